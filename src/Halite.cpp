@@ -22,6 +22,8 @@
 
 #include "global/logger.hpp"
 #include "halConfig.hpp"
+#include "halEventLog.hpp"
+#include "halSpans.hpp"
 
 #include "HaliteWindow.hpp"
 #include "SplashDialog.hpp"
@@ -45,6 +47,7 @@ Halite::Halite() :
 #	endif
 	showMessage_(true),
 	logToFile_(true),
+	traceSpans_(false),
 	logListLen_(128)
 {
 	hal::event_log().init();
@@ -134,6 +137,7 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
 	halite_log_file_.connect();
 
 	int return_result = -1;
+	boost::scoped_ptr<hal::binary_event_log> trace_log;
 
 	try 
 	{
@@ -212,6 +216,20 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
 	}
 	else
 	{
+		// Only the instance that owns the mutex writes the binary trace.
+		if (halite().logToFile())
+		{
+			trace_log.reset(new hal::binary_event_log(hal::app().get_working_directory()/L"logs"));
+			trace_log->connect();
+		}
+
+		// Spans from startup on, written out as a Chrome trace when Halite exits.
+		if (halite().traceSpans())
+		{
+			hal::spans().enable();
+			hal::spans().name_thread("UI");
+		}
+
 		HAL_DEV_MSG(hal::wform(L"App Data Path: %1%.") % *hal::app().get_local_appdata());
 		HAL_DEV_MSG(hal::wform(L"Exe Path: %1%.") % hal::app().exe_path());
 		HAL_DEV_MSG(hal::wform(L"Initial Path: %1%.") % hal::app().initial_path());
@@ -242,6 +260,9 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
 		_Module.RemoveMessageLoop();
 
 		halite().save_to_ini();
+
+		if (hal::spans().enabled())
+			hal::spans().write_chrome_trace(hal::app().get_working_directory()/L"logs"/L"HaliteTrace.json");
 	}
 	}
 
@@ -273,6 +294,10 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
 	{
 		MessageBox(0, L"WinMain() catch all", L"Exception Thrown!", 0);
 	}
+
+	// Flush the log while the log files are still connected.
+	hal::event_log().shutdown();
+	trace_log.reset();
 	
 	return return_result;
 }
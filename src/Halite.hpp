@@ -92,6 +92,9 @@ public:
 
 		switch (version)
 		{
+		case 6:
+			ar & make_nvp("trace_spans", traceSpans_);
+
 		case 5:
 			ar & make_nvp("one_inst", oneInst);
 			ar & make_nvp("show_message", showMessage_);
@@ -123,6 +126,7 @@ public:
 	const std::wstring& dll() { return dll_; }
 	const int logListLen() { return static_cast<int>(logListLen_); }
 	bool showMessage() { return showMessage_; }
+	bool traceSpans() { return traceSpans_; }
 	
 	friend class GeneralOptions;
 	friend class GlobalOptions;
@@ -137,9 +141,10 @@ private:
 	bool logDebug_;
 	bool showMessage_;
 	bool logToFile_;
+	bool traceSpans_;
 	size_t logListLen_;
 };
 
 Halite& halite();
 
-BOOST_CLASS_VERSION(Halite, 5)
+BOOST_CLASS_VERSION(Halite, 6)
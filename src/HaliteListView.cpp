@@ -40,7 +40,8 @@ HaliteListViewCtrl::HaliteListViewCtrl(HaliteWindow& HalWindow) :
 	halite_window_(HalWindow),
 	ini_class_t(L"listviews/halite", L"halite_listview"),
 	editing_lock_(false),
-	queue_view_(false)
+	queue_view_(false),
+	details_version_(0)
 {		
 	HalWindow.connectUiUpdate(bind(&HaliteListViewCtrl::uiUpdate, this, _1));
 }
@@ -120,14 +121,58 @@ DWORD HaliteListViewCtrl::OnItemPrePaint(int idCtrl, LPNMCUSTOMDRAW lpNMCD)
 	return CDRF_DODEFAULT;
 }
 
+hal::torrent_details_ptr HaliteListViewCtrl::details(const hal::uuid& id) const
+{
+	if (snapshot_)
+		return snapshot_->find(id);
+	else
+		return hal::bittorrent().torrentDetails().get(id);
+}
+
+void HaliteListViewCtrl::sort_column(size_t index, bool descending)
+{
+	if (snapshot_ && hal::torrent_details_columns::has(index))
+	{
+		std::vector<size_t> rows;
+		rows.reserve(GetItemCount());
+
+		for (int i = 0, e = GetItemCount(); i != e; ++i)
+		{
+			if (boost::optional<size_t> row = snapshot_->row(key_from_index(i)))
+				rows.push_back(*row);
+			else
+				break;
+		}
+
+		// Every row has details, so the keys can be gathered once instead of per comparison.
+		if (rows.size() == static_cast<size_t>(GetItemCount()))
+		{
+			snapshot_->columns().visit(index, [&](auto column)
+			{
+				std::vector<typename std::remove_const<typename std::remove_pointer<decltype(column)>::type>::type> keys;
+				keys.reserve(rows.size());
+
+				for (size_t row : rows)
+					keys.push_back(column[row]);
+
+				sort_by_keys(keys, descending);
+			});
+
+			return;
+		}
+	}
+
+	sort(index, descending);
+}
+
 bool HaliteListViewCtrl::sort_list_comparison(list_class_data_t l, list_class_data_t r, size_t index, bool ascending)
 {
 	try
 	{
 
-	if (hal::torrent_details_ptr left = hal::bittorrent().torrentDetails().get(l))
+	if (hal::torrent_details_ptr left = details(l))
 	{
-		if (hal::torrent_details_ptr right = hal::bittorrent().torrentDetails().get(r))
+		if (hal::torrent_details_ptr right = details(r))
 			return hal::hal_details_ptr_compare(left, right, index, ascending);
 		else
 			return true;	// Huh?
@@ -151,7 +196,7 @@ LRESULT HaliteListViewCtrl::OnGetDispInfo(int, LPNMHDR pnmh, BOOL&)
 		return 0;
 	
 	NMLVDISPINFO* pdi = (NMLVDISPINFO*)pnmh;
-	hal::torrent_details_ptr td = hal::bittorrent().torrentDetails().get(key_from_index(pdi->item.iItem));
+	hal::torrent_details_ptr td = details(key_from_index(pdi->item.iItem));
 
 	if (td && pdi->item.mask & LVIF_TEXT)
 	{
@@ -204,45 +249,127 @@ LRESULT HaliteListViewCtrl::OnEndLabelEdit(int i, LPNMHDR pnmh, BOOL&)
 	return false;
 }
 
+HaliteListViewCtrl::sort_order HaliteListViewCtrl::current_sort_order(bool sort_once)
+{
+	sort_order order;
+
+	if (queue_view_)
+		order.push_back(std::make_pair(static_cast<size_t>(hal::torrent_details::managed_e), false));
+
+	if (sort_once || AutoSort())
+	{
+		if (GetSortColumn() != -1)
+		{		
+			int index = GetColumnSortType(GetSortColumn());				
+			if (index > WTL::LVCOLSORT_LAST)
+				order.push_back(std::make_pair(static_cast<size_t>(index - (WTL::LVCOLSORT_LAST+1+hal::torrent_details::name_e)), IsSortDescending()));
+		}
+
+		if (GetSecondarySortColumn() != -1)
+		{
+			int index = GetColumnSortType(GetSecondarySortColumn());					
+			if (index > WTL::LVCOLSORT_LAST)
+				order.push_back(std::make_pair(static_cast<size_t>(index - (WTL::LVCOLSORT_LAST+1+hal::torrent_details::name_e)), IsSecondarySortDescending()));
+		}
+	}
+
+	return order;
+}
+
+bool HaliteListViewCtrl::sort_less(const hal::uuid& l, const hal::uuid& r, const sort_order& order)
+{
+	BOOST_FOREACH (const sort_order::value_type& level, order)
+	{
+		// Operands swapped to match the comparison sort() hands to sort_list_comparison.
+		if (sort_list_comparison(r, l, level.first, level.second))
+			return true;
+		else if (sort_list_comparison(l, r, level.first, level.second))
+			return false;
+	}
+
+	return false;
+}
+
 void HaliteListViewCtrl::uiUpdate(const hal::torrent_details_manager& tD)
 {
 	if (hal::try_update_lock<list_class_t> lock{ this })
 	{		
 
+	hal::torrent_details_delta delta = tD.changes_since(details_version_);
+	bool changed = delta.reset || !delta.added.empty() || !delta.removed.empty() || !delta.changed.empty();
+
+	// Nothing was published since the last pass and the user hasn't asked for a sort. Only
+	// peek at the sort flag here, the sort below is what consumes it.
+	if (!changed && !IsSortOnce(false))
+		return;
+
+	// Rows are drawn and sorted from this snapshot until the next update.
+	snapshot_ = tD.snapshot();
+
 	selection_from_listview();
 		
-	std::set<hal::uuid> torrent_set;
-	BOOST_FOREACH (hal::torrent_details_ptr t,  tD.torrents())
+	std::set<hal::uuid> dirty;
+
+	if (delta.reset)
 	{
-		torrent_set.insert(t->uuid());
+		std::set<hal::uuid> torrent_set;
+
+		BOOST_FOREACH (hal::torrent_details_ptr t,  *snapshot_)
+		{
+			torrent_set.insert(t->uuid());
+		}
+		
+		erase_based_on_set(torrent_set, true);
+		set_keys(torrent_set);
 	}
-	
-	erase_based_on_set(torrent_set, true);	
+	else
+	{
+		BOOST_FOREACH (const hal::uuid& id, delta.removed)
+		{
+			erase_from_list(id);
+		}
+
+		set_keys(delta.added);
+
+		dirty = delta.added;
+		dirty.insert(delta.changed.begin(), delta.changed.end());
+	}
+
+	details_version_ = delta.to;
 
 	if (!editing_lock_)
 	{
-		if (IsSortOnce() || AutoSort())
+		bool sort_once = IsSortOnce();
+		sort_order order = current_sort_order(sort_once);
+
+		if (!order.empty() && !sort_once && !delta.reset && order == sorted_by_)
 		{
-			if (GetSecondarySortColumn() != -1)
-			{
-				int index = GetColumnSortType(GetSecondarySortColumn());					
-				if (index > WTL::LVCOLSORT_LAST)
-					sort(index - (WTL::LVCOLSORT_LAST+1+hal::torrent_details::name_e), IsSecondarySortDescending());
-			}
-
-			if (GetSortColumn() != -1)
-			{		
-				int index = GetColumnSortType(GetSortColumn());				
-				if (index > WTL::LVCOLSORT_LAST)
-					sort(index - (WTL::LVCOLSORT_LAST+1+hal::torrent_details::name_e), IsSortDescending());
-			}
+			// Still in order from the last pass apart from the torrents that changed.
+			if (!dirty.empty())
+				merge_keys(dirty, [&](const hal::uuid& l, const hal::uuid& r) { return sort_less(l, r, order); });
 		}
-		
-		if (queue_view_)
-			sort(hal::torrent_details::managed_e, false);
+		else
+		{
+			for (sort_order::const_reverse_iterator i = order.rbegin(), e = order.rend(); i != e; ++i)
+				sort_column(i->first, i->second);
+		}
+
+		sorted_by_ = order;
+	}
+	else
+	{
+		// Changed rows aren't being moved, so the next sort has to start from scratch.
+		sorted_by_.clear();
 	}
 
-	set_keys(torrent_set);	
+	// Rows may have moved, so every row needs its selection state put back.
+	std::vector<hal::uuid> keys;
+	keys.reserve(GetItemCount());
+
+	for (int i = 0, e = GetItemCount(); i != e; ++i)
+		keys.push_back(key_from_index(i));
+
+	set_keys(keys);	
 	InvalidateRect(NULL,true);
 
 	}
@@ -649,6 +649,62 @@ protected:
 		pair_container_.rearrange(sv.begin());
 	}
 
+	// Stable sort on precomputed keys, keys[i] belongs to the row currently at index i.
+	template<typename Key>
+	void sort_by_keys(const std::vector<Key>& keys, bool descending)
+	{
+		std::vector<std::pair<Key, size_t> > order;
+		order.reserve(keys.size());
+
+		for (size_t i = 0, e = keys.size(); i != e; ++i)
+			order.push_back(std::make_pair(keys[i], i));
+
+		if (descending)
+			std::stable_sort(order.begin(), order.end(), 
+				[](const std::pair<Key, size_t>& l, const std::pair<Key, size_t>& r) { return r.first < l.first; });
+		else
+			std::stable_sort(order.begin(), order.end(), 
+				[](const std::pair<Key, size_t>& l, const std::pair<Key, size_t>& r) { return l.first < r.first; });
+
+		std::vector<implicit_reference_wrapper<const list_pair_t> > sv;
+		sv.reserve(order.size());
+
+		for (size_t i = 0, e = order.size(); i != e; ++i)
+			sv.push_back(pair_container_[order[i].second]);
+
+		pair_container_.rearrange(sv.begin());
+	}
+
+	// For when only the rows in 'dirty' changed since the list was last sorted by 'less'. The
+	// other rows are still in order, so only the dirty ones are sorted and then merged back.
+	template<typename Less>
+	void merge_keys(const std::set<DataType>& dirty, Less less)
+	{
+		typedef implicit_reference_wrapper<const list_pair_t> row_ref;
+
+		std::vector<row_ref> clean, moved;
+		clean.reserve(pair_container_.size());
+
+		for (pair_container::const_iterator i = pair_container_.begin(), e = pair_container_.end(); i != e; ++i)
+		{
+			if (dirty.find((*i).second) != dirty.end())
+				moved.push_back(*i);
+			else
+				clean.push_back(*i);
+		}
+
+		auto row_less = [&less](const row_ref& l, const row_ref& r) { return less(l.get().second, r.get().second); };
+
+		std::stable_sort(moved.begin(), moved.end(), row_less);
+
+		std::vector<row_ref> sv;
+		sv.reserve(pair_container_.size());
+
+		std::merge(clean.begin(), clean.end(), moved.begin(), moved.end(), std::back_inserter(sv), row_less);
+
+		pair_container_.rearrange(sv.begin());
+	}
+
 	DataType key_from_index(size_t index)
 	{
 		list_pair_t pi = pair_container_[index];
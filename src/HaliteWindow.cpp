@@ -21,6 +21,7 @@
 
 #include "ConfigOptions.hpp"
 #include "halConfig.hpp"
+#include "halSpans.hpp"
 
 HaliteWindow::HaliteWindow(unsigned areYouMe = 0) :
 	ini_class_t(L"halite_window", L"halite_window"),
@@ -67,6 +68,7 @@ LRESULT HaliteWindow::OnCreate(LPCREATESTRUCT lpcs)
 	try
 	{
 	HAL_DEV_MSG(L"HaliteWindow::OnCreate");
+	HAL_SPAN("HaliteWindow::OnCreate");
 	
 	SetWindowText(L"Halite");
 	MoveWindow(rect.left, rect.top,	rect.right-rect.left, rect.bottom-rect.top, false);	
@@ -77,7 +79,10 @@ LRESULT HaliteWindow::OnCreate(LPCREATESTRUCT lpcs)
 	hal::event_log().set_debug_logging(true);
 	hal::event_log().post(shared_ptr<hal::EventDetail>(
 		new hal::EventMsg(L"Loading Halite configuration ...")));
-	hal::config().load_from_ini();
+	{	HAL_SPAN("Load configuration");
+
+		hal::config().load_from_ini();
+	}
 	hal::config().set_callback(boost::bind(&HaliteWindow::runProgressCommand, this, _1, _2));
 
 	hal::event_log().post(shared_ptr<hal::EventDetail>(
@@ -16,6 +16,7 @@
 #include "global/logger.hpp"
 
 #include "../halEvent.hpp"
+#include "../halEventHistory.hpp"
 #include "../HaliteTabPage.hpp"
 #include "../HaliteListManager.hpp"
 #include "../HaliteDialogBase.hpp"
@@ -93,7 +94,9 @@ public:
 	END_MSG_MAP()
 
 	LogListViewCtrl() :
-		ini_class_t(L"listviews/event_log", L"log_listview")
+		ini_class_t(L"listviews/event_log", L"log_listview"),
+		next_event_(0),
+		post_pending_(false)
 	{}
 	
 	~LogListViewCtrl()
@@ -127,43 +130,27 @@ public:
 		}
 	}
 
+	// The event is already in the history, only wake the window if it isn't about to look.
 	void operator()(shared_ptr<hal::EventDetail> event)
 	{
-		hal::mutex_t::scoped_lock l(mutex_);
-
-		try
-		{
-		events_.push_back(event);
-		
-		PostMessage(WM_USER_LOGPOST, 0, 0);
-		
-		}
-		catch(...)
-		{}
+		if (!post_pending_.exchange(true))
+			PostMessage(WM_USER_LOGPOST, 0, 0);
 	}
 
 	LRESULT OnMessageLogPost(UINT uMsg, WPARAM wParam, LPARAM lParam)
 	{
 		hal::mutex_t::scoped_lock l(mutex_);
 
+		post_pending_ = false;
+
 		try
 		{
-		shared_ptr<hal::EventDetail> event(*events_.begin());
-
-		int itemPos = AddItem(0, 0, lexical_cast<wstring>(event->timeStamp()).c_str());
-		SetItemText(itemPos, 1, event->msg().c_str());
-
-		SetItemText(itemPos, 2, hal::event_logger::eventLevelToStr(event->level()).c_str());
-			
-		if (halite().logListLen() <= GetItemCount())
-			DeleteItem(halite().logListLen());
+		pull_events();
 
 		}
 		catch(...)
 		{}
 
-		events_.pop_front();
-
 		return 0;
 	}
 
@@ -193,6 +180,35 @@ private:
 		safe_load_from_ini();
 		
 		conn_ = hal::event_log().attach(bind(&LogListViewCtrl::operator(), this, _1));
+
+		// Start with what was logged before the window existed.
+		next_event_ = hal::event_log().history().first();
+		pull_events();
+	}
+
+	// Anything more than the list can show is skipped rather than added and deleted again.
+	void pull_events()
+	{
+		const hal::event_history& history = hal::event_log().history();
+		size_t list_len = halite().logListLen();
+
+		boost::uint64_t next = history.next();
+		if (next - next_event_ > list_len)
+			next_event_ = next - list_len;
+
+		std::vector<shared_ptr<hal::EventDetail> > events;
+		next_event_ = history.read(next_event_, events, list_len);
+
+		for (const shared_ptr<hal::EventDetail>& event : events)
+		{
+			int itemPos = AddItem(0, 0, lexical_cast<wstring>(event->timeStamp()).c_str());
+			SetItemText(itemPos, 1, event->msg().c_str());
+
+			SetItemText(itemPos, 2, hal::event_logger::eventLevelToStr(event->level()).c_str());
+		}
+			
+		while (GetItemCount() > static_cast<int>(list_len))
+			DeleteItem(GetItemCount() - 1);
 	}
 
 	void OnDestroy()
@@ -205,7 +221,9 @@ private:
 
 	mutable hal::mutex_t mutex_;
 	boost::signals2::connection conn_;
-	std::deque<shared_ptr<hal::EventDetail> > events_;
+
+	boost::uint64_t next_event_;
+	std::atomic<bool> post_pending_;
 };
 
 class AdvDebugDialog :
@@ -0,0 +1,439 @@
+//         Copyright Ein O'Callaghan 2009 - 2009.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Replays alerts recorded from a session through AlertHandler's alert handling as it was,
+// an alert_cast chain, and as it is, alert_dispatch_table.
+//
+//	halAlertBench [--torrents <n>] [--alerts <n>]
+//
+// A session with the alert mask bit_impl sets has synthetic torrents added, updated, saved,
+// paused and resumed, and what it raises is popped in one go. The recording is then replayed
+// until --alerts have been through each path. Torrents are held in a hashed index by info
+// hash as torrent_manager holds them and the handlers only count, so what's measured is the
+// dispatch and the torrent lookups.
+//
+// chain is handle_alert_alt before the table: its eight alert_casts in its order, each branch
+// looking its torrent up from the handle as many times as it called get() in a release build.
+// table is handle_alert_alt now: the nine production entries, a torrent alert's torrent looked
+// up once under a recursive mutex as AlertHandler::get takes bit_impl's, and every torrent in
+// a state_update_alert looked up by info hash. The chain had no state_update_alert branch, so
+// those go unhandled there and the table does more work for them.
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/chrono.hpp>
+#include <boost/format.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/program_options.hpp>
+#include <boost/thread/recursive_mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <libtorrent/alert_types.hpp>
+#include <libtorrent/bencode.hpp>
+#include <libtorrent/create_torrent.hpp>
+#include <libtorrent/hasher.hpp>
+#include <libtorrent/session.hpp>
+#include <libtorrent/settings_pack.hpp>
+#include <libtorrent/torrent_info.hpp>
+
+#include "../halAlertDispatch.hpp"
+
+namespace po = boost::program_options;
+namespace libt = libtorrent;
+
+namespace
+{
+
+typedef boost::chrono::steady_clock clock_type;
+
+double elapsed_ms(clock_type::time_point start)
+{
+	return boost::chrono::duration<double, boost::milli>(clock_type::now() - start).count();
+}
+
+struct no_torrent {};
+
+struct torrent_stub
+{
+	torrent_stub() : touched(0) {}
+
+	size_t touched;
+};
+
+typedef boost::shared_ptr<torrent_stub> torrent_ptr;
+
+// As torrent_manager's big_number_hash.
+struct info_hash_hash
+{
+	std::size_t operator()(const libt::sha1_hash& h) const
+	{
+		std::size_t v;
+		std::memcpy(&v, &h[0], sizeof(v));
+
+		return v;
+	}
+};
+
+class torrent_index
+{
+public:
+	void insert(const libt::sha1_hash& h)
+	{
+		index_[h] = boost::make_shared<torrent_stub>();
+	}
+
+	torrent_ptr get(const libt::torrent_handle& h) const
+	{
+		if (!h.is_valid())
+			throw no_torrent();
+
+		return get(h.info_hash());
+	}
+
+	torrent_ptr get(const libt::sha1_hash& h) const
+	{
+		index_map::const_iterator i = index_.find(h);
+
+		if (i == index_.end())
+			throw no_torrent();
+
+		return i->second;
+	}
+
+	size_t touched() const
+	{
+		size_t t = 0;
+		for (index_map::const_iterator i = index_.begin(), e = index_.end(); i != e; ++i)
+			t += i->second->touched;
+
+		return t;
+	}
+
+private:
+	typedef boost::unordered_map<libt::sha1_hash, torrent_ptr, info_hash_hash> index_map;
+
+	index_map index_;
+};
+
+// handle_alert_alt's alert_cast chain, one ++touched wherever it called get().
+class chain_handler
+{
+public:
+	explicit chain_handler(torrent_index& t) :
+		torrents_(t)
+	{}
+
+	bool handle(libt::alert* a)
+	{
+		if (auto* p = libt::alert_cast<libt::add_torrent_alert>(a))
+		{
+			use(p->handle, 3);
+		}
+		else if (auto* p = libt::alert_cast<libt::torrent_removed_alert>(a))
+		{
+			++torrents_.get(p->info_hash)->touched;
+		}
+		else if (auto* p = libt::alert_cast<libt::save_resume_data_alert>(a))
+		{
+			use(p->handle, p->resume_data ? 3 : 2);
+		}
+		else if (auto* p = libt::alert_cast<libt::torrent_paused_alert>(a))
+		{
+			use(p->handle, 3);
+		}
+		else if (auto* p = libt::alert_cast<libt::torrent_resumed_alert>(a))
+		{
+			use(p->handle, 2);
+		}
+		else if (auto* p = libt::alert_cast<libt::torrent_finished_alert>(a))
+		{
+			use(p->handle, 2);
+		}
+		else if (auto* p = libt::alert_cast<libt::save_resume_data_failed_alert>(a))
+		{
+			use(p->handle, 2);
+		}
+		else if (libt::alert_cast<libt::state_changed_alert>(a))
+		{
+			// Its only get() was in a HAL_DEV_MSG.
+		}
+		else
+			return false;
+
+		return true;
+	}
+
+private:
+	void use(const libt::torrent_handle& h, int gets)
+	{
+		for (int i = 0; i < gets; ++i)
+			++torrents_.get(h)->touched;
+	}
+
+	torrent_index& torrents_;
+};
+
+// AlertHandler's table and its dispatch and dispatch_torrent.
+class table_handler
+{
+public:
+	explicit table_handler(torrent_index& t) :
+		torrents_(t)
+	{}
+
+	bool handle(libt::alert* a)
+	{
+		if (dispatch_fn fn = dispatch_table().find(a->type()))
+		{
+			try
+			{
+				fn(*this, a);
+			}
+			catch (const no_torrent&)
+			{}
+
+			return true;
+		}
+		else
+			return false;
+	}
+
+private:
+	typedef hal::alert_dispatch_table<table_handler>::dispatch_fn dispatch_fn;
+
+	torrent_ptr get(const libt::torrent_handle& h) const
+	{
+		if (!h.is_valid())
+			throw no_torrent();
+
+		return get(h.info_hash());
+	}
+
+	torrent_ptr get(const libt::sha1_hash& h) const
+	{
+		boost::recursive_mutex::scoped_lock l(mutex_);
+
+		return torrents_.get(h);
+	}
+
+	template<typename A, void (table_handler::*F)(A&)>
+	static void dispatch(table_handler& h, libt::alert* a)
+	{
+		(h.*F)(*static_cast<A*>(a));
+	}
+
+	template<typename A, void (table_handler::*F)(A&, torrent_stub&)>
+	static void dispatch_torrent(table_handler& h, libt::alert* a)
+	{
+		A& p = *static_cast<A*>(a);
+		torrent_ptr t = h.get(p.handle);
+
+		(h.*F)(p, *t);
+	}
+
+	static const hal::alert_dispatch_table<table_handler>& dispatch_table()
+	{
+		static const hal::alert_dispatch_table<table_handler> table = make_dispatch_table();
+		return table;
+	}
+
+	static hal::alert_dispatch_table<table_handler> make_dispatch_table()
+	{
+		hal::alert_dispatch_table<table_handler> t;
+
+		t.add<libt::add_torrent_alert>(&dispatch_torrent<libt::add_torrent_alert, &table_handler::on_torrent>);
+		t.add<libt::torrent_removed_alert>(&dispatch<libt::torrent_removed_alert, &table_handler::on_torrent_removed>);
+		t.add<libt::save_resume_data_alert>(&dispatch_torrent<libt::save_resume_data_alert, &table_handler::on_torrent>);
+		t.add<libt::torrent_paused_alert>(&dispatch_torrent<libt::torrent_paused_alert, &table_handler::on_torrent>);
+		t.add<libt::torrent_resumed_alert>(&dispatch_torrent<libt::torrent_resumed_alert, &table_handler::on_torrent>);
+		t.add<libt::torrent_finished_alert>(&dispatch_torrent<libt::torrent_finished_alert, &table_handler::on_torrent>);
+		t.add<libt::save_resume_data_failed_alert>(&dispatch_torrent<libt::save_resume_data_failed_alert, &table_handler::on_torrent>);
+		t.add<libt::state_changed_alert>(&dispatch_torrent<libt::state_changed_alert, &table_handler::on_torrent>);
+		t.add<libt::state_update_alert>(&dispatch<libt::state_update_alert, &table_handler::on_state_update>);
+
+		return t;
+	}
+
+	template<typename A>
+	void on_torrent(A&, torrent_stub& t)
+	{
+		++t.touched;
+	}
+
+	void on_torrent_removed(libt::torrent_removed_alert& p)
+	{
+		++get(p.info_hash)->touched;
+	}
+
+	void on_state_update(libt::state_update_alert& p)
+	{
+		for (const libt::torrent_status& ts : p.status)
+		{
+			try
+			{
+				++get(ts.info_hash)->touched;
+			}
+			catch (const no_torrent&)
+			{}
+		}
+	}
+
+	torrent_index& torrents_;
+	mutable boost::recursive_mutex mutex_;
+};
+
+boost::shared_ptr<libt::torrent_info> make_torrent(size_t i)
+{
+	const int piece_size = 256 * 1024;
+	std::string name = (boost::format("Some.Synthetic.Torrent.Name.%1%") % i).str();
+
+	libt::file_storage storage;
+	storage.add_file(name + "/data.bin", static_cast<boost::int64_t>(piece_size) * 64);
+
+	libt::create_torrent ct(storage, piece_size);
+	ct.add_tracker("http://127.0.0.1:1/announce");
+
+	for (int p = 0; p < ct.num_pieces(); ++p)
+	{
+		std::string seed = (boost::format("%1%.%2%") % i % p).str();
+		ct.set_hash(p, libt::hasher(seed.data(), static_cast<int>(seed.size())).final());
+	}
+
+	std::vector<char> buffer;
+	libt::bencode(std::back_inserter(buffer), ct.generate());
+
+	return boost::make_shared<libt::torrent_info>(&buffer[0], static_cast<int>(buffer.size()));
+}
+
+// The alerts stay valid until the session pops again or goes, so it's the caller's.
+void record(libt::session& s, size_t torrents, std::vector<libt::sha1_hash>& hashes, 
+	std::vector<libt::alert*>& alerts)
+{
+	std::vector<libt::torrent_handle> handles;
+
+	for (size_t i = 0; i < torrents; ++i)
+	{
+		libt::add_torrent_params p;
+
+		p.ti = make_torrent(i);
+		p.save_path = ".";
+		p.flags = libt::add_torrent_params::flag_update_subscribe;
+
+		hashes.push_back(p.ti->info_hash());
+		handles.push_back(s.add_torrent(p));
+	}
+
+	s.post_torrent_updates();
+
+	for (libt::torrent_handle& h : handles)
+		h.save_resume_data();
+
+	for (libt::torrent_handle& h : handles)
+		h.pause();
+
+	s.post_torrent_updates();
+
+	for (libt::torrent_handle& h : handles)
+		h.resume();
+
+	s.post_torrent_updates();
+
+	// Whatever is still in flight has a moment to land, then it's all taken in one pop.
+	boost::this_thread::sleep(boost::posix_time::seconds(2));
+	s.pop_alerts(&alerts);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	size_t torrents = 100;
+	size_t total = 1000000;
+
+	po::options_description desc("Options");
+	desc.add_options()
+		("help", "show this message")
+		("torrents", po::value<size_t>(&torrents), "torrents added while recording, 100 by default")
+		("alerts", po::value<size_t>(&total), "alerts replayed per path, 1000000 by default");
+
+	try
+	{
+
+	po::variables_map vm;
+	po::store(po::parse_command_line(argc, argv, desc), vm);
+	po::notify(vm);
+
+	if (vm.count("help"))
+	{
+		std::cout << "halAlertBench [options]\n" << desc << std::endl;
+		return 1;
+	}
+
+	libt::settings_pack pack;
+	pack.set_str(libt::settings_pack::listen_interfaces, "127.0.0.1:0");
+	pack.set_bool(libt::settings_pack::enable_dht, false);
+	pack.set_bool(libt::settings_pack::enable_lsd, false);
+	pack.set_bool(libt::settings_pack::enable_upnp, false);
+	pack.set_bool(libt::settings_pack::enable_natpmp, false);
+	pack.set_int(libt::settings_pack::alert_mask, 
+		libt::alert::error_notification | libt::alert::status_notification);
+	pack.set_int(libt::settings_pack::alert_queue_size, 1000000);
+
+	libt::session s(pack);
+
+	std::vector<libt::sha1_hash> hashes;
+	std::vector<libt::alert*> recorded;
+
+	record(s, torrents, hashes, recorded);
+
+	if (recorded.empty())
+		throw std::runtime_error("the session raised no alerts");
+
+	torrent_index chain_index, table_index;
+
+	for (const libt::sha1_hash& h : hashes)
+	{
+		chain_index.insert(h);
+		table_index.insert(h);
+	}
+
+	chain_handler chain(chain_index);
+	table_handler table(table_index);
+
+	size_t chain_handled = 0, table_handled = 0;
+	clock_type::time_point start = clock_type::now();
+
+	for (size_t n = 0; n < total; ++n)
+		if (chain.handle(recorded[n % recorded.size()])) ++chain_handled;
+
+	double chain_ms = elapsed_ms(start);
+	start = clock_type::now();
+
+	for (size_t n = 0; n < total; ++n)
+		if (table.handle(recorded[n % recorded.size()])) ++table_handled;
+
+	double table_ms = elapsed_ms(start);
+
+	std::cout << recorded.size() << " alerts recorded from " << torrents << " torrents, " 
+			<< total << " replayed per path\n"
+		<< boost::format("%-8s %12s %12s %12s %12s\n") 
+			% "path" % "total ms" % "ns/alert" % "handled" % "lookups"
+		<< boost::format("%-8s %12.1f %12.1f %12d %12d\n") 
+			% "chain" % chain_ms % (chain_ms * 1e6 / total) % chain_handled % chain_index.touched()
+		<< boost::format("%-8s %12.1f %12.1f %12d %12d\n") 
+			% "table" % table_ms % (table_ms * 1e6 / total) % table_handled % table_index.touched();
+
+	return 0;
+
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "halAlertBench: " << e.what() << std::endl;
+		return 1;
+	}
+}
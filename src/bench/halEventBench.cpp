@@ -0,0 +1,325 @@
+
+//         Copyright Ein O'Callaghan 2009 - 2009.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Measures how long event posts keep the posting thread when several threads post at once,
+// through the queue event_logger now uses and through the lock and synchronous signal it
+// replaced.
+//
+//	halEventBench [--threads <n>] [--events <n>]
+//
+// The queued run pushes onto bounded_mpsc_queue and wakes a dispatcher thread the way
+// event_impl does, the dispatcher delivering in batches under its lock. A full queue is
+// waited out as keep_important does for warnings, so nothing is dropped and both runs deliver
+// every event. The subscriber keeps a bounded history in both runs.
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/chrono.hpp>
+#include <boost/format.hpp>
+#include <boost/program_options.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/signals2.hpp>
+#include <boost/thread.hpp>
+
+#include "../halEventQueue.hpp"
+
+namespace po = boost::program_options;
+
+namespace
+{
+
+typedef boost::chrono::steady_clock clock_type;
+
+struct event
+{
+	event(size_t t, size_t n) :
+		msg((boost::wformat(L"Producer %1% event %2%, something happened to a torrent") % t % n).str())
+	{}
+
+	std::wstring msg;
+};
+
+typedef boost::shared_ptr<event> event_ptr;
+
+class history
+{
+public:
+	history() :
+		chars_(0)
+	{}
+
+	void append(const event_ptr& e)
+	{
+		events_.push_back(e);
+		chars_ += e->msg.size();
+
+		if (events_.size() > 16384)
+			events_.pop_front();
+	}
+
+	size_t chars() const { return chars_; }
+
+private:
+	std::deque<event_ptr> events_;
+	size_t chars_;
+};
+
+// What event_logger::post did before, the subscriber runs on the poster's thread under the
+// one lock.
+class synchronous_logger
+{
+public:
+	synchronous_logger()
+	{
+		signal_.connect(boost::bind(&history::append, &history_, _1));
+	}
+
+	void post(const event_ptr& e)
+	{
+		boost::recursive_mutex::scoped_lock l(mutex_);
+		signal_(e);
+	}
+
+	void stop() {}
+
+	const history& delivered() const { return history_; }
+
+private:
+	boost::recursive_mutex mutex_;
+	boost::signals2::signal<void (event_ptr)> signal_;
+	history history_;
+};
+
+// event_impl's post, wake and dispatch without the drop accounting.
+class queued_logger
+{
+public:
+	queued_logger() :
+		queue_(8192),
+		running_(true),
+		sleeping_(false)
+	{
+		signal_.connect(boost::bind(&history::append, &history_, _1));
+		dispatcher_.reset(new boost::thread(boost::bind(&queued_logger::dispatch, this)));
+	}
+
+	void post(const event_ptr& e)
+	{
+		while (!queue_.try_push(e))
+		{
+			wake();
+			boost::this_thread::yield();
+		}
+
+		wake();
+	}
+
+	void stop()
+	{
+		{	boost::mutex::scoped_lock l(wake_mutex_);
+			running_ = false;
+		}
+		wake_.notify_one();
+
+		dispatcher_->join();
+	}
+
+	const history& delivered() const { return history_; }
+
+private:
+	void wake()
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		if (sleeping_.exchange(false))
+		{
+			boost::mutex::scoped_lock l(wake_mutex_);
+			wake_.notify_one();
+		}
+	}
+
+	void dispatch()
+	{
+		std::vector<event_ptr> batch;
+		batch.reserve(256);
+
+		for ( ; ; )
+		{
+			event_ptr e;
+
+			while (batch.size() < 256 && queue_.try_pop(e))
+				batch.push_back(e);
+
+			if (batch.empty())
+			{
+				boost::mutex::scoped_lock l(wake_mutex_);
+
+				sleeping_ = true;
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+
+				if (queue_.empty())
+				{
+					if (!running_) break;
+
+					wake_.timed_wait(l, boost::posix_time::milliseconds(100));
+				}
+
+				sleeping_ = false;
+				continue;
+			}
+
+			{	boost::recursive_mutex::scoped_lock l(mutex_);
+
+				for (const event_ptr& d : batch)
+					signal_(d);
+			}
+
+			batch.clear();
+		}
+	}
+
+	hal::bounded_mpsc_queue<event_ptr> queue_;
+	boost::recursive_mutex mutex_;
+	boost::signals2::signal<void (event_ptr)> signal_;
+	history history_;
+
+	std::atomic<bool> running_;
+	std::atomic<bool> sleeping_;
+	boost::mutex wake_mutex_;
+	boost::condition_variable wake_;
+	boost::scoped_ptr<boost::thread> dispatcher_;
+};
+
+struct result
+{
+	std::vector<double> latencies_ns;
+	double wall_ms;
+	size_t delivered_chars;
+};
+
+// Events are made before the clock starts, only the post itself is timed.
+template<typename Logger>
+result run(size_t threads, size_t events)
+{
+	Logger logger;
+
+	std::vector<std::vector<double> > latencies(threads);
+	boost::barrier start_line(static_cast<unsigned>(threads + 1));
+	boost::thread_group producers;
+
+	for (size_t t = 0; t < threads; ++t)
+		producers.create_thread([&, t]()
+		{
+			std::vector<event_ptr> pending;
+			pending.reserve(events);
+
+			for (size_t n = 0; n < events; ++n)
+				pending.push_back(event_ptr(new event(t, n)));
+
+			std::vector<double>& lat = latencies[t];
+			lat.reserve(events);
+
+			start_line.wait();
+
+			for (const event_ptr& e : pending)
+			{
+				clock_type::time_point before = clock_type::now();
+				logger.post(e);
+
+				lat.push_back(boost::chrono::duration<double, boost::nano>(clock_type::now() - before).count());
+			}
+		});
+
+	start_line.wait();
+	clock_type::time_point start = clock_type::now();
+
+	producers.join_all();
+	logger.stop();
+
+	result r;
+	r.wall_ms = boost::chrono::duration<double, boost::milli>(clock_type::now() - start).count();
+	r.delivered_chars = logger.delivered().chars();
+
+	for (const std::vector<double>& lat : latencies)
+		r.latencies_ns.insert(r.latencies_ns.end(), lat.begin(), lat.end());
+
+	std::sort(r.latencies_ns.begin(), r.latencies_ns.end());
+
+	return r;
+}
+
+double percentile(const std::vector<double>& sorted, double p)
+{
+	size_t i = static_cast<size_t>(p / 100 * (sorted.size() - 1));
+	return sorted[i];
+}
+
+void report(const char* name, const result& r)
+{
+	const std::vector<double>& l = r.latencies_ns;
+
+	std::cout << boost::format("%-12s %10.0f %10.0f %10.0f %10.0f %12.0f %12.1f\n")
+		% name % percentile(l, 50) % percentile(l, 90) % percentile(l, 99) % percentile(l, 99.9) 
+		% l.back() % r.wall_ms;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	size_t threads = 8;
+	size_t events = 200000;
+
+	po::options_description desc("Options");
+	desc.add_options()
+		("help", "show this message")
+		("threads", po::value<size_t>(&threads), "posting threads, 8 by default")
+		("events", po::value<size_t>(&events), "events posted by each thread, 200000 by default");
+
+	try
+	{
+
+	po::variables_map vm;
+	po::store(po::parse_command_line(argc, argv, desc), vm);
+	po::notify(vm);
+
+	if (vm.count("help"))
+	{
+		std::cout << "halEventBench [options]\n" << desc << std::endl;
+		return 1;
+	}
+
+	threads = std::max<size_t>(threads, 1);
+	events = std::max<size_t>(events, 1);
+
+	result synchronous = run<synchronous_logger>(threads, events);
+	result queued = run<queued_logger>(threads, events);
+
+	if (synchronous.delivered_chars != queued.delivered_chars)
+		throw std::runtime_error("the runs delivered different events");
+
+	std::cout << threads << " threads posting " << events << " events each, post latency in ns\n"
+		<< boost::format("%-12s %10s %10s %10s %10s %12s %12s\n") 
+			% "run" % "p50" % "p90" % "p99" % "p99.9" % "max" % "wall ms";
+
+	report("synchronous", synchronous);
+	report("queued", queued);
+
+	return 0;
+
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "halEventBench: " << e.what() << std::endl;
+		return 1;
+	}
+}
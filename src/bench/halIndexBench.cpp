@@ -0,0 +1,257 @@
+
+//         Copyright Ein O'Callaghan 2009 - 2009.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Compares torrent_manager's lookups on ordered and hashed indexes, and the duplicate check
+// start_all used to make against the single pass insert_holder makes now.
+//
+//	halIndexBench [--torrents <n> ...] [--lookups <n>] [--quadratic-limit <n>]
+//
+// The container mirrors torrent_manager's torrent_holder, a uuid, a name and a 20 byte
+// info-hash hashed on its leading bytes as big_number_hash does. Lookups are for keys picked
+// at random from those present. The old duplicate check counted each torrent's hash over the
+// whole hash index, it is only run up to --quadratic-limit torrents.
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/array.hpp>
+#include <boost/chrono.hpp>
+#include <boost/format.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/program_options.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+#include <boost/uuid/random_generator.hpp>
+#include <boost/uuid/uuid.hpp>
+
+namespace po = boost::program_options;
+namespace mi = boost::multi_index;
+
+namespace
+{
+
+typedef boost::chrono::steady_clock clock_type;
+typedef boost::array<unsigned char, 20> info_hash;
+
+struct big_number_hash
+{
+	std::size_t operator()(const info_hash& h) const
+	{
+		std::size_t v;
+		std::memcpy(&v, &h[0], sizeof(v));
+
+		return v;
+	}
+};
+
+struct holder
+{
+	boost::uuids::uuid id;
+	std::wstring name;
+	info_hash hash;
+};
+
+struct by_uuid{};
+struct by_name{};
+struct by_hash{};
+
+typedef boost::multi_index_container<
+	holder,
+	mi::indexed_by<
+		mi::ordered_unique<
+			mi::tag<by_uuid>, mi::member<holder, boost::uuids::uuid, &holder::id> >,
+		mi::ordered_non_unique<
+			mi::tag<by_name>, mi::member<holder, std::wstring, &holder::name> >,
+		mi::ordered_non_unique<
+			mi::tag<by_hash>, mi::member<holder, info_hash, &holder::hash> >
+	>
+> ordered_index;
+
+typedef boost::multi_index_container<
+	holder,
+	mi::indexed_by<
+		mi::hashed_unique<
+			mi::tag<by_uuid>, mi::member<holder, boost::uuids::uuid, &holder::id>,
+			boost::hash<boost::uuids::uuid> >,
+		mi::ordered_non_unique<
+			mi::tag<by_name>, mi::member<holder, std::wstring, &holder::name> >,
+		mi::hashed_non_unique<
+			mi::tag<by_hash>, mi::member<holder, info_hash, &holder::hash>,
+			big_number_hash >
+	>
+> hashed_index;
+
+std::vector<holder> make_holders(size_t n, boost::random::mt19937& rng)
+{
+	boost::uuids::basic_random_generator<boost::random::mt19937> gen(rng);
+	boost::random::uniform_int_distribution<int> byte(0, 255);
+
+	std::vector<holder> holders(n);
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		holders[i].id = gen();
+		holders[i].name = (boost::wformat(L"Some.Synthetic.Torrent.Name.%1%") % i).str();
+
+		for (size_t b = 0; b < holders[i].hash.size(); ++b)
+			holders[i].hash[b] = static_cast<unsigned char>(byte(rng));
+	}
+
+	return holders;
+}
+
+double elapsed_ms(clock_type::time_point start)
+{
+	return boost::chrono::duration<double, boost::milli>(clock_type::now() - start).count();
+}
+
+// The sum keeps the finds from being optimized away.
+template<typename Tag, typename Index, typename Key>
+double lookup_ns(const Index& index, const std::vector<Key>& keys, size_t& found)
+{
+	const typename Index::template index<Tag>::type& idx = index.template get<Tag>();
+
+	clock_type::time_point start = clock_type::now();
+
+	for (const Key& k : keys)
+		if (idx.find(k) != idx.end()) ++found;
+
+	return elapsed_ms(start) * 1e6 / keys.size();
+}
+
+// What start_all did before, a count over the hash index for every torrent.
+double quadratic_check_ms(const ordered_index& index, size_t& duplicates)
+{
+	const ordered_index::index<by_hash>::type& hashes = index.get<by_hash>();
+
+	clock_type::time_point start = clock_type::now();
+
+	for (const holder& h : index.get<by_uuid>())
+		if (std::count_if(hashes.begin(), hashes.end(), 
+				[&h](const holder& o) { return o.hash == h.hash; }) > 1)
+			++duplicates;
+
+	return elapsed_ms(start);
+}
+
+// What insert_holder does now, each insert checked against the hashed index as it goes in.
+double single_pass_ms(const std::vector<holder>& holders, size_t& duplicates)
+{
+	clock_type::time_point start = clock_type::now();
+
+	hashed_index index;
+
+	for (const holder& h : holders)
+	{
+		if (index.get<by_hash>().count(h.hash) != 0)
+			++duplicates;
+		else
+			index.insert(h);
+	}
+
+	return elapsed_ms(start);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	std::vector<size_t> sizes;
+	size_t lookups = 1000000;
+	size_t quadratic_limit = 20000;
+
+	po::options_description desc("Options");
+	desc.add_options()
+		("help", "show this message")
+		("torrents", po::value<std::vector<size_t> >(&sizes)->multitoken(), "torrent counts to run, 1000 10000 50000 by default")
+		("lookups", po::value<size_t>(&lookups), "random finds per index, 1000000 by default")
+		("quadratic-limit", po::value<size_t>(&quadratic_limit), "largest count the old duplicate check is run for");
+
+	try
+	{
+
+	po::variables_map vm;
+	po::store(po::parse_command_line(argc, argv, desc), vm);
+	po::notify(vm);
+
+	if (vm.count("help"))
+	{
+		std::cout << "halIndexBench [options]\n" << desc << std::endl;
+		return 1;
+	}
+
+	if (sizes.empty())
+	{
+		sizes.push_back(1000);
+		sizes.push_back(10000);
+		sizes.push_back(50000);
+	}
+
+	lookups = std::max<size_t>(lookups, 1);
+
+	std::cout << boost::format("%8s %12s %12s %12s %12s %14s %14s\n") 
+		% "torrents" % "uuid ord ns" % "uuid hash ns" % "hash ord ns" % "hash hash ns" 
+		% "old check ms" % "one pass ms";
+
+	boost::random::mt19937 rng(42);
+	size_t found = 0;
+
+	for (size_t n : sizes)
+	{
+		if (n == 0) continue;
+
+		std::vector<holder> holders = make_holders(n, rng);
+
+		ordered_index ordered(holders.begin(), holders.end());
+		hashed_index hashed(holders.begin(), holders.end());
+
+		boost::random::uniform_int_distribution<size_t> pick(0, n - 1);
+		std::vector<boost::uuids::uuid> uuids(lookups);
+		std::vector<info_hash> hashes(lookups);
+
+		for (size_t i = 0; i < lookups; ++i)
+		{
+			const holder& h = holders[pick(rng)];
+			uuids[i] = h.id;
+			hashes[i] = h.hash;
+		}
+
+		double uuid_ordered = lookup_ns<by_uuid>(ordered, uuids, found);
+		double uuid_hashed = lookup_ns<by_uuid>(hashed, uuids, found);
+		double hash_ordered = lookup_ns<by_hash>(ordered, hashes, found);
+		double hash_hashed = lookup_ns<by_hash>(hashed, hashes, found);
+
+		size_t duplicates = 0;
+		std::string old_check = "skipped";
+
+		if (n <= quadratic_limit)
+			old_check = (boost::format("%.1f") % quadratic_check_ms(ordered, duplicates)).str();
+
+		double one_pass = single_pass_ms(holders, duplicates);
+
+		std::cout << boost::format("%8d %12.1f %12.1f %12.1f %12.1f %14s %14.1f\n") 
+			% n % uuid_ordered % uuid_hashed % hash_ordered % hash_hashed % old_check % one_pass;
+	}
+
+	if (found == 0)
+		std::cout << "nothing found" << std::endl;
+
+	return 0;
+
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "halIndexBench: " << e.what() << std::endl;
+		return 1;
+	}
+}
@@ -0,0 +1,276 @@
+
+//         Copyright Ein O'Callaghan 2009 - 2009.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Compares saving and loading every torrent's resume data, torrent info and .torrent file
+// as three files each and through pack_store.
+//
+//	halPackBench [--torrents <n>] [--resume-bytes <n>] [--info-bytes <n>] [--dir <path>]
+//
+// Save all writes every record, resave rewrites only the resume data as a session's periodic
+// save does, load all finds and reads every record back. The files go where Halite keeps them,
+// resume/<name>.fastresume, resume/<name>.torrent_info and torrents/<name>.torrent, and are
+// found with a directory scan. The pack is committed once per pass and loaded by opening it.
+// Nothing is done about the file cache, it's warm for every pass.
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/chrono.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/format.hpp>
+#include <boost/program_options.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+
+#include "../halPackStore.hpp"
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+namespace libt = libtorrent;
+
+namespace
+{
+
+typedef boost::chrono::steady_clock clock_type;
+
+double elapsed_ms(clock_type::time_point start)
+{
+	return boost::chrono::duration<double, boost::milli>(clock_type::now() - start).count();
+}
+
+struct torrent
+{
+	std::wstring name;
+	libt::sha1_hash hash;
+	std::vector<char> resume;
+	std::vector<char> info;
+};
+
+std::vector<torrent> make_torrents(size_t n, size_t resume_bytes, size_t info_bytes)
+{
+	boost::random::mt19937 rng(42);
+	boost::random::uniform_int_distribution<int> byte(0, 255);
+
+	std::vector<torrent> torrents(n);
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		torrent& t = torrents[i];
+
+		t.name = (boost::wformat(L"Some.Synthetic.Torrent.Name.%1%") % i).str();
+
+		for (libt::sha1_hash::iterator b = t.hash.begin(), e = t.hash.end(); b != e; ++b)
+			*b = static_cast<unsigned char>(byte(rng));
+
+		t.resume.resize(resume_bytes);
+		t.info.resize(info_bytes);
+
+		for (char& c : t.resume) c = static_cast<char>(byte(rng));
+		for (char& c : t.info) c = static_cast<char>(byte(rng));
+	}
+
+	return torrents;
+}
+
+void write_file(const fs::wpath& file, const std::vector<char>& data)
+{
+	fs::ofstream out(file, std::ios_base::binary | std::ios_base::trunc);
+	out.write(data.data(), data.size());
+
+	if (!out)
+		throw std::runtime_error("can't write " + file.string());
+}
+
+void read_file(const fs::wpath& file, std::vector<char>& data)
+{
+	fs::ifstream in(file, std::ios_base::binary);
+
+	data.resize(static_cast<size_t>(fs::file_size(file)));
+	if (!data.empty() && !in.read(&data[0], data.size()))
+		throw std::runtime_error("can't read " + file.string());
+}
+
+boost::uintmax_t directory_bytes(const fs::wpath& dir)
+{
+	boost::uintmax_t bytes = 0;
+
+	for (fs::recursive_directory_iterator i(dir), e; i != e; ++i)
+		if (fs::is_regular_file(i->status())) bytes += fs::file_size(i->path());
+
+	return bytes;
+}
+
+struct timing
+{
+	double save_ms;
+	double resave_ms;
+	double load_ms;
+	boost::uintmax_t bytes;
+	size_t loaded;
+};
+
+timing run_files(const std::vector<torrent>& torrents, const fs::wpath& dir)
+{
+	fs::wpath resume = dir / L"resume";
+	fs::wpath files = dir / L"torrents";
+
+	fs::create_directories(resume);
+	fs::create_directories(files);
+
+	timing t;
+	clock_type::time_point start = clock_type::now();
+
+	for (const torrent& tor : torrents)
+	{
+		write_file(resume / (tor.name + L".fastresume"), tor.resume);
+		write_file(resume / (tor.name + L".torrent_info"), tor.info);
+		write_file(files / (tor.name + L".torrent"), tor.info);
+	}
+
+	t.save_ms = elapsed_ms(start);
+	start = clock_type::now();
+
+	for (const torrent& tor : torrents)
+		write_file(resume / (tor.name + L".fastresume"), tor.resume);
+
+	t.resave_ms = elapsed_ms(start);
+	start = clock_type::now();
+
+	std::vector<char> data;
+	t.loaded = 0;
+
+	for (fs::wpath d : { resume, files })
+		for (fs::directory_iterator i(d), e; i != e; ++i)
+		{
+			read_file(i->path(), data);
+			++t.loaded;
+		}
+
+	t.load_ms = elapsed_ms(start);
+	t.bytes = directory_bytes(dir);
+
+	return t;
+}
+
+timing run_pack(const std::vector<torrent>& torrents, const fs::wpath& dir)
+{
+	fs::create_directories(dir);
+	fs::wpath file = dir / L"torrents.pack";
+
+	timing t;
+	clock_type::time_point start = clock_type::now();
+
+	{	hal::pack_store pack(file);
+
+		for (const torrent& tor : torrents)
+		{
+			pack.put(tor.hash, hal::pack_store::fastresume, tor.resume.data(), tor.resume.size());
+			pack.put(tor.hash, hal::pack_store::torrent_info, tor.info.data(), tor.info.size());
+			pack.put(tor.hash, hal::pack_store::torrent_file, tor.info.data(), tor.info.size());
+		}
+
+		pack.commit();
+
+		t.save_ms = elapsed_ms(start);
+		start = clock_type::now();
+
+		for (const torrent& tor : torrents)
+			pack.put(tor.hash, hal::pack_store::fastresume, tor.resume.data(), tor.resume.size());
+
+		pack.commit();
+
+		t.resave_ms = elapsed_ms(start);
+	}
+
+	start = clock_type::now();
+
+	{	hal::pack_store pack(file);
+
+		std::vector<char> data;
+		t.loaded = 0;
+
+		for (const torrent& tor : torrents)
+		{
+			if (pack.get(tor.hash, hal::pack_store::fastresume, data)) ++t.loaded;
+			if (pack.get(tor.hash, hal::pack_store::torrent_info, data)) ++t.loaded;
+			if (pack.get(tor.hash, hal::pack_store::torrent_file, data)) ++t.loaded;
+		}
+
+		t.load_ms = elapsed_ms(start);
+	}
+
+	t.bytes = fs::file_size(file);
+
+	return t;
+}
+
+void report(const char* name, const timing& t)
+{
+	std::cout << boost::format("%-6s %12.1f %12.1f %12.1f %10d %14d\n")
+		% name % t.save_ms % t.resave_ms % t.load_ms % t.loaded % t.bytes;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	size_t torrents = 10000;
+	size_t resume_bytes = 2048;
+	size_t info_bytes = 8192;
+	std::string dir = ".";
+
+	po::options_description desc("Options");
+	desc.add_options()
+		("help", "show this message")
+		("torrents", po::value<size_t>(&torrents), "number of synthetic torrents, 10000 by default")
+		("resume-bytes", po::value<size_t>(&resume_bytes), "size of each resume record, 2048 by default")
+		("info-bytes", po::value<size_t>(&info_bytes), "size of each torrent info and .torrent record, 8192 by default")
+		("dir", po::value<std::string>(&dir), "where the files and the pack are written");
+
+	try
+	{
+
+	po::variables_map vm;
+	po::store(po::parse_command_line(argc, argv, desc), vm);
+	po::notify(vm);
+
+	if (vm.count("help"))
+	{
+		std::cout << "halPackBench [options]\n" << desc << std::endl;
+		return 1;
+	}
+
+	std::vector<torrent> records = make_torrents(torrents, resume_bytes, info_bytes);
+
+	fs::wpath root = fs::wpath(dir) / L"halPackBench";
+	fs::remove_all(root);
+
+	timing files = run_files(records, root / L"files");
+	timing pack = run_pack(records, root / L"pack");
+
+	if (files.loaded != pack.loaded)
+		throw std::runtime_error("the runs loaded different numbers of records");
+
+	std::cout << torrents << " torrents, " << 3 * torrents << " records\n"
+		<< boost::format("%-6s %12s %12s %12s %10s %14s\n") 
+			% "store" % "save all ms" % "resave ms" % "load all ms" % "records" % "bytes";
+
+	report("files", files);
+	report("pack", pack);
+
+	fs::remove_all(root);
+
+	return 0;
+
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "halPackBench: " << e.what() << std::endl;
+		return 1;
+	}
+}
@@ -0,0 +1,295 @@
+
+//         Copyright Ein O'Callaghan 2009 - 2009.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Times a start_all's worth of torrents from their .torrent files to the session's
+// add_torrent_alerts.
+//
+//	halStartBench [--torrents <n>] [--pieces <n>] [--dir <path>]
+//
+// Synthetic torrents are written out once. Each run then parses them and adds them paused
+// to a fresh session, reporting when the first and the last add_torrent_alert came back.
+// The serial run parses and adds one torrent after another as not_started used to, the
+// prefetch run parses on a pool sized as torrent_manager::prefetch_torrent_info sizes it
+// before adding any.
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/chrono.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/format.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/program_options.hpp>
+#include <boost/thread.hpp>
+
+#include <libtorrent/alert_types.hpp>
+#include <libtorrent/bencode.hpp>
+#include <libtorrent/create_torrent.hpp>
+#include <libtorrent/hasher.hpp>
+#include <libtorrent/session.hpp>
+#include <libtorrent/settings_pack.hpp>
+#include <libtorrent/torrent_info.hpp>
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+namespace libt = libtorrent;
+
+namespace
+{
+
+typedef boost::chrono::steady_clock clock_type;
+typedef boost::shared_ptr<libt::torrent_info> torrent_info_ptr;
+
+double elapsed_ms(clock_type::time_point start)
+{
+	return boost::chrono::duration<double, boost::milli>(clock_type::now() - start).count();
+}
+
+// Eight files per torrent and made up piece hashes, there's no payload behind them.
+std::vector<fs::path> write_torrents(size_t n, int pieces, const fs::path& dir)
+{
+	const int piece_size = 256 * 1024;
+
+	fs::create_directories(dir);
+	std::vector<fs::path> files;
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		std::string name = (boost::format("Some.Synthetic.Torrent.Name.%1%") % i).str();
+
+		libt::file_storage storage;
+		for (int f = 0; f < 8; ++f)
+			storage.add_file((boost::format("%1%/Track %2%.flac") % name % f).str(),
+				static_cast<boost::int64_t>(piece_size) * pieces / 8);
+
+		libt::create_torrent ct(storage, piece_size);
+		ct.add_tracker("http://tracker.example.org:6969/announce");
+
+		for (int p = 0; p < ct.num_pieces(); ++p)
+		{
+			std::string seed = (boost::format("%1%.%2%") % i % p).str();
+			ct.set_hash(p, libt::hasher(seed.data(), static_cast<int>(seed.size())).final());
+		}
+
+		std::vector<char> buffer;
+		libt::bencode(std::back_inserter(buffer), ct.generate());
+
+		fs::path file = dir / (name + ".torrent");
+		fs::ofstream out(file, std::ios_base::binary);
+		out.write(buffer.data(), buffer.size());
+
+		if (!out)
+			throw std::runtime_error("can't write " + file.string());
+
+		files.push_back(file);
+	}
+
+	return files;
+}
+
+torrent_info_ptr parse(const fs::path& file)
+{
+	return boost::make_shared<libt::torrent_info>(file.string());
+}
+
+std::vector<torrent_info_ptr> parse_pooled(const std::vector<fs::path>& files)
+{
+	std::vector<torrent_info_ptr> infos(files.size());
+	std::atomic<size_t> next(0);
+
+	unsigned workers = std::max(1u, std::min(boost::thread::hardware_concurrency(), 8u));
+	boost::thread_group pool;
+
+	for (unsigned n = 0; n < workers && n < files.size(); ++n)
+		pool.create_thread([&]()
+		{
+			for (size_t j = next++; j < files.size(); j = next++)
+				infos[j] = parse(files[j]);
+		});
+
+	pool.join_all();
+
+	return infos;
+}
+
+libt::settings_pack quiet_settings(size_t n)
+{
+	libt::settings_pack pack;
+
+	pack.set_str(libt::settings_pack::listen_interfaces, "127.0.0.1:0");
+	pack.set_bool(libt::settings_pack::enable_dht, false);
+	pack.set_bool(libt::settings_pack::enable_lsd, false);
+	pack.set_bool(libt::settings_pack::enable_upnp, false);
+	pack.set_bool(libt::settings_pack::enable_natpmp, false);
+	pack.set_int(libt::settings_pack::alert_mask, 
+		libt::alert::status_notification | libt::alert::error_notification);
+	pack.set_int(libt::settings_pack::alert_queue_size, static_cast<int>(n) + 1000);
+
+	return pack;
+}
+
+struct timing
+{
+	double parsed_ms;
+	double first_added_ms;
+	double all_added_ms;
+	size_t failed;
+};
+
+class adder
+{
+public:
+	adder(libt::session& s, const fs::path& save) :
+		session_(s),
+		save_(save.string())
+	{}
+
+	void add(const torrent_info_ptr& info)
+	{
+		libt::add_torrent_params p;
+
+		p.ti = info;
+		p.save_path = save_;
+		p.flags = libt::add_torrent_params::flag_paused;
+
+		session_.async_add_torrent(p);
+	}
+
+	// Returns once n torrents have been added or have failed to be.
+	void wait(size_t n, clock_type::time_point start, timing& t)
+	{
+		size_t seen = 0;
+		t.failed = 0;
+		t.first_added_ms = 0;
+
+		std::vector<libt::alert*> alerts;
+
+		while (seen < n)
+		{
+			if (!session_.wait_for_alert(libt::seconds(30)))
+				throw std::runtime_error("timed out waiting for add_torrent_alert");
+
+			session_.pop_alerts(&alerts);
+
+			for (libt::alert* a : alerts)
+			{
+				if (libt::add_torrent_alert* p = libt::alert_cast<libt::add_torrent_alert>(a))
+				{
+					if (seen++ == 0) 
+						t.first_added_ms = elapsed_ms(start);
+
+					if (p->error) ++t.failed;
+				}
+			}
+		}
+
+		t.all_added_ms = elapsed_ms(start);
+	}
+
+private:
+	libt::session& session_;
+	std::string save_;
+};
+
+timing run_serial(const std::vector<fs::path>& files, const fs::path& save)
+{
+	libt::session s(quiet_settings(files.size()));
+	adder a(s, save);
+
+	timing t;
+	clock_type::time_point start = clock_type::now();
+
+	for (const fs::path& f : files)
+		a.add(parse(f));
+
+	t.parsed_ms = elapsed_ms(start);
+	a.wait(files.size(), start, t);
+
+	return t;
+}
+
+timing run_prefetch(const std::vector<fs::path>& files, const fs::path& save)
+{
+	libt::session s(quiet_settings(files.size()));
+	adder a(s, save);
+
+	timing t;
+	clock_type::time_point start = clock_type::now();
+
+	std::vector<torrent_info_ptr> infos = parse_pooled(files);
+	t.parsed_ms = elapsed_ms(start);
+
+	for (const torrent_info_ptr& info : infos)
+		a.add(info);
+
+	a.wait(files.size(), start, t);
+
+	return t;
+}
+
+void report(const char* name, const timing& t)
+{
+	std::cout << boost::format("%-10s %12.1f %14.1f %14.1f %8d\n")
+		% name % t.parsed_ms % t.first_added_ms % t.all_added_ms % t.failed;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	size_t torrents = 5000;
+	int pieces = 2048;
+	std::string dir = ".";
+
+	po::options_description desc("Options");
+	desc.add_options()
+		("help", "show this message")
+		("torrents", po::value<size_t>(&torrents), "number of synthetic torrents, 5000 by default")
+		("pieces", po::value<int>(&pieces), "pieces per torrent, 2048 by default")
+		("dir", po::value<std::string>(&dir), "where the torrent files are written");
+
+	try
+	{
+
+	po::variables_map vm;
+	po::store(po::parse_command_line(argc, argv, desc), vm);
+	po::notify(vm);
+
+	if (vm.count("help"))
+	{
+		std::cout << "halStartBench [options]\n" << desc << std::endl;
+		return 1;
+	}
+
+	fs::path root = fs::path(dir) / "halStartBench";
+	std::vector<fs::path> files = write_torrents(torrents, std::max(pieces, 8), root / "torrents");
+
+	// The prefetch run goes first so the serial one, not it, gets the warm file cache.
+	timing prefetch = run_prefetch(files, root / "data");
+	timing serial = run_serial(files, root / "data");
+
+	std::cout << torrents << " torrents of " << pieces << " pieces\n"
+		<< boost::format("%-10s %12s %14s %14s %8s\n") 
+			% "run" % "parsed ms" % "first add ms" % "all added ms" % "failed";
+
+	report("serial", serial);
+	report("prefetch", prefetch);
+
+	fs::remove_all(root);
+
+	return 0;
+
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "halStartBench: " << e.what() << std::endl;
+		return 1;
+	}
+}
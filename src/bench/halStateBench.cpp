@@ -0,0 +1,420 @@
+
+//         Copyright Ein O'Callaghan 2009 - 2009.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Compares saving and loading the torrent state as XML and as a binary archive.
+//
+//	halStateBench [--torrents <n>] [--rounds <n>] [--dir <path>]
+//
+// The records are synthetic but shaped like torrent_internal's serialize, the same mix of
+// strings, paths, numbers, times and per torrent tracker and file lists, written as a count
+// and one record after another as torrent_manager does. XML is buffered and stored as UTF-16
+// as work_file does, the binary archive goes to and from the file as it is.
+
+#include <iostream>
+#include <locale>
+#include <codecvt>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/xml_wiarchive.hpp>
+#include <boost/archive/xml_woarchive.hpp>
+#include <boost/chrono.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/date_time/posix_time/time_serialize.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/format.hpp>
+#include <boost/program_options.hpp>
+#include <boost/serialization/nvp.hpp>
+#include <boost/serialization/string.hpp>
+#include <boost/serialization/vector.hpp>
+#include <boost/uuid/random_generator.hpp>
+#include <boost/uuid/uuid_io.hpp>
+#include <boost/uuid/uuid_serialize.hpp>
+
+namespace po = boost::program_options;
+namespace pt = boost::posix_time;
+namespace fs = boost::filesystem;
+
+using boost::serialization::make_nvp;
+
+namespace
+{
+
+typedef boost::chrono::steady_clock clock_type;
+
+struct tracker
+{
+	std::wstring url;
+	int tier;
+
+	template<class Archive>
+	void serialize(Archive& ar, const unsigned int)
+	{
+		ar & make_nvp("url", url);
+		ar & make_nvp("tier", tier);
+	}
+};
+
+struct file
+{
+	std::wstring path;
+	boost::int64_t size;
+	int priority;
+	bool finished;
+
+	template<class Archive>
+	void serialize(Archive& ar, const unsigned int)
+	{
+		ar & make_nvp("path", path);
+		ar & make_nvp("size", size);
+		ar & make_nvp("priority", priority);
+		ar & make_nvp("finished", finished);
+	}
+};
+
+struct torrent
+{
+	boost::uuids::uuid id;
+	std::wstring name;
+	std::wstring filename;
+	std::wstring original_filename;
+	std::wstring save_directory;
+	std::wstring move_to_directory;
+	std::wstring magnet_uri;
+	std::wstring tracker_username;
+	std::wstring tracker_password;
+	std::string hash;
+
+	float transfer_limit_down;
+	float transfer_limit_up;
+	int connections;
+	int uploads;
+	float ratio;
+	int allocation;
+	int state;
+	int queue_position;
+
+	bool resolve_countries;
+	bool managed;
+	bool superseeding;
+	bool compact_storage;
+
+	boost::int64_t total_uploaded;
+	boost::int64_t total_base;
+	boost::int64_t total_downloaded;
+
+	pt::ptime added;
+	pt::ptime completed;
+	pt::time_duration active_duration;
+	pt::time_duration seeding_duration;
+
+	std::vector<tracker> trackers;
+	std::vector<file> files;
+
+	template<class Archive>
+	void serialize(Archive& ar, const unsigned int)
+	{
+		ar & make_nvp("uuid", id);
+		ar & make_nvp("name", name);
+		ar & make_nvp("filename", filename);
+		ar & make_nvp("original_filename", original_filename);
+		ar & make_nvp("save_directory", save_directory);
+		ar & make_nvp("move_to_directory", move_to_directory);
+		ar & make_nvp("magnet_uri", magnet_uri);
+		ar & make_nvp("tracker_username", tracker_username);
+		ar & make_nvp("tracker_password", tracker_password);
+		ar & make_nvp("hash", hash);
+
+		ar & make_nvp("transfer_limit_down", transfer_limit_down);
+		ar & make_nvp("transfer_limit_up", transfer_limit_up);
+		ar & make_nvp("connections", connections);
+		ar & make_nvp("uploads", uploads);
+		ar & make_nvp("ratio", ratio);
+		ar & make_nvp("allocation", allocation);
+		ar & make_nvp("state", state);
+		ar & make_nvp("queue_position", queue_position);
+
+		ar & make_nvp("resolve_countries", resolve_countries);
+		ar & make_nvp("managed", managed);
+		ar & make_nvp("superseeding", superseeding);
+		ar & make_nvp("compact_storage", compact_storage);
+
+		ar & make_nvp("total_uploaded", total_uploaded);
+		ar & make_nvp("total_base", total_base);
+		ar & make_nvp("total_downloaded", total_downloaded);
+
+		ar & make_nvp("added", added);
+		ar & make_nvp("completed", completed);
+		ar & make_nvp("active_duration", active_duration);
+		ar & make_nvp("seeding_duration", seeding_duration);
+
+		ar & make_nvp("trackers", trackers);
+		ar & make_nvp("files", files);
+	}
+};
+
+struct state
+{
+	std::vector<torrent> torrents;
+
+	template<class Archive>
+	void save(Archive& ar, const unsigned int) const
+	{
+		boost::uint64_t count = torrents.size();
+		ar & make_nvp("count", count);
+
+		for (const torrent& t : torrents)
+			ar & make_nvp("torrent", t);
+	}
+
+	template<class Archive>
+	void load(Archive& ar, const unsigned int)
+	{
+		boost::uint64_t count = 0;
+		ar & make_nvp("count", count);
+
+		torrents.clear();
+		torrents.reserve(static_cast<size_t>(count));
+
+		for (boost::uint64_t n = 0; n != count; ++n)
+		{
+			torrent t;
+			ar & make_nvp("torrent", t);
+
+			torrents.push_back(t);
+		}
+	}
+
+	BOOST_SERIALIZATION_SPLIT_MEMBER()
+};
+
+state make_state(size_t n)
+{
+	boost::uuids::random_generator gen;
+	pt::ptime now = pt::second_clock::universal_time();
+
+	state s;
+	s.torrents.reserve(n);
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		torrent t;
+		std::wstring name = (boost::wformat(L"Some.Synthetic.Torrent.Name.%1%") % i).str();
+
+		t.id = gen();
+		t.name = name;
+		t.filename = name + L".torrent";
+		t.original_filename = name + L".torrent";
+		t.save_directory = L"C:\\Users\\someone\\Downloads\\Incoming";
+		t.move_to_directory = L"C:\\Users\\someone\\Downloads";
+		t.hash = (boost::format("%040x") % i).str();
+
+		t.transfer_limit_down = -1;
+		t.transfer_limit_up = -1;
+		t.connections = -1;
+		t.uploads = -1;
+		t.ratio = 2.0f;
+		t.allocation = 1;
+		t.state = static_cast<int>(i % 4);
+		t.queue_position = static_cast<int>(i);
+
+		t.resolve_countries = true;
+		t.managed = (i % 3) == 0;
+		t.superseeding = false;
+		t.compact_storage = false;
+
+		t.total_uploaded = 1024 * 1024 * static_cast<boost::int64_t>(i);
+		t.total_base = 0;
+		t.total_downloaded = 4 * 1024 * 1024 * static_cast<boost::int64_t>(i);
+
+		t.added = now - pt::hours(static_cast<long>(i));
+		t.completed = now;
+		t.active_duration = pt::seconds(static_cast<long>(i * 60));
+		t.seeding_duration = pt::seconds(static_cast<long>(i * 30));
+
+		for (int j = 0; j < 3; ++j)
+		{
+			tracker tr = { (boost::wformat(L"http://tracker%1%.example.org:6969/announce") % j).str(), j };
+			t.trackers.push_back(tr);
+		}
+
+		for (int j = 0; j < 8; ++j)
+		{
+			file f = { (boost::wformat(L"%1%\\Disc %2%\\Track %3%.flac") % name % (j / 4) % j).str(),
+				32 * 1024 * 1024, 1, true };
+			t.files.push_back(f);
+		}
+
+		s.torrents.push_back(t);
+	}
+
+	return s;
+}
+
+void imbue_utf16(std::wios& s)
+{
+	s.imbue(std::locale(s.getloc(),
+		new std::codecvt_utf16<wchar_t, 0x10ffff, std::little_endian>));
+}
+
+double elapsed_ms(clock_type::time_point start)
+{
+	return boost::chrono::duration<double, boost::milli>(clock_type::now() - start).count();
+}
+
+struct timing
+{
+	double save_ms;
+	double load_ms;
+};
+
+timing run_xml(const state& s, const fs::path& file)
+{
+	timing t;
+	clock_type::time_point start = clock_type::now();
+
+	{	std::wostringstream body;
+
+		{	boost::archive::xml_woarchive oa(body);
+			oa << make_nvp("bittorrent", s);
+		}
+
+		fs::wofstream ofs(file, std::ios_base::out | std::ios_base::trunc);
+		imbue_utf16(ofs);
+
+		ofs << body.str();
+	}
+
+	t.save_ms = elapsed_ms(start);
+	start = clock_type::now();
+
+	state loaded;
+	{	fs::wifstream ifs(file);
+		imbue_utf16(ifs);
+
+		std::wostringstream contents;
+		contents << ifs.rdbuf();
+
+		std::wistringstream body(contents.str());
+
+		boost::archive::xml_wiarchive ia(body);
+		ia >> make_nvp("bittorrent", loaded);
+	}
+
+	t.load_ms = elapsed_ms(start);
+
+	if (loaded.torrents.size() != s.torrents.size())
+		throw std::runtime_error("XML round trip lost torrents");
+
+	return t;
+}
+
+timing run_binary(const state& s, const fs::path& file)
+{
+	timing t;
+	clock_type::time_point start = clock_type::now();
+
+	{	fs::ofstream ofs(file, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+
+		boost::archive::binary_oarchive oa(ofs);
+		oa << make_nvp("bittorrent", s);
+	}
+
+	t.save_ms = elapsed_ms(start);
+	start = clock_type::now();
+
+	state loaded;
+	{	fs::ifstream ifs(file, std::ios_base::in | std::ios_base::binary);
+
+		boost::archive::binary_iarchive ia(ifs);
+		ia >> make_nvp("bittorrent", loaded);
+	}
+
+	t.load_ms = elapsed_ms(start);
+
+	if (loaded.torrents.size() != s.torrents.size())
+		throw std::runtime_error("binary round trip lost torrents");
+
+	return t;
+}
+
+void report(const char* format, const std::vector<timing>& runs, const fs::path& file)
+{
+	timing best = runs.front();
+
+	for (const timing& t : runs)
+	{
+		best.save_ms = std::min(best.save_ms, t.save_ms);
+		best.load_ms = std::min(best.load_ms, t.load_ms);
+	}
+
+	std::cout << boost::format("%-8s %12.1f %12.1f %14d\n")
+		% format % best.save_ms % best.load_ms % fs::file_size(file);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	size_t torrents = 20000;
+	size_t rounds = 3;
+	std::string dir = ".";
+
+	po::options_description desc("Options");
+	desc.add_options()
+		("help", "show this message")
+		("torrents", po::value<size_t>(&torrents), "number of synthetic torrents, 20000 by default")
+		("rounds", po::value<size_t>(&rounds), "save and load this many times, the best is shown")
+		("dir", po::value<std::string>(&dir), "where the state files are written");
+
+	try
+	{
+
+	po::variables_map vm;
+	po::store(po::parse_command_line(argc, argv, desc), vm);
+	po::notify(vm);
+
+	if (vm.count("help"))
+	{
+		std::cout << "halStateBench [options]\n" << desc << std::endl;
+		return 1;
+	}
+
+	state s = make_state(torrents);
+
+	fs::path xml_file = fs::path(dir) / "bench_state.xml";
+	fs::path binary_file = fs::path(dir) / "bench_state.bin";
+
+	std::vector<timing> xml_runs, binary_runs;
+
+	for (size_t r = 0; r < std::max<size_t>(rounds, 1); ++r)
+	{
+		xml_runs.push_back(run_xml(s, xml_file));
+		binary_runs.push_back(run_binary(s, binary_file));
+	}
+
+	std::cout << torrents << " torrents, best of " << xml_runs.size() << "\n"
+		<< boost::format("%-8s %12s %12s %14s\n") % "format" % "save ms" % "load ms" % "bytes";
+
+	report("xml", xml_runs, xml_file);
+	report("binary", binary_runs, binary_file);
+
+	fs::remove(xml_file);
+	fs::remove(binary_file);
+
+	return 0;
+
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "halStateBench: " << e.what() << std::endl;
+		return 1;
+	}
+}
@@ -7,40 +7,97 @@
 #ifndef GLOBAL_VERSIONED_FILE
 #define GLOBAL_VERSIONED_FILE
 
+#include <sstream>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/crc.hpp>
+#include <boost/optional.hpp>
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_io.hpp>
 
+#include "logger.hpp"
+#include "string_conv.hpp"
 #include "work_file.hpp"
 
 namespace hal 
 {
 
+// The header is the uuid, the version and then the generation, counting every save, and a
+// checksum of everything after the header. Text files from before there was a generation
+// line load as generation 0 without a check.
 class file_header
 {
 public:	
+	struct info
+	{
+		int version;
+		boost::uint64_t generation;
+		boost::uint32_t checksum;
+		bool checked;
+	};
+
 	file_header(const boost::uuids::uuid& u, int v) :
 		uuid_(u),
 		version_(v)
 	{}
 
-	std::pair<bool, int> check_header(std::wistream& is)
+	template<typename C>
+	boost::optional<info> check_header(std::basic_istream<C>& is)
 	{
 		boost::uuids::uuid uuid;
 		is >> uuid;
 
-		if (uuid != uuid_)
-			return make_pair(false, -1);
+		if (!is || uuid != uuid_)
+			return boost::optional<info>();
 
-		int version;
-		is >> version;
+		info i = { -1, 0, 0, false };
+		is >> i.version >> std::ws;
+
+		if (!is)
+			return boost::optional<info>();
 
-		return make_pair(true, version);
+		if (is.peek() != '<')
+		{
+			is >> i.generation >> i.checksum;
+			is.ignore(1);
+
+			if (!is)
+				return boost::optional<info>();
+
+			i.checked = true;
+		}
+
+		return i;
 	}
 
-	void add_header(std::wostream& os)
+	template<typename C>
+	void add_header(std::basic_ostream<C>& os, boost::uint64_t generation, boost::uint32_t checksum)
 	{
 		os << uuid_ << std::endl;
-		os << version_ << std::endl;;
+		os << version_ << std::endl;
+		os << generation << ' ' << checksum << std::endl;
+	}
+
+	template<typename C>
+	static boost::uint32_t checksum(const std::basic_string<C>& body)
+	{
+		boost::crc_32_type crc;
+		crc.process_bytes(body.data(), body.size() * sizeof(C));
+
+		return crc.checksum();
+	}
+
+	// Of everything left in the stream, read a block at a time.
+	template<typename C>
+	static boost::uint32_t checksum(std::basic_istream<C>& is)
+	{
+		boost::crc_32_type crc;
+		std::vector<C> block(16*1024);
+
+		while (is.read(&block[0], block.size()) || is.gcount() > 0)
+			crc.process_bytes(&block[0], static_cast<size_t>(is.gcount()) * sizeof(C));
+
+		return crc.checksum();
 	}
 
 private:	
@@ -48,60 +105,157 @@ private:
 	int version_;
 };
 
+// Saves are committed whole through work_file. Loading checks every copy a crash may have
+// left, streaming each through the checksum, and reads the body of the newest generation whose
+// checksum holds straight from its file. The w streams are for UTF-16
+// text, the narrow ones for binary archives.
 class versioned_file
 {
 public:
 	versioned_file(const std::wstring& f, const boost::uuids::uuid& u, int v) :
 		file_(f),
 		header_(u, v),
-		loaded_version_(-1)
+		loaded_version_(-1),
+		generation_(0)
 	{}
 		
-	shared_wostream_ptr wostream()
+	// Written out with the header once the last reference is released.
+	shared_wostream_ptr wostream() { return make_ostream<wchar_t>(); }
+	shared_ostream_ptr ostream() { return make_ostream<char>(); }
+
+	boost::optional<shared_wistream_ptr> wistream() { return make_istream<wchar_t>(); }
+	boost::optional<shared_istream_ptr> istream() { return make_istream<char>(); }
+
+	int loaded_version() const { return loaded_version_; }
+	// Of the copy last loaded or saved.
+	boost::uint64_t generation() const { return generation_; }
+
+	bool exists() const { return !file_.candidates().empty(); }
+	void retire() { file_.retire(); }
+
+	boost::filesystem::wpath main_file() const
 	{
-		shared_wostream_ptr owfs_p = file_.wostream();
+		return file_.main_file();
+	}
+
+	boost::filesystem::wpath working_file() const
+	{
+		return file_.working_file();
+	}
 
-		header_.add_header(*owfs_p);
+private:
+	template<typename C>
+	boost::shared_ptr<std::basic_ostream<C> > make_ostream()
+	{
+		if (generation_ == 0)
+			generation_ = newest_generation<C>();
 
-		return owfs_p;
+		return boost::shared_ptr<std::basic_ostream<C> >(new std::basic_ostringstream<C>(),
+			boost::bind(&versioned_file::commit<C>, this, _1));
 	}
 
-	boost::optional<shared_wistream_ptr> wistream()
+	template<typename C>
+	boost::optional<boost::shared_ptr<std::basic_istream<C> > > make_istream()
 	{
-		shared_wistream_ptr iwfs_p = file_.wistream();
+		typedef boost::shared_ptr<std::basic_istream<C> > stream_ptr;
 
-		std::pair<bool, int> p = header_.check_header(*iwfs_p);
+		boost::optional<file_header::info> newest;
+		boost::filesystem::wpath newest_file;
 
-		if (p.first)
+		for (const boost::filesystem::wpath& file : file_.candidates())
 		{
-			loaded_version_ = p.second;
+			stream_ptr is = open(file, C());
+			if (!is) continue;
+
+			boost::optional<file_header::info> h = header_.check_header(*is);
+			if (!h) continue;
+
+			if (h->checked && file_header::checksum(*is) != h->checksum)
+				continue;
 
-			return boost::optional<shared_wistream_ptr>(iwfs_p);
+			if (!newest || h->generation > newest->generation)
+			{
+				newest = h;
+				newest_file = file;
+			}
+		}
+
+		// Opened again and left just past the header, the body is read by the caller.
+		stream_ptr body = newest ? open(newest_file, C()) : stream_ptr();
+
+		if (body && header_.check_header(*body))
+		{
+			loaded_version_ = newest->version;
+			generation_ = newest->generation;
+
+			return boost::optional<stream_ptr>(body);
 		}
 		else
 		{
 			loaded_version_ = -1;
 
-			return boost::optional<shared_wistream_ptr>();
+			return boost::optional<stream_ptr>();
 		}
 	}
 
-	int loaded_version() const { return loaded_version_; }
+	template<typename C>
+	void commit(std::basic_ostream<C>* os)
+	{
+		boost::scoped_ptr<std::basic_ostringstream<C> > buffer(static_cast<std::basic_ostringstream<C>*>(os));
+		std::basic_string<C> body = buffer->str();
+		buffer.reset();
 
-	boost::filesystem::wpath main_file() const
+		std::basic_ostringstream<C> header;
+		header_.add_header(header, generation_ + 1, file_header::checksum(body));
+
+		try
+		{
+
+		file_.commit(header.str(), body);
+		++generation_;
+
+		}
+		catch (const std::exception& e)
+		{
+			wlog() << (L"Writing " + file_.main_file().wstring() + L" failed, " + from_utf8(e.what()) + L"\r\n");
+		}
+	}
+
+	// A save before any load must still come out newer than what's on disk. Only the headers
+	// are read.
+	template<typename C>
+	boost::uint64_t newest_generation()
 	{
-		return file_.main_file();
+		boost::uint64_t generation = 0;
+
+		for (const boost::filesystem::wpath& file : file_.candidates())
+		{
+			boost::shared_ptr<std::basic_istream<C> > is = open(file, C());
+			if (!is) continue;
+
+			boost::optional<file_header::info> h = header_.check_header(*is);
+
+			if (h && h->generation > generation)
+				generation = h->generation;
+		}
+
+		return generation;
 	}
 
-	boost::filesystem::wpath working_file() const
+	static shared_wistream_ptr open(const boost::filesystem::wpath& file, wchar_t)
 	{
-		return file_.working_file();
+		return work_file::open_wistream(file);
+	}
+
+	static shared_istream_ptr open(const boost::filesystem::wpath& file, char)
+	{
+		return work_file::open_istream(file);
 	}
 
-private:
 	work_file file_;
 	file_header header_;
 	int loaded_version_;
+	boost::uint64_t generation_;
 };
 
 } // namespace hal
@@ -6,7 +6,7 @@
 
 #include "stdAfx.hpp"
 
-#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/filesystem/fstream.hpp>
 
 #include "wtl_app.hpp"
 #include "logger.hpp"
@@ -16,71 +16,213 @@
 namespace hal 
 {
 
-work_file::work_file(const std::wstring& filename) :
-	main_file_(app().get_working_directory()/filename),
-	working_file_(app().get_working_directory()/(filename + L".working")),
-	filename_(filename)
-{		
-	if (boost::filesystem::exists(working_file_))
-		boost::filesystem::rename(working_file_, generate_backup_name());
+namespace
+{
 
-	if (boost::filesystem::exists(main_file_))
-		boost::filesystem::copy_file(main_file_, working_file_);
+void imbue_utf16(std::wios& s)
+{
+	s.imbue(std::locale(s.getloc(),
+		new std::codecvt_utf16<wchar_t, 0x10ffff, std::little_endian>));
 }
 
-work_file::~work_file()
+void imbue_utf16(std::ios&)
+{}
+
+// Otherwise the rename can reach the disk ahead of the data it's meant to publish, and a
+// power cut leaves a main file with nothing in it.
+void flush_to_disk(const boost::filesystem::wpath& file)
 {
-	if (boost::filesystem::exists(working_file_))
+	HANDLE h = ::CreateFileW(file.wstring().c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, 
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (h == INVALID_HANDLE_VALUE)
+		throw boost::filesystem::filesystem_error("work_file: can't open to flush", file,
+			boost::system::error_code(::GetLastError(), boost::system::system_category()));
+
+	BOOL flushed = ::FlushFileBuffers(h);
+	DWORD error = ::GetLastError();
+
+	::CloseHandle(h);
+
+	if (!flushed)
+		throw boost::filesystem::filesystem_error("work_file: flush failed", file,
+			boost::system::error_code(error, boost::system::system_category()));
+}
+
+// Commits what was written once the stream's last reference goes.
+class commit_on_release
+{
+public:
+	explicit commit_on_release(work_file* f) :
+		file_(f)
+	{}
+
+	void operator()(std::wostream* os) const
 	{
-		boost::filesystem::remove(main_file_);
-		boost::filesystem::copy_file(working_file_, main_file_);
+		boost::scoped_ptr<std::wostringstream> buffer(static_cast<std::wostringstream*>(os));
 
-		if (boost::filesystem::last_write_time(main_file_) >=
-				boost::filesystem::last_write_time(working_file_))
+		try
 		{
-			boost::filesystem::remove(working_file_);
+
+		file_->commit(buffer->str());
+
+		}
+		catch (const std::exception& e)
+		{
+			wlog() << (L"Writing " + file_->main_file().wstring() + L" failed, " + from_utf8(e.what()) + L"\r\n");
 		}
 	}
+
+private:
+	work_file* file_;
+};
+
 }
 
+work_file::work_file(const std::wstring& filename) :
+	main_file_(app().get_working_directory()/filename),
+	working_file_(app().get_working_directory()/(filename + L".working")),
+	previous_file_(app().get_working_directory()/(filename + L".previous")),
+	filename_(filename)
+{}
+
+work_file::~work_file()
+{}
+
 shared_wostream_ptr work_file::wostream()
 {		
-	if (boost::filesystem::exists(working_file_))
-	{
-		boost::filesystem::remove(main_file_);
-		boost::filesystem::copy_file(working_file_, main_file_);
+	return shared_wostream_ptr(new std::wostringstream(), commit_on_release(this));
+}
+
+shared_wistream_ptr work_file::wistream()
+{
+	for (const boost::filesystem::wpath& file : candidates())
+		if (shared_wistream_ptr is = open_wistream(file)) return is;
+
+	return shared_wistream_ptr(new std::wistringstream());
+}
+
+void work_file::commit(const std::wstring& contents)
+{
+	commit(std::wstring(), contents);
+}
+
+void work_file::commit(const std::string& bytes)
+{
+	commit(std::string(), bytes);
+}
+
+void work_file::commit(const std::wstring& header, const std::wstring& contents)
+{
+	commit<boost::filesystem::wofstream>(header, contents, std::ios_base::out | std::ios_base::trunc);
+}
+
+void work_file::commit(const std::string& header, const std::string& bytes)
+{
+	commit<boost::filesystem::ofstream>(header, bytes, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+}
+
+template<typename Stream, typename Contents>
+void work_file::commit(const Contents& header, const Contents& contents, std::ios_base::openmode mode)
+{
+	if (!boost::filesystem::exists(main_file_.parent_path()))
+		boost::filesystem::create_directories(main_file_.parent_path());
+
+	{	Stream ofs(working_file_, mode);
+		imbue_utf16(ofs);
+
+		ofs << header << contents;
+		ofs.close();
+
+		if (ofs.fail())
+			throw boost::filesystem::filesystem_error("work_file: write failed", working_file_,
+				boost::system::errc::make_error_code(boost::system::errc::io_error));
 	}
 
-	shared_wostream_ptr owfs_p(new boost::filesystem::wofstream(working_file_));
+	flush_to_disk(working_file_);
 
-	owfs_p->imbue(std::locale(owfs_p->getloc(),
-		new std::codecvt_utf16<wchar_t, 0x10ffff, std::little_endian>));
+	// Between the renames there's no main file, the previous and working copies are both whole.
+	if (boost::filesystem::exists(main_file_))
+		boost::filesystem::rename(main_file_, previous_file_);
 
-	return owfs_p;
+	boost::filesystem::rename(working_file_, main_file_);
 }
 
-shared_wistream_ptr work_file::wistream()
+std::vector<boost::filesystem::wpath> work_file::candidates() const
 {
-	shared_wistream_ptr iwfs_p(new boost::filesystem::wifstream(working_file_));
+	std::vector<boost::filesystem::wpath> files;
 
+	if (boost::filesystem::exists(main_file_)) files.push_back(main_file_);
+	if (boost::filesystem::exists(working_file_)) files.push_back(working_file_);
+	if (boost::filesystem::exists(previous_file_)) files.push_back(previous_file_);
 
-	iwfs_p->imbue(std::locale(iwfs_p->getloc(),
-		new std::codecvt_utf16<wchar_t, 0x10ffff, std::little_endian>));
+	return files;
+}
+
+bool work_file::read(const boost::filesystem::wpath& file, std::wstring& contents)
+{
+	boost::filesystem::wifstream ifs(file);
+	if (!ifs) return false;
+
+	imbue_utf16(ifs);
 
-	return iwfs_p;
+	std::wostringstream buffer;
+	buffer << ifs.rdbuf();
+
+	if (ifs.bad()) return false;
+
+	contents = buffer.str();
+
+	return true;
 }
 
-boost::filesystem::wpath work_file::generate_backup_name()
+bool work_file::read(const boost::filesystem::wpath& file, std::string& bytes)
 {
-	std::wstringstream sstr;
-	boost::posix_time::wtime_facet* facet = new boost::posix_time::wtime_facet(L"%Y-%m-%d.%H-%M-%S");
-	sstr.imbue(std::locale(std::cout.getloc(), facet));
-	sstr << boost::posix_time::second_clock::universal_time();
+	boost::filesystem::ifstream ifs(file, std::ios_base::in | std::ios_base::binary);
+	if (!ifs) return false;
+
+	std::ostringstream buffer;
+	buffer << ifs.rdbuf();
+
+	if (ifs.bad()) return false;
+
+	bytes = buffer.str();
+
+	return true;
+}
+
+shared_wistream_ptr work_file::open_wistream(const boost::filesystem::wpath& file)
+{
+	boost::shared_ptr<boost::filesystem::wifstream> ifs(new boost::filesystem::wifstream(file));
+	if (!*ifs) return shared_wistream_ptr();
+
+	imbue_utf16(*ifs);
+
+	return ifs;
+}
+
+shared_istream_ptr work_file::open_istream(const boost::filesystem::wpath& file)
+{
+	boost::shared_ptr<boost::filesystem::ifstream> ifs(
+		new boost::filesystem::ifstream(file, std::ios_base::in | std::ios_base::binary));
+	if (!*ifs) return shared_istream_ptr();
+
+	return ifs;
+}
+
+void work_file::retire()
+{
+	boost::system::error_code ec;
+
+	if (boost::filesystem::exists(main_file_))
+		boost::filesystem::rename(main_file_, boost::filesystem::wpath(main_file_.wstring() + L".migrated"));
 
-	return app().get_working_directory()/(filename_ + L"." + sstr.str());
+	boost::filesystem::remove(working_file_, ec);
+	boost::filesystem::remove(previous_file_, ec);
 }
 
 boost::filesystem::wpath work_file::main_file() const { return main_file_; }
 boost::filesystem::wpath work_file::working_file() const { return working_file_; }
+boost::filesystem::wpath work_file::previous_file() const { return previous_file_; }
 
 } // namespace hal
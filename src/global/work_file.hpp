@@ -7,6 +7,7 @@
 #ifndef GLOBAL_WORKING_FILE
 #define GLOBAL_WORKING_FILE
 
+#include <vector>
 #include <boost/smart_ptr.hpp>
 #include <boost/filesystem/path.hpp>
 #include <boost/smart_ptr.hpp>
@@ -16,24 +17,55 @@ namespace hal
 
 typedef boost::shared_ptr<std::wostream> shared_wostream_ptr;
 typedef boost::shared_ptr<std::wistream> shared_wistream_ptr;
+typedef boost::shared_ptr<std::ostream> shared_ostream_ptr;
+typedef boost::shared_ptr<std::istream> shared_istream_ptr;
 
+// A file that is only ever replaced whole. Everything is written to the working file first,
+// closed and then renamed over the main file, the main file having been moved aside as the
+// previous copy. A crash at any point leaves at least one complete copy among the candidates.
 class work_file
 {
 public:	
 	work_file(const std::wstring& filename);
 	~work_file();
 	
+	// Buffers what is written, the file is committed once the last reference is released.
 	shared_wostream_ptr wostream();
+	// The newest complete copy, the main file unless a crash left it missing.
 	shared_wistream_ptr wistream();
 
+	// Text is stored as UTF-16, bytes as they are. The header, when there is one, is
+	// written ahead of the rest so callers needn't join the two. The file is flushed to the
+	// disk before it's renamed into place.
+	void commit(const std::wstring& contents);
+	void commit(const std::string& bytes);
+	void commit(const std::wstring& header, const std::wstring& contents);
+	void commit(const std::string& header, const std::string& bytes);
+
+	// Every file which may hold a complete copy, the likeliest first.
+	std::vector<boost::filesystem::wpath> candidates() const;
+	static bool read(const boost::filesystem::wpath& file, std::wstring& contents);
+	static bool read(const boost::filesystem::wpath& file, std::string& bytes);
+
+	// For reading a candidate a piece at a time, null if it can't be opened.
+	static shared_wistream_ptr open_wistream(const boost::filesystem::wpath& file);
+	static shared_istream_ptr open_istream(const boost::filesystem::wpath& file);
+
+	// Once the data has moved to another file, keeps the main file as <name>.migrated and
+	// removes the rest so none of them is mistaken for current.
+	void retire();
+
 	boost::filesystem::wpath main_file() const;
 	boost::filesystem::wpath working_file() const;
+	boost::filesystem::wpath previous_file() const;
 
 private:	
-	boost::filesystem::wpath generate_backup_name();
+	template<typename Stream, typename Contents>
+	void commit(const Contents& header, const Contents& contents, std::ios_base::openmode mode);
 
 	boost::filesystem::wpath main_file_;
 	boost::filesystem::wpath working_file_;
+	boost::filesystem::wpath previous_file_;
 	std::wstring filename_;
 };
 
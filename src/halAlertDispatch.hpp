@@ -0,0 +1,48 @@
+
+//         Copyright Ein O'Callaghan 2009 - 2009.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#if defined(HALTORRENT_PCH)
+#	include "halPch.hpp"
+#else
+#	include <vector>
+#	include <libtorrent/alert.hpp>
+#endif
+
+namespace hal
+{
+
+// Functions indexed by alert::type(), so finding the one for an alert is a bounds check and
+// a load however many types are registered. Handler is what they're called with.
+template<typename Handler>
+class alert_dispatch_table
+{
+public:
+	typedef void (*dispatch_fn)(Handler&, libtorrent::alert*);
+
+	template<typename A>
+	void add(dispatch_fn fn)
+	{
+		if (static_cast<size_t>(A::alert_type) >= handlers_.size())
+			handlers_.resize(A::alert_type + 1, nullptr);
+
+		handlers_[A::alert_type] = fn;
+	}
+
+	dispatch_fn find(int type) const
+	{
+		if (type >= 0 && static_cast<size_t>(type) < handlers_.size())
+			return handlers_[type];
+		else
+			return nullptr;
+	}
+
+private:
+	std::vector<dispatch_fn> handlers_;
+};
+
+}
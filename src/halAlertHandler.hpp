@@ -21,6 +21,19 @@ namespace hal
 		hal::event_log().post(boost::make_shared<hal::EventGeneral>(level, convert_to_ptime(a->timestamp()), msg));
 	}
 
+	// For alerts about a torrent, the event carries its uuid.
+	template<typename M>
+	void alert_msg(libt::alert* a, const torrent_internal& t, const M& msg)
+	{
+		alert_msg(a, t, lbt_category_to_event(a->category()), msg);
+	}
+
+	template<typename M>
+	void alert_msg(libt::alert* a, const torrent_internal& t, event_logger::eventLevel level, const M& msg)
+	{
+		hal::event_log().post(boost::make_shared<hal::EventTorrentMsg>(t.id(), msg, level, convert_to_ptime(a->timestamp())));
+	}
+
 
 	class AlertHandler
 	{
@@ -37,9 +50,16 @@ namespace hal
 		return get(h.info_hash());
 	}
 
+	// get_by_hash may drop duplicates, so it's held to the same lock as the other users of
+	// the_torrents_.
 	torrent_internal_ptr get(libt::sha1_hash hash) const
 	{
-		torrent_internal_ptr p = bit_impl_.the_torrents_.get_by_hash(hash);
+		torrent_internal_ptr p;
+
+		{	unique_lock_t l(bit_impl_.mutex_);
+
+			p = bit_impl_.the_torrents_.get_by_hash(hash);
+		}
 
 		if (p)
 			return p;
@@ -47,514 +67,177 @@ namespace hal
 			throw bit::null_torrent();
 	}
 
+	// Alerts are dispatched through a table indexed by alert::type(), so each alert costs
+	// one lookup rather than a walk down an alert_cast chain. Torrent alerts have their
+	// torrent resolved once, before the handler is called.
 	bool handle_alert_alt(libtorrent::alert* a)
 	{
-		if (auto* p = libt::alert_cast<libt::add_torrent_alert>(a))
+		if (dispatch_fn fn = dispatch_table().find(a->type()))
 		{
-			alert_msg(a, hal::wform(hal::app().res_wstr(LBT_EVENT_TORRENT_ADDED)) % get(p->handle)->name());
+			try
+			{
 
-			get(p->handle)->set_handle(p->handle);
-			get(p->handle)->process_event(new ev_added_alert((p->params.flags & libt::add_torrent_params::flag_paused) != 0, p->error));
-		}
-		else if (auto* p = libt::alert_cast<libt::torrent_removed_alert>(a))
-		{
-			alert_msg(a, hal::wform(L"Torrent removed alert %1%") % get(p->info_hash)->name());
+			fn(*this, a);
+
+			}
+			catch (const bit::null_torrent&)
+			{
+				HAL_DEV_MSG(hal::wform(L"No torrent for alert %1%") % hal::from_utf8_safe(a->what()));
+			}
+			catch (const invalid_torrent&)
+			{
+				HAL_DEV_MSG(hal::wform(L"No torrent for alert %1%") % hal::from_utf8_safe(a->what()));
+			}
 
-	//		get(p->info_hash)->
+			return true;
 		}
-		else if (auto* p = libt::alert_cast<libt::save_resume_data_alert>(a))
+		else
 		{
-			alert_msg(a, hal::wform(hal::app().res_wstr(HAL_WRITE_RESUME_ALERT))
-				% get(p->handle)->name());
-
-			if (p->resume_data)
-				get(p->handle)->write_resume_data(*p->resume_data);
+			alert_msg(a, event_logger::debug,
+				hal::wform(hal::app().res_wstr(HAL_UNHANDLED_ALERT))
+					% hal::from_utf8_safe(a->what())
+					% hal::from_utf8_safe(a->message()));
 
-			get(p->handle)->process_event(new ev_resume_data_alert());
+			return false;
 		}
-		else if (auto* p = libt::alert_cast<libt::torrent_paused_alert>(a))
-		{
-			wstring err = get(p->handle)->check_error();
+	}
 
-			if (err.empty())
-			{
-				alert_msg(a, hal::wform(hal::app().res_wstr(LBT_EVENT_TORRENT_PAUSED)) % get(p->handle)->name());
+	private:
+	typedef alert_dispatch_table<AlertHandler>::dispatch_fn dispatch_fn;
 
-				HAL_DEV_MSG(hal::wform(L"Torrent Paused alert, %1%.") % get(p->handle)->name());
+	template<typename A, void (AlertHandler::*F)(A&)>
+	static void dispatch(AlertHandler& h, libt::alert* a)
+	{
+		(h.*F)(*static_cast<A*>(a));
+	}
 
-				get(p->handle)->process_event(new ev_paused_alert());
-			}
-			else
-			{
-				alert_msg(a, event_logger::warning, hal::wform(hal::app().res_wstr(HAL_TORRENT_ERROR_PAUSE_ALERT))
-					% err
-					% get(p->handle)->name());
+	template<typename A, void (AlertHandler::*F)(A&, torrent_internal&)>
+	static void dispatch_torrent(AlertHandler& h, libt::alert* a)
+	{
+		A& p = *static_cast<A*>(a);
+		torrent_internal_ptr t = h.get(p.handle);
 
-				HAL_DEV_MSG(hal::wform(L"Torrent Error alert %2%, %1%.") % get(p->handle)->name() % err);
+		(h.*F)(p, *t);
+	}
 
-				get(p->handle)->process_event(new ev_error_alert(err));
-			}
-		}
-		else if (auto* p = libt::alert_cast<libt::torrent_resumed_alert>(a))
-		{
+	static const alert_dispatch_table<AlertHandler>& dispatch_table()
+	{
+		static const alert_dispatch_table<AlertHandler> table = make_dispatch_table();
+		return table;
+	}
 
-			alert_msg(a, hal::wform(hal::app().res_wstr(HAL_TORRENT_RESUME_ALERT)) % get(p->handle)->name());
+	static alert_dispatch_table<AlertHandler> make_dispatch_table()
+	{
+		alert_dispatch_table<AlertHandler> t;
+
+		t.add<libt::add_torrent_alert>(&dispatch_torrent<libt::add_torrent_alert, &AlertHandler::on_add_torrent>);
+		t.add<libt::torrent_removed_alert>(&dispatch<libt::torrent_removed_alert, &AlertHandler::on_torrent_removed>);
+		t.add<libt::save_resume_data_alert>(&dispatch_torrent<libt::save_resume_data_alert, &AlertHandler::on_save_resume_data>);
+		t.add<libt::torrent_paused_alert>(&dispatch_torrent<libt::torrent_paused_alert, &AlertHandler::on_torrent_paused>);
+		t.add<libt::torrent_resumed_alert>(&dispatch_torrent<libt::torrent_resumed_alert, &AlertHandler::on_torrent_resumed>);
+		t.add<libt::torrent_finished_alert>(&dispatch_torrent<libt::torrent_finished_alert, &AlertHandler::on_torrent_finished>);
+		t.add<libt::save_resume_data_failed_alert>(&dispatch_torrent<libt::save_resume_data_failed_alert, &AlertHandler::on_save_resume_data_failed>);
+		t.add<libt::state_changed_alert>(&dispatch_torrent<libt::state_changed_alert, &AlertHandler::on_state_changed>);
+		t.add<libt::state_update_alert>(&dispatch<libt::state_update_alert, &AlertHandler::on_state_update>);
+
+		return t;
+	}
 
-			HAL_DEV_MSG(hal::wform(L"Torrent Resumed alert, %1%.") % get(p->handle)->name());
+	void on_add_torrent(libt::add_torrent_alert& p, torrent_internal& t)
+	{
+		alert_msg(&p, t, hal::wform(hal::app().res_wstr(LBT_EVENT_TORRENT_ADDED)) % t.name());
 
-			get(p->handle)->process_event(new ev_resumed_alert());
-		}
-		else if (auto* p = libt::alert_cast<libt::torrent_finished_alert>(a))
-		{
-			HAL_DEV_MSG(hal::wform(hal::app().res_wstr(LBT_EVENT_TORRENT_FINISHED))
-				% get(p->handle)->name());
+		t.set_handle(p.handle);
+		t.process_event(new ev_added_alert((p.params.flags & libt::add_torrent_params::flag_paused) != 0, p.error));
+	}
 
-			get(p->handle)->alert_finished();
+	void on_torrent_removed(libt::torrent_removed_alert& p)
+	{
+		torrent_internal_ptr t = get(p.info_hash);
 
-			bit_impl_.signals.torrent_completed(get(p->handle)->name());
-		}
-		else if (auto* p = libt::alert_cast<libt::save_resume_data_failed_alert>(a))
-		{
-			alert_msg(a, hal::wform(hal::app().res_wstr(HAL_WRITE_RESUME_FAIL_ALERT))
-				% get(p->handle)->name());
+		alert_msg(&p, *t, hal::wform(L"Torrent removed alert %1%") % t->name());
+	}
 
-			get(p->handle)->process_event(new ev_resume_data_failed_alert());
-		}
-		else if (auto* p = libt::alert_cast<libt::state_changed_alert>(a))
-		{
-			HAL_DEV_MSG(hal::wform(L"Torrent state changed alert, %1%. From %2% -> %3%") % get(p->handle)->name() % p->prev_state % p->state);
-		}
-		else
-		{
-			alert_msg(a, event_logger::debug,
-				hal::wform(hal::app().res_wstr(HAL_UNHANDLED_ALERT))
-					% hal::from_utf8_safe(a->what())
-					% hal::from_utf8_safe(a->message()));
+	void on_save_resume_data(libt::save_resume_data_alert& p, torrent_internal& t)
+	{
+		alert_msg(&p, t, hal::wform(hal::app().res_wstr(HAL_WRITE_RESUME_ALERT)) % t.name());
 
-			return false;
-		}
+		if (p.resume_data)
+			t.write_resume_data(p.resume_data);
 
-		return true;
+		t.process_event(new ev_resume_data_alert());
 	}
-		
-	bool handle_alert(libtorrent::alert* a)
+
+	void on_torrent_paused(libt::torrent_paused_alert& p, torrent_internal& t)
 	{
-		if (auto* p = libt::alert_cast<libt::add_torrent_alert>(a))
-		{
-			alert_msg(a, hal::wform(hal::app().res_wstr(LBT_EVENT_TORRENT_ADDED)) % get(p->handle)->name());
-			
-			HAL_DEV_MSG(hal::wform(L"Torrent Added alert, %1%.") % get(p->handle)->name());
+		wstring err = t.check_error();
 
-			get(p->handle)->set_handle(p->handle);
-			get(p->handle)->process_event(new ev_added_alert((p->params.flags & libt::add_torrent_params::flag_paused) != 0, p->error));
-		}
-		else if (auto* p = libt::alert_cast<libt::external_ip_alert>(a))
-		{
-			event_log().post(shared_ptr<EventDetail>(
-				new EventGeneral(lbt_category_to_event(p->category()), convert_to_ptime(p->timestamp()),
-					hal::wform(hal::app().res_wstr(HAL_EXTERNAL_IP_ALERT))
-						% hal::from_utf8_safe(p->message())
-						% hal::from_utf8_safe(p->external_address.to_string()))
-			));		
-
-			if (!bit_impl_.use_custom_interface_ || !bit_impl_.external_interface_) 
-				bit_impl_.external_interface_.reset(hal::from_utf8_safe(p->external_address.to_string()));
-		}
-		else if (auto* p = libt::alert_cast<libt::portmap_error_alert>(a))
-		{
-			event_log().post(shared_ptr<EventDetail>(
-				new EventGeneral(lbt_category_to_event(p->category()), convert_to_ptime(p->timestamp()),
-					hal::wform(hal::app().res_wstr(HAL_PORTMAP_ERROR_ALERT))
-					% (p->type() == 0 ? 
-						hal::app().res_wstr(HAL_PORTMAP_TYPE_PMP) : 
-						hal::app().res_wstr(HAL_PORTMAP_TYPE_UPNP)))
-			));				
-		}
-		else if (auto* p = libt::alert_cast<libt::portmap_alert>(a))
+		if (err.empty())
 		{
-			event_log().post(shared_ptr<EventDetail>(
-				new EventGeneral(lbt_category_to_event(p->category()), convert_to_ptime(p->timestamp()),
-					hal::wform(hal::app().res_wstr(HAL_PORTMAP_ALERT))
-					% (p->type() == 0 ? 
-						hal::app().res_wstr(HAL_PORTMAP_TYPE_PMP) : 
-						hal::app().res_wstr(HAL_PORTMAP_TYPE_UPNP))
-					% p->external_port)
-			));				
-		}
-		else if (auto* p = libt::alert_cast<libt::file_error_alert>(a))
-		{
-			event_log().post(shared_ptr<EventDetail>(
-				new EventGeneral(lbt_category_to_event(p->category()), convert_to_ptime(p->timestamp()),
-					hal::wform(hal::app().res_wstr(HAL_FILE_ERROR_ALERT))
-					% hal::from_utf8_safe(p->file)
-					% hal::from_utf8_safe(p->message()))
-			));				
-		}	
-		else if (auto* p = libt::alert_cast<libt::dht_reply_alert>(a))
-		{
-			event_log().post(shared_ptr<EventDetail>(
-				new EventGeneral(lbt_category_to_event(p->category()), convert_to_ptime(p->timestamp()),
-					hal::wform(hal::app().res_wstr(HAL_DHT_REPLY_ALERT))
-						% p->num_peers
-						% get(p->handle)->name())
-			));				
-		}
-		else if (auto* p = libt::alert_cast<libt::torrent_finished_alert>(a))
-		{
-			event_log().post(shared_ptr<EventDetail>(
-				new EventMsg((hal::wform(hal::app().res_wstr(LBT_EVENT_TORRENT_FINISHED)) 
-						% get(p->handle)->name()), 
-					event_logger::info, convert_to_ptime(p->timestamp()))));
-		
-			get(p->handle)->alert_finished();
-
-			bit_impl_.signals.torrent_completed(get(p->handle)->name());
-		}
-		else if (auto* p = libt::alert_cast<libt::storage_moved_alert>(a))
-		{
-			event_log().post(shared_ptr<EventDetail>(
-				new EventMsg((hal::wform(hal::app().res_wstr(LBT_EVENT_TORRENT_STOREAGE_MOVED)) 
-						% get(p->handle)->name()), 
-					event_logger::info, convert_to_ptime(p->timestamp()))));
-		
-			get(p->handle)->alert_storage_moved(from_utf8(p->path));
-		}
-		else if (auto* p = libt::alert_cast<libt::storage_moved_failed_alert >(a))
-		{
-			event_log().post(shared_ptr<EventDetail>(
-				new EventMsg((hal::wform(hal::app().res_wstr(LBT_EVENT_TORRENT_FILE_RENAME_ERR)) 
-						% get(p->handle)->name()
-						% p->error), 
-					event_logger::warning, convert_to_ptime(p->timestamp()))));
-		}
-		else if (auto* p = libt::alert_cast<libt::file_renamed_alert>(a))
-		{
-			event_log().post(shared_ptr<EventDetail>(
-				new EventMsg((hal::wform(hal::app().res_wstr(LBT_EVENT_TORRENT_FILE_RENAMED)) 
-						% get(p->handle)->name()
-						% p->index 
-						% hal::from_utf8_safe(p->name)), 
-					event_logger::debug, convert_to_ptime(p->timestamp()))));
-		}
-		else if (auto* p = libt::alert_cast<libt::file_rename_failed_alert>(a))
-		{
-			event_log().post(shared_ptr<EventDetail>(
-				new EventMsg((hal::wform(hal::app().res_wstr(LBT_EVENT_TORRENT_FILE_RENAME_ERR)) 
-						% get(p->handle)->name()
-						% p->index), 
-					event_logger::warning, convert_to_ptime(p->timestamp()))));
-		}
-		else if (auto* p = libt::alert_cast<libt::file_completed_alert>(a))
-		{
-			event_log().post(shared_ptr<EventDetail>(
-				new EventMsg((hal::wform(hal::app().res_wstr(LBT_EVENT_TORRENT_FILE_COMPLETED)) 
-						% get(p->handle)->name()
-						% p->index), 
-					event_logger::info, convert_to_ptime(p->timestamp()))));
-		
-			get(p->handle)->alert_file_completed(p->index);	
+			alert_msg(&p, t, hal::wform(hal::app().res_wstr(LBT_EVENT_TORRENT_PAUSED)) % t.name());
+
+			HAL_DEV_FORMAT(L"Torrent Paused alert, %1%.", t.name());
+
+			t.process_event(new ev_paused_alert());
 		}
-		else if (auto* p = libt::alert_cast<libt::metadata_received_alert>(a))
+		else
 		{
-			event_log().post(shared_ptr<EventDetail>(
-				new EventMsg((hal::wform(hal::app().res_wstr(LBT_EVENT_TORRENT_METADATA)) 
-						% get(p->handle)->name()), 
-					event_logger::info, convert_to_ptime(p->timestamp()))));
-		
-			get(p->handle)->alert_metadata_completed();	
+			alert_msg(&p, t, event_logger::warning, hal::wform(hal::app().res_wstr(HAL_TORRENT_ERROR_PAUSE_ALERT))
+				% err
+				% t.name());
+
+			HAL_DEV_FORMAT(L"Torrent Error alert %2%, %1%.", t.name(), err);
+
+			t.process_event(new ev_error_alert(err));
 		}
-		else if (auto* p = libt::alert_cast<libt::metadata_failed_alert>(a))
-		{
-			event_log().post(shared_ptr<EventDetail>(
-				new EventMsg((hal::wform(hal::app().res_wstr(LBT_EVENT_TORRENT_METADATA_FAILED)) 
-						% get(p->handle)->name()), 
-					event_logger::critical, convert_to_ptime(p->timestamp()))));
-		}	
-		else if (auto* p = libt::alert_cast<libt::torrent_paused_alert>(a))
-		{
-			wstring err = get(p->handle)->check_error();
+	}
 
-			if (err.empty())
-			{
-				event_log().post(shared_ptr<EventDetail>(
-					new EventMsg((hal::wform(hal::app().res_wstr(LBT_EVENT_TORRENT_PAUSED)) 
-							% get(p->handle)->name()), 
-						event_logger::debug, convert_to_ptime(p->timestamp()))));
-			
-				HAL_DEV_MSG(hal::wform(L"Torrent Paused alert, %1%.") % get(p->handle)->name());
+	void on_torrent_resumed(libt::torrent_resumed_alert& p, torrent_internal& t)
+	{
+		alert_msg(&p, t, hal::wform(hal::app().res_wstr(HAL_TORRENT_RESUME_ALERT)) % t.name());
 
-				get(p->handle)->process_event(new ev_paused_alert());
-			}
-			else
-			{
-				HAL_DEV_MSG(hal::wform(L"Torrent Error alert %2%, %1%.") % get(p->handle)->name() % err);
+		HAL_DEV_FORMAT(L"Torrent Resumed alert, %1%.", t.name());
 
-				event_log().post(shared_ptr<EventDetail>(
-					new EventMsg((hal::wform(hal::app().res_wstr(HAL_TORRENT_ERROR_PAUSE_ALERT)) 
-							% err 
-							% get(p->handle)->name()), 
-						event_logger::warning, convert_to_ptime(p->timestamp()))));
+		t.process_event(new ev_resumed_alert());
+	}
 
-				get(p->handle)->process_event(new ev_error_alert(err));
-			}
-		}	
-		else if (auto* p = libt::alert_cast<libt::torrent_resumed_alert>(a))
-		{
+	void on_torrent_finished(libt::torrent_finished_alert& p, torrent_internal& t)
+	{
+		HAL_DEV_FORMAT(hal::app().res_wstr(LBT_EVENT_TORRENT_FINISHED), t.name());
 
-			event_log().post(shared_ptr<EventDetail>(
-				new EventMsg((hal::wform(hal::app().res_wstr(HAL_TORRENT_RESUME_ALERT)) 
-						% get(p->handle)->name()), 
-					event_logger::debug, convert_to_ptime(p->timestamp()))));
+		t.alert_finished();
 
-			HAL_DEV_MSG(hal::wform(L"Torrent Resumed alert, %1%.") % get(p->handle)->name());
+		bit_impl_.signals.torrent_completed(t.name());
+	}
 
-			get(p->handle)->process_event(new ev_resumed_alert());
-		}	
-		else if (auto* p = libt::alert_cast<libt::save_resume_data_alert>(a))
-		{
-			event_log().post(shared_ptr<EventDetail>(
-				new EventMsg((hal::wform(hal::app().res_wstr(HAL_WRITE_RESUME_ALERT)) 
-						% get(p->handle)->name()), 
-					event_logger::info, convert_to_ptime(p->timestamp()))));
+	void on_save_resume_data_failed(libt::save_resume_data_failed_alert& p, torrent_internal& t)
+	{
+		alert_msg(&p, t, hal::wform(hal::app().res_wstr(HAL_WRITE_RESUME_FAIL_ALERT)) % t.name());
 
-			if (p->resume_data)
-				get(p->handle)->write_resume_data(*p->resume_data);
+		t.process_event(new ev_resume_data_failed_alert());
+	}
 
-			get(p->handle)->process_event(new ev_resume_data_alert());
-		}	
-		else if (auto* p = libt::alert_cast<libt::save_resume_data_failed_alert>(a))
-		{
-			event_log().post(shared_ptr<EventDetail>(
-				new EventMsg((hal::wform(hal::app().res_wstr(HAL_WRITE_RESUME_FAIL_ALERT)) 
-						% get(p->handle)->name()), 
-					event_logger::warning, convert_to_ptime(p->timestamp()))));
-
-			get(p->handle)->process_event(new ev_resume_data_failed_alert());
-		}	
-		else if (auto* p = libt::alert_cast<libt::peer_error_alert>(a))
-		{
-			event_log().post(shared_ptr<EventDetail>(
-				new EventGeneral(lbt_category_to_event(p->category()), convert_to_ptime(p->timestamp()),
-					hal::wform(hal::app().res_wstr(HAL_PEER_ALERT))
-						% hal::from_utf8_safe(p->message())
-						% hal::from_utf8_safe(p->ip.address().to_string()))
-			));				
-		}		
-		else if (auto* p = libt::alert_cast<libt::peer_ban_alert>(a))
-		{
-			event_log().post(shared_ptr<EventDetail>(
-				new EventGeneral(lbt_category_to_event(p->category()), convert_to_ptime(p->timestamp()),
-					hal::wform(hal::app().res_wstr(HAL_PEER_BAN_ALERT))
-						% get(p->handle)->name()
-						% hal::from_utf8_safe(p->ip.address().to_string()))
-			));				
-		}		
-		else if (auto* p = libt::alert_cast<libt::hash_failed_alert>(a))
-		{
-			event_log().post(shared_ptr<EventDetail>(
-				new EventGeneral(lbt_category_to_event(p->category()), convert_to_ptime(p->timestamp()),
-					hal::wform(hal::app().res_wstr(HAL_HASH_FAIL_ALERT))
-						% get(p->handle)->name()
-						% p->piece_index)
-			));				
-		}		
-		else if (auto* p = libt::alert_cast<libt::url_seed_alert>(a))
-		{
-			event_log().post(shared_ptr<EventDetail>(
-				new EventGeneral(lbt_category_to_event(p->category()), convert_to_ptime(p->timestamp()),
-					hal::wform(hal::app().res_wstr(HAL_URL_SEED_ALERT))
-						% get(p->handle)->name()
-						% hal::from_utf8_safe(p->url)
-						% hal::from_utf8_safe(p->message()))
-			));				
-		}	
-		else if (auto* p = libt::alert_cast<libt::tracker_warning_alert>(a))
-		{
-			event_log().post(shared_ptr<EventDetail>(
-				new EventGeneral(lbt_category_to_event(p->category()), convert_to_ptime(p->timestamp()),
-					hal::wform(hal::app().res_wstr(HAL_TRACKER_WARNING_ALERT))
-						% get(p->handle)->name()
-						% hal::from_utf8_safe(p->message()))
-			));				
-		}	
-		else if (auto* p = libt::alert_cast<libt::tracker_announce_alert>(a))
-		{
-			event_log().post(shared_ptr<EventDetail>(
-				new EventMsg((hal::wform(hal::app().res_wstr(HAL_TRACKER_ANNOUNCE_ALERT)) 
-						% get(p->handle)->name()), 
-					event_logger::info, convert_to_ptime(p->timestamp()))));
-		}	
-		else if (auto* p = libt::alert_cast<libt::tracker_error_alert>(a))
-		{
-			event_log().post(shared_ptr<EventDetail>(
-				new EventGeneral(lbt_category_to_event(p->category()), convert_to_ptime(p->timestamp()),
-					hal::wform(hal::app().res_wstr(HAL_TRACKER_ALERT))
-						% get(p->handle)->name()
-						% hal::from_utf8_safe(p->message())
-						% p->times_in_row
-						% p->status_code)
-			));				
-
-			hal::peer_details_vec peers;
-			get(p->handle)->get_peer_details(peers);
-
-			HAL_DEV_MSG(hal::wform(L"Recieved %1% peers") % peers.size());
-			for (const auto& peer : peers)
-			{			
-				HAL_DEV_MSG(hal::wform(L"  --  %1% : %2%") % peer.ip_address % peer.port);
-			}
-		}	
-		else if (auto* p = libt::alert_cast<libt::scrape_failed_alert>(a))
-		{
-			event_log().post(shared_ptr<EventDetail>(
-				new EventGeneral(lbt_category_to_event(p->category()), convert_to_ptime(p->timestamp()),
-					hal::wform(hal::app().res_wstr(HAL_TRACKER_SCRAPE_FAILED_ALERT))
-						% get(p->handle)->name()
-						% hal::from_utf8_safe(p->message()))
-			));				
-		}	
-		else if (auto* p = libt::alert_cast<libt::tracker_reply_alert>(a))
-		{
-			event_log().post(shared_ptr<EventDetail>(
-				new EventGeneral(lbt_category_to_event(p->category()), convert_to_ptime(p->timestamp()),
-					hal::wform(hal::app().res_wstr(HAL_TRACKER_REPLY_ALERT))
-						% get(p->handle)->name()
-						% hal::from_utf8_safe(p->message())
-						% p->num_peers)
-			));				
-		}
-	
-		else if (auto* p = libt::alert_cast<libt::fastresume_rejected_alert>(a))
-		{
-			event_log().post(shared_ptr<EventDetail>(
-				new EventGeneral(lbt_category_to_event(p->category()), convert_to_ptime(p->timestamp()),
-					hal::wform(hal::app().res_wstr(HAL_FAST_RESUME_ALERT))
-						% get(p->handle)->name()
-						% hal::from_utf8_safe(p->message()))
-			));				
-		}	
-		else if (auto* p = libt::alert_cast<libt::piece_finished_alert>(a))
-		{
-			event_log().post(shared_ptr<EventDetail>(
-				new EventGeneral(event_logger::debug, convert_to_ptime(p->timestamp()),
-					hal::wform(hal::app().res_wstr(HAL_PIECE_FINISHED_ALERT))
-						% get(p->handle)->name()
-						% p->piece_index)
-			));				
-		}	
-		else if (auto* p = libt::alert_cast<libt::block_finished_alert>(a))
-		{
-	/*		event_log().post(shared_ptr<EventDetail>(
-				new EventGeneral(event_logger::debug, convert_to_ptime(p->timestamp()),
-					hal::wform(hal::app().res_wstr(HAL_BLOCK_FINISHED_ALERT))
-						% get(p->handle)->name()
-						% p->block_index
-						% p->piece_index)
-			));				
-	*/	}	
-		else if (auto* p = libt::alert_cast<libt::block_downloading_alert>(a))
-		{
-	/*		event_log().post(shared_ptr<EventDetail>(
-				new EventGeneral(event_logger::debug, convert_to_ptime(p->timestamp()),
-					hal::wform(hal::app().res_wstr(HAL_BLOCK_DOWNLOADING_ALERT))
-						% get(p->handle)->name()
-						% p->block_index
-						% p->piece_index)
-			));				
-	*/	}	
-		else if (auto* p = libt::alert_cast<libt::listen_failed_alert>(a))
+	void on_state_changed(libt::state_changed_alert& p, torrent_internal& t)
+	{
+		HAL_DEV_FORMAT(L"Torrent state changed alert, %1%. From %2% -> %3%", t.name(), p.prev_state, p.state);
+	}
+
+	// Answer to the session's post_torrent_updates, carrying only torrents whose status changed.
+	void on_state_update(libt::state_update_alert& p)
+	{
+		for (const libt::torrent_status& ts : p.status)
 		{
-			if (p->endpoint.address().is_v6())
-			{	
-				event_log().post(shared_ptr<EventDetail>(
-					new EventGeneral(event_logger::info, convert_to_ptime(p->timestamp()),
-						hal::app().res_wstr(HAL_LISTEN_V6_FAILED_ALERT))
-				));		
-			}
-			else
+			try
 			{
-				event_log().post(shared_ptr<EventDetail>(
-					new EventGeneral(event_logger::info, convert_to_ptime(p->timestamp()),
-						hal::wform(hal::app().res_wstr(HAL_LISTEN_FAILED_ALERT))
-							% hal::from_utf8_safe(p->message()))
-				));
-			}
-		}	
-		else if (auto* p = libt::alert_cast<libt::listen_succeeded_alert>(a))
-		{
-			event_log().post(shared_ptr<EventDetail>(
-				new EventGeneral(event_logger::info, convert_to_ptime(p->timestamp()),
-					hal::wform(hal::app().res_wstr(HAL_LISTEN_SUCCEEDED_ALERT))
-						% hal::from_utf8_safe(p->message()))
-			)	);	
-
-			//bit_impl_.signals.successful_listen();
-		}	
-		else if (auto* p = libt::alert_cast<libt::portmap_log_alert>(a))
-		{ 
-		
-		}	
-		else if (auto* p = libt::alert_cast<libt::dht_pkt_alert>(a))
-		{ 
-		
-		}
-		else if (auto* p = libt::alert_cast<libt::dht_log_alert>(a))
-		{ 
-		
-		}
-		else if (auto* p = libt::alert_cast<libt::log_alert>(a))
-		{ 
-			// Nothing for now
-
-		/*	event_log().post(shared_ptr<EventDetail>(
-				new EventGeneral(event_logger::debug, convert_to_ptime(a->timestamp()),
-					hal::wform(hal::app().res_wstr(HAL_LOG_ALERT))
-						% hal::from_utf8_safe(a->message()))
-			));	
-		*/
-		}
-		else if (auto* p = libt::alert_cast<libt::peer_blocked_alert>(a))
-		{
-			event_log().post(shared_ptr<EventDetail>(
-				new EventGeneral(event_logger::debug, convert_to_ptime(p->timestamp()),
-					hal::wform(hal::app().res_wstr(HAL_IPFILTER_ALERT))
-					% hal::from_utf8_safe(p->ip.to_string())
-					% hal::from_utf8_safe(p->message()))
-				));
-		}
-		else if (auto* p = libt::alert_cast<libt::peer_connect_alert>(a))
-		{
-			// Nothing for now
-		}
-		else if (auto* p = libt::alert_cast<libt::peer_disconnected_alert>(a))
-		{
-			// Nothing for now
-		}
-		else if (auto* p = libt::alert_cast<libt::peer_log_alert>(a))
-		{
-			// Nothing for now
-		}
-		else if (auto* p = libt::alert_cast<libt::torrent_log_alert>(a))
-		{
-			// Nothing for now
-		}
-		else if (auto* p = libt::alert_cast<libt::picker_log_alert>(a))
-		{
-			// Nothing for now
-		}
-		else 
-		{
-			event_log().post(shared_ptr<EventDetail>(
-				new EventGeneral(event_logger::debug, convert_to_ptime(a->timestamp()),
-					hal::wform(hal::app().res_wstr(HAL_UNHANDLED_ALERT))
-					% hal::from_utf8_safe(a->what())
-					% hal::from_utf8_safe(a->message()))
-			));	
 
-			return true;
-		}
+			get(ts.info_hash)->update_status_cache(ts);
 
-		return true;
+			}
+			catch (const bit::null_torrent&)
+			{}
+			catch (const invalid_torrent&)
+			{}
+		}
 	}
 
 	private:
@@ -14,6 +14,7 @@
 
 #include "halIni.hpp"
 #include "halConfig.hpp"
+#include "halSpans.hpp"
 //#include "ProgressDialog.hpp"
 
 namespace hal
@@ -50,6 +51,9 @@ Config::Config() :
 	ut_pex_plugin_(true),
 	smart_ban_plugin_(true),
 	lt_trackers_plugin_(true),
+	use_pack_store_(false),
+	binary_torrent_state_(true),
+	service_threads_(0),
 	queue_settings_(bind(&hal::bit::set_queue_settings, &bittorrent(), _1))
 {
 	if (hal::app().get_my_documents())
@@ -81,15 +85,17 @@ bool Config::settingsThread()
 	try
 	{
 
+	HAL_SPAN("Config::settingsThread");
+
 	event_log().post(shared_ptr<EventDetail>(new EventMsg(L"Applying BitTorrent session settings.")));
 
 	unsigned listen_port = port_range_.first;
 	int current_port = bittorrent().is_listening_on();
 
-	bittorrent().set_mapping(false, false);
-	
 	try
 	{
+	HAL_SPAN("Load IP Filter");
+
 	if (enable_ip_filter_)
 	{
 		if (pdc_)
@@ -111,6 +117,8 @@ bool Config::settingsThread()
 
 	try
 	{
+	HAL_SPAN("Protocol Encryption");
+
 	if (enable_pe_)
 	{
 		bittorrent().ensure_pe_on(pe_settings_);
@@ -124,6 +132,8 @@ bool Config::settingsThread()
 			new hal::EventStdException(event_logger::critical, e, L"settingsThread, Protocol Encryption"))); 
 	}
 	
+	bit::settings_transaction settings(bittorrent());
+
 	bittorrent().set_session_half_open_limit(half_connections_limit_);	
 	
 	bittorrent().set_session_limits(globals_.total, globals_.uploads);
@@ -136,6 +146,14 @@ bool Config::settingsThread()
 	bittorrent().set_resolve_countries(resolve_countries_);
 	bittorrent().set_announce_to_all(announce_all_trackers_, announce_all_tiers_);
 
+	settings.commit();
+
+	// Not session settings. Switching the pack store moves every torrent's files, which has
+	// no business inside a transaction that an exception from it would roll back.
+	bittorrent().use_pack_store(use_pack_store_);
+	bittorrent().use_binary_torrent_state(binary_torrent_state_);
+	bittorrent().set_service_threads(service_threads_);
+
 	if (use_custom_interface_)
 		bittorrent().set_external_interface(custom_interface_);
 	else
@@ -153,6 +171,8 @@ bool Config::settingsThread()
 	try
 	{		
 
+	HAL_SPAN("Listen");
+
 	if (randomize_port_ && (current_port < port_range_.first || current_port > port_range_.second))
 	{
 		for (int i=0, e=10; i!=e; ++i)
@@ -198,6 +218,8 @@ bool Config::settingsThread()
 	
 	if (enable_dht_)
 	{
+		HAL_SPAN("DHT");
+
 		unsigned old_port = dht_settings_.service_port;
 
 		if (dht_random_port_)
@@ -224,7 +246,10 @@ bool Config::settingsThread()
 		bittorrent().ensure_dht_off();
 
 	
-	bittorrent().set_mapping(mapping_upnp_, mapping_nat_pmp_);
+	{	HAL_SPAN("Port Mapping");
+
+		bittorrent().set_mapping(mapping_upnp_, mapping_nat_pmp_);
+	}
 
 		
 	// Settings seem to have applied ok!
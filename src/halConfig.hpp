@@ -400,6 +400,12 @@ public:
 		using boost::serialization::make_nvp;
 		switch (version)
 		{
+		case 12:
+			ar & make_nvp("service_threads", service_threads_);
+		case 11:
+			ar & make_nvp("binary_torrent_state", binary_torrent_state_);
+		case 10:
+			ar & make_nvp("use_pack_store", use_pack_store_);
 		case 9:	
 			ar & make_nvp("default_allocation_type", default_allocation_type_);
 		case 8:			
@@ -516,6 +522,10 @@ private:
 	bool use_custom_interface_;
 	std::wstring custom_interface_;	
 
+	bool use_pack_store_;
+	bool binary_torrent_state_;
+	size_t service_threads_;
+
 	hal::cache_settings cache_settings_;
 
 	action_setting<hal::queue_settings> queue_settings_;
@@ -526,7 +536,7 @@ Config& config();
 
 } // namespace hal
 
-BOOST_CLASS_VERSION(hal::Config, 9)
+BOOST_CLASS_VERSION(hal::Config, 12)
 BOOST_CLASS_VERSION(hal::queue_settings, 2)
 BOOST_CLASS_VERSION(hal::timeouts, 2)
 BOOST_CLASS_VERSION(hal::dht_settings, 2)
@@ -13,6 +13,8 @@
 #endif
 
 #include "halEvent.hpp"
+#include "halEventQueue.hpp"
+#include "halEventHistory.hpp"
 #include "../res/resource.h"
 
 
@@ -21,12 +23,188 @@ namespace hal
 
 struct event_impl
 {
-	event_impl() : debug_(false) {}
+	typedef boost::shared_ptr<EventDetail> event_ptr;
+
+	static const size_t queue_capacity = 8192;
+	static const size_t batch_limit = 256;
+
+	static const size_t history_capacity = 16384;
+	static const size_t history_bytes = 4*1024*1024;
+
+	event_impl() : 
+		policy_(event_logger::keep_important),
+		queue_(queue_capacity),
+		history_(history_capacity, history_bytes),
+		running_(true),
+		sleeping_(false),
+		posted_(0),
+		delivered_(0),
+		unreported_drops_(0)
+	{
+		for (size_t i = 0; i <= event_logger::none; ++i)
+			dropped_[i] = 0;
+
+		dispatcher_.reset(new thread_t(boost::bind(&event_impl::dispatch, this)));
+	}
+
+	~event_impl()
+	{
+		stop();
+	}
+
+	void post(const event_ptr& e)
+	{
+		if (!running_)
+		{
+			// Late stragglers after shutdown go straight through like they used to.
+			unique_lock_t l(mutex_);
+			notify(e);
+
+			return;
+		}
+
+		if (!queue_.try_push(e))
+		{
+			size_t level = std::min<size_t>(e->level(), event_logger::none);
+
+			// The dispatcher can't wait on itself, anything its subscribers post is dropped.
+			if (policy_ == event_logger::keep_important && e->level() >= event_logger::warning
+				&& boost::this_thread::get_id() != dispatcher_->get_id())
+			{
+				while (!queue_.try_push(e))
+				{
+					if (!running_) 
+					{
+						post(e);
+						return;
+					}
+
+					wake();
+					boost::this_thread::yield();
+				}
+			}
+			else
+			{
+				++dropped_[level];
+				++unreported_drops_;
+
+				return;
+			}
+		}
+
+		++posted_;
+		wake();
+	}
+
+	void wake()
+	{
+		// Pairs with the fence in dispatch, either it sees the new event or we see it asleep.
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		if (sleeping_.exchange(false))
+		{
+			boost::mutex::scoped_lock l(wake_mutex_);
+			wake_.notify_one();
+		}
+	}
+
+	void dispatch()
+	{
+		std::vector<event_ptr> batch;
+		batch.reserve(batch_limit);
+
+		for ( ; ; )
+		{
+			event_ptr e;
+
+			while (batch.size() < batch_limit && queue_.try_pop(e))
+				batch.push_back(e);
+
+			if (batch.empty())
+			{
+				boost::mutex::scoped_lock l(wake_mutex_);
+
+				sleeping_ = true;
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+
+				if (queue_.empty())
+				{
+					if (!running_) break;
+
+					// The timeout only guards against a missed wake up.
+					wake_.timed_wait(l, pt::milliseconds(100));
+				}
+
+				sleeping_ = false;
+				continue;
+			}
+
+			deliver(batch);
+			batch.clear();
+		}
+	}
+
+	void deliver(const std::vector<event_ptr>& batch)
+	{
+		unique_lock_t l(mutex_);
+
+		if (size_t dropped = unreported_drops_.exchange(0))
+		{
+			notify(event_ptr(new EventMsg(hal::wform(L"Event queue full, %1% events dropped") % dropped,
+				event_logger::warning)));
+		}
+
+		for (std::vector<event_ptr>::const_iterator i = batch.begin(), e = batch.end(); i != e; ++i)
+			notify(*i);
+
+		delivered_ += batch.size();
+	}
+
+	void notify(const event_ptr& e)
+	{
+		try
+		{
+
+		history_.append(e);
+		event_signal_(e);
+
+		}
+		catch (...)
+		{
+			// A throwing subscriber mustn't take the dispatcher down with it.
+		}
+	}
+
+	void stop()
+	{
+		{	boost::mutex::scoped_lock l(wake_mutex_);
+
+			if (!running_) return;
+			running_ = false;
+		}
+		wake_.notify_one();
+
+		dispatcher_->join();
+	}
 
 	mutable mutex_t mutex_;
 
-	bool debug_;
+	std::atomic<event_logger::overflow_policy> policy_;
 	boost::signals2::signal<void (boost::shared_ptr<EventDetail>)> event_signal_;
+
+	bounded_mpsc_queue<event_ptr> queue_;
+	event_history history_;
+
+	std::atomic<bool> running_;
+	std::atomic<bool> sleeping_;
+	boost::mutex wake_mutex_;
+	boost::condition_variable wake_;
+	boost::scoped_ptr<thread_t> dispatcher_;
+
+	std::atomic<boost::uint64_t> posted_;
+	std::atomic<boost::uint64_t> delivered_;
+	std::atomic<boost::uint64_t> dropped_[event_logger::none + 1];
+	std::atomic<size_t> unreported_drops_;
 };
 
 event_logger::event_logger()
@@ -70,18 +248,55 @@ void event_logger::dettach(const boost::signals2::connection& c)
 
 void event_logger::set_debug_logging(bool d)
 {
-	pimpl_->debug_ = d;
+	const unsigned debug_levels = (1u << dev) | (1u << debug);
+
+	if (d)
+		level_mask() |= debug_levels;
+	else
+		level_mask() &= ~debug_levels;
 }
 
 void event_logger::post(boost::shared_ptr<EventDetail> e)
 {
 	if (pimpl_)
 	{
-		unique_lock_t l(pimpl_->mutex_);
+		if (enabled(e->level()))
+			pimpl_->post(e);
+	}
+}
+
+void event_logger::set_overflow_policy(overflow_policy p)
+{
+	if (pimpl_)
+		pimpl_->policy_ = p;
+}
+
+event_logger::queue_stats event_logger::get_queue_stats() const
+{
+	queue_stats stats = {};
+
+	if (pimpl_)
+	{
+		stats.posted = pimpl_->posted_;
+		stats.delivered = pimpl_->delivered_;
+		stats.capacity = pimpl_->queue_.capacity();
 
-		if (pimpl_->debug_ || !(e->level() == hal::event_logger::debug || e->level() == hal::event_logger::dev))
-			pimpl_->event_signal_(e);
+		for (size_t i = 0; i <= none; ++i)
+			stats.dropped[i] = pimpl_->dropped_[i];
 	}
+
+	return stats;
+}
+
+void event_logger::shutdown()
+{
+	if (pimpl_)
+		pimpl_->stop();
+}
+
+event_history& event_logger::history()
+{
+	return pimpl_->history_;
 }
 	
 std::wstring event_logger::eventLevelToStr(eventLevel event)
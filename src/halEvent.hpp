@@ -45,21 +45,32 @@
 
 #include "halTorrent.hpp"
 
+// The level is checked before the message is built, so a disabled level costs no formatting.
+#define HAL_LEVEL_MSG(level, msg) \
+	do { if (hal::event_logger::enabled(level)) \
+		hal::event_log().post(boost::shared_ptr<hal::EventDetail>(new hal::EventMsg(msg, level))); } while (false)
+
+// As above but formatting is left to whichever sink first asks for the message, 
+// HAL_DEV_FORMAT(L"Torrent %1% at %2%", name, progress).
+#define HAL_LEVEL_FORMAT(level, ...) \
+	do { if (hal::event_logger::enabled(level)) \
+		hal::event_log().post(hal::event_format(level, __VA_ARGS__)); } while (false)
+
 #ifdef HAL_TORRENT_DEV_MSGES
-#	define HAL_DEV_MSG(msg) \
-	hal::event_log().post(boost::shared_ptr<hal::EventDetail>(new hal::EventMsg(msg, hal::event_logger::dev))) 
+#	define HAL_DEV_MSG(msg) HAL_LEVEL_MSG(hal::event_logger::dev, msg)
+#	define HAL_DEV_FORMAT(...) HAL_LEVEL_FORMAT(hal::event_logger::dev, __VA_ARGS__)
 #else
 #	define HAL_DEV_MSG(msg)
+#	define HAL_DEV_FORMAT(...)
 #endif
 
 
-#define HAL_DEBUG_MSG(msg) \
-	hal::event_log().post(boost::shared_ptr<hal::EventDetail>(new hal::EventMsg(msg, hal::event_logger::debug))) 
+#define HAL_DEBUG_MSG(msg) HAL_LEVEL_MSG(hal::event_logger::debug, msg)
+#define HAL_DEBUG_FORMAT(...) HAL_LEVEL_FORMAT(hal::event_logger::debug, __VA_ARGS__)
 
 
 #ifdef HAL_SORT_LOGGING
-#	define HAL_DEV_SORT_MSG(msg) \
-	hal::event_log().post(boost::shared_ptr<hal::EventDetail>(new hal::EventMsg(msg, hal::event_logger::dev))) 
+#	define HAL_DEV_SORT_MSG(msg) HAL_LEVEL_MSG(hal::event_logger::dev, msg)
 #else
 #	define HAL_DEV_SORT_MSG(msg)
 #endif
@@ -165,6 +176,7 @@ namespace hal
 {
 
 struct event_impl;
+class event_history;
 
 class event_logger : private boost::noncopyable
 {	
@@ -185,6 +197,21 @@ public:
 		tracker = HAL_EVENT_TRACKER,
 		infoCode
 	};
+
+	// What post does when the dispatcher has fallen a full queue behind.
+	enum overflow_policy 
+	{ 
+		drop_when_full,		// every level is dropped and counted
+		keep_important		// warnings and above wait for space, the rest are dropped
+	};
+
+	struct queue_stats
+	{
+		boost::uint64_t posted;
+		boost::uint64_t delivered;
+		boost::uint64_t dropped[none + 1];
+		size_t capacity;
+	};
 	
 	event_logger();
 	~event_logger();
@@ -194,14 +221,37 @@ public:
 	bool is_active() { return static_cast<bool>(pimpl_); }
 	void set_debug_logging(bool d);
 
+	// Checked by the logging macros before they evaluate their arguments.
+	static bool enabled(eventLevel l)
+	{
+		return (level_mask().load(std::memory_order_relaxed) & (1u << l)) != 0;
+	}
+
 	boost::signals2::connection attach(boost::function<void (boost::shared_ptr<EventDetail>)> fn);
 	void dettach(const boost::signals2::connection& c);
 
+	// Queues the event for the dispatcher thread, subscribers are never called on the 
+	// posting thread unless the logger has been shut down.
 	void post(boost::shared_ptr<EventDetail> e);
+
+	void set_overflow_policy(overflow_policy p);
+	queue_stats get_queue_stats() const;
+
+	// Delivers whatever is still queued and stops the dispatcher.
+	void shutdown();
+
+	// Every delivered event is also kept here, within its limits, for viewers to pull from.
+	event_history& history();
 	
 	static std::wstring eventLevelToStr(eventLevel);
 
 private:
+	static std::atomic<unsigned>& level_mask()
+	{
+		static std::atomic<unsigned> mask(~((1u << dev) | (1u << debug)));
+		return mask;
+	}
+
 	boost::shared_ptr<event_impl> pimpl_;
 };
 
@@ -229,6 +279,15 @@ public:
 		return (wform(L"Code %1%") % code()).str();
 	}
 
+	// Structured view for the binary event log. Events that keep their format string apart
+	// return it from format() and its arguments from arguments(), the rest log msg() whole.
+	virtual uuid torrent() { return uuid(); }
+	virtual std::wstring format() { return std::wstring(); }
+	virtual void arguments(std::vector<std::wstring>& args) { args.push_back(msg()); }
+
+	// Approximate memory held by the event, charged against the event_history budget.
+	virtual size_t footprint() { return sizeof(EventDetail); }
+
 	event_logger::eventLevel level() { return level_; }
 	pt::ptime  timeStamp() { return timeStamp_; }
 	event_logger::codes code() { return code_; }
@@ -313,11 +372,94 @@ public:
 		else
 			return msg_;
 	}
+
+	virtual size_t footprint() { return sizeof(*this) + msg_.capacity()*sizeof(wchar_t); }
 	
 private:
 	std::wstring msg_;
 };
 
+// An EventMsg about one torrent, which the event log files under it.
+class EventTorrentMsg : public EventMsg
+{
+public:
+	template<typename str_t>
+	EventTorrentMsg(const uuid& id, str_t m, event_logger::eventLevel l=event_logger::info, 
+		pt::ptime t = boost::posix_time::second_clock::universal_time()) :
+		EventMsg(m, l, t),
+		id_(id)
+	{}
+
+	virtual uuid torrent() { return id_; }
+	virtual size_t footprint() { return EventMsg::footprint() + sizeof(id_); }
+	
+private:
+	uuid id_;
+};
+
+// Keeps the format string and a copy of the arguments, the message is only rendered the first
+// time a sink asks for it. Arguments must be safe to format from the dispatcher thread.
+template<typename... Args>
+class EventFormat : public EventDetail
+{
+public:
+	EventFormat(event_logger::eventLevel l, const std::wstring& f, const Args&... args) :
+		EventDetail(l, boost::posix_time::second_clock::universal_time(), event_logger::noEvent),
+		format_(f),
+		args_(args...)
+	{}
+	
+	virtual std::wstring msg()
+	{
+		std::call_once(rendered_once_, [this] { rendered_ = render(std::index_sequence_for<Args...>()); });
+
+		return rendered_;
+	}
+
+	virtual std::wstring format() { return format_; }
+
+	virtual size_t footprint() 
+	{ 
+		return sizeof(*this) + (format_.capacity() + rendered_.capacity())*sizeof(wchar_t); 
+	}
+
+	virtual void arguments(std::vector<std::wstring>& args)
+	{
+		collect(args, std::index_sequence_for<Args...>());
+	}
+	
+private:
+	template<size_t... I>
+	void collect(std::vector<std::wstring>& args, std::index_sequence<I...>) const
+	{
+		int expand[] = { 0, ((void)(args.push_back((wform(L"%1%") % std::get<I>(args_)).str())), 0)... };
+		(void)expand;
+	}
+
+	template<size_t... I>
+	std::wstring render(std::index_sequence<I...>) const
+	{
+		wform f(format_);
+
+		int expand[] = { 0, ((void)(f % std::get<I>(args_)), 0)... };
+		(void)expand;
+
+		return f.str();
+	}
+
+	std::wstring format_;
+	std::tuple<Args...> args_;
+
+	std::once_flag rendered_once_;
+	std::wstring rendered_;
+};
+
+template<typename... Args>
+boost::shared_ptr<EventDetail> event_format(event_logger::eventLevel l, const std::wstring& f, const Args&... args)
+{
+	return boost::shared_ptr<EventDetail>(new EventFormat<typename std::decay<Args>::type...>(l, f, args...));
+}
+
 class EventPeerAlert : public EventDetail
 {
 public:
@@ -368,6 +510,8 @@ public:
 	{
 		return (wform(hal::app().res_wstr(code())) % id_ % function_).str();
 	}
+
+	virtual uuid torrent() { return id_; }
 	
 private:
 	std::wstring function_;
@@ -390,6 +534,8 @@ public:
 	{
 		return (wform(hal::app().res_wstr(code())) % id_ % exception_ % function_).str();
 	}
+
+	virtual uuid torrent() { return id_; }
 	
 private:
 	hal::uuid id_;
@@ -0,0 +1,137 @@
+
+//         Copyright Ein O'Callaghan 2009 - 2009.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include "halEvent.hpp"
+
+namespace hal
+{
+
+// The most recent events, kept in a fixed number of slots and under a memory budget. Every
+// event gets the next sequence number as it is appended and the oldest are evicted when
+// either limit is reached. Viewers remember the sequence number they read up to and pull
+// whatever is newer, so one wake up can cover any number of events.
+class event_history :
+	private boost::noncopyable
+{
+public:
+	typedef boost::shared_ptr<EventDetail> event_ptr;
+
+	// Rough cost of a slot and the shared_ptr control block on top of the event itself.
+	static const size_t slot_overhead = sizeof(event_ptr) + 4*sizeof(void*);
+
+	event_history(size_t capacity, size_t max_bytes) :
+		slots_(std::max<size_t>(capacity, 1)),
+		max_bytes_(max_bytes),
+		bytes_(0),
+		first_(0),
+		next_(0)
+	{}
+
+	// Called by the event dispatcher only.
+	boost::uint64_t append(const event_ptr& e)
+	{
+		size_t bytes = e->footprint() + slot_overhead;
+
+		boost::mutex::scoped_lock l(mutex_);
+
+		while (next_ != first_ && (next_ - first_ == slots_.size() || bytes_ + bytes > max_bytes_))
+			evict_oldest();
+
+		slot& s = slots_[next_ % slots_.size()];
+		s.event = e;
+		s.bytes = bytes;
+
+		bytes_ += bytes;
+
+		return next_++;
+	}
+
+	// Copies up to max events, oldest first, starting at sequence number from or at the oldest
+	// still held if that has already been evicted. Returns the sequence number to read from
+	// next time.
+	boost::uint64_t read(boost::uint64_t from, std::vector<event_ptr>& out, size_t max = ~size_t(0)) const
+	{
+		boost::mutex::scoped_lock l(mutex_);
+
+		boost::uint64_t seq = std::max(from, first_);
+
+		for (; seq != next_ && max != 0; ++seq, --max)
+			out.push_back(slots_[seq % slots_.size()].event);
+
+		return std::max(seq, from);
+	}
+
+	// Sequence number of the oldest event held.
+	boost::uint64_t first() const
+	{
+		boost::mutex::scoped_lock l(mutex_);
+		return first_;
+	}
+
+	// Sequence number the next event appended will get.
+	boost::uint64_t next() const
+	{
+		boost::mutex::scoped_lock l(mutex_);
+		return next_;
+	}
+
+	size_t bytes() const
+	{
+		boost::mutex::scoped_lock l(mutex_);
+		return bytes_;
+	}
+
+	// Keeps the newest events that still fit.
+	void set_limits(size_t capacity, size_t max_bytes)
+	{
+		boost::mutex::scoped_lock l(mutex_);
+
+		capacity = std::max<size_t>(capacity, 1);
+		max_bytes_ = max_bytes;
+
+		while (next_ != first_ && (next_ - first_ > capacity || bytes_ > max_bytes_))
+			evict_oldest();
+
+		std::vector<slot> resized(capacity);
+		for (boost::uint64_t seq = first_; seq != next_; ++seq)
+			std::swap(resized[seq % capacity], slots_[seq % slots_.size()]);
+
+		slots_.swap(resized);
+	}
+
+private:
+	struct slot
+	{
+		slot() : bytes(0) {}
+
+		event_ptr event;
+		size_t bytes;
+	};
+
+	void evict_oldest()
+	{
+		slot& s = slots_[first_ % slots_.size()];
+
+		bytes_ -= s.bytes;
+		s.event.reset();
+		s.bytes = 0;
+
+		++first_;
+	}
+
+	mutable boost::mutex mutex_;
+
+	std::vector<slot> slots_;
+	size_t max_bytes_;
+	size_t bytes_;
+
+	boost::uint64_t first_;
+	boost::uint64_t next_;
+};
+
+}
@@ -0,0 +1,195 @@
+
+//         Copyright Ein O'Callaghan 2009 - 2009.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "halPch.hpp"
+
+#include "halEventLog.hpp"
+
+namespace hal
+{
+
+namespace
+{
+
+// Up to the end of the last whole record, 0 when the header is bad.
+boost::uintmax_t complete_length(const fs::path& file)
+{
+	fs::ifstream ifs(file, std::ios::binary);
+
+	if (!ifs || !event_log_format::read_header(ifs)) return 0;
+
+	event_log_format::record r;
+	std::vector<char> scratch;
+
+	boost::uintmax_t length = event_log_format::header_size;
+
+	while (event_log_format::read_record(ifs, r, scratch))
+		length = static_cast<boost::uintmax_t>(ifs.tellg());
+
+	return length;
+}
+
+}
+
+binary_event_log::binary_event_log(const fs::path& directory, boost::uintmax_t max_file_size, size_t max_files) :
+	directory_(directory),
+	max_file_size_(max_file_size),
+	max_files_(std::max<size_t>(max_files, 1)),
+	file_size_(0),
+	last_flush_(pt::microsec_clock::universal_time())
+{
+	batch_.reserve(batch_size + batch_size/4);
+}
+
+binary_event_log::~binary_event_log()
+{
+	disconnect();
+
+	try
+	{
+
+	flush();
+
+	}
+	catch (...)
+	{}
+}
+
+void binary_event_log::connect()
+{
+	event_log().init();
+	conn_ = event_log().attach(boost::bind(&binary_event_log::on_event, this, _1));
+}
+
+void binary_event_log::disconnect()
+{
+	conn_.disconnect();
+}
+
+void binary_event_log::flush()
+{
+	boost::mutex::scoped_lock l(mutex_);
+
+	flush_locked();
+}
+
+void binary_event_log::on_event(boost::shared_ptr<EventDetail> event)
+{
+	static const pt::ptime epoch(boost::gregorian::date(1970, 1, 1));
+
+	boost::mutex::scoped_lock l(mutex_);
+
+	record_.time = (event->timeStamp() - epoch).total_microseconds();
+	record_.level = event->level();
+	record_.code = event->code();
+	record_.torrent = event->torrent();
+	record_.format = to_utf8(event->format());
+
+	args_.clear();
+	event->arguments(args_);
+
+	record_.args.resize(args_.size());
+	for (size_t i = 0, e = args_.size(); i != e; ++i)
+		record_.args[i] = to_utf8(args_[i]);
+
+	event_log_format::write_record(batch_, record_);
+
+	pt::ptime now = pt::microsec_clock::universal_time();
+
+	if (batch_.size() >= batch_size || event->level() >= event_logger::warning
+			|| now - last_flush_ >= pt::seconds(1))
+		flush_locked();
+}
+
+void binary_event_log::flush_locked()
+{
+	last_flush_ = pt::microsec_clock::universal_time();
+
+	if (batch_.empty()) return;
+
+	if (!ofs_.is_open() || file_size_ >= max_file_size_)
+	{
+		if (ofs_.is_open()) rotate();
+		open();
+	}
+
+	ofs_.write(&batch_[0], batch_.size());
+	ofs_.flush();
+
+	file_size_ += batch_.size();
+	batch_.clear();
+}
+
+void binary_event_log::open()
+{
+	if (!fs::is_directory(directory_))
+		fs::create_directories(directory_);
+
+	fs::path current = file(0);
+
+	if (fs::exists(current) && fs::file_size(current) >= max_file_size_)
+		rotate();
+
+	file_size_ = fs::exists(current) ? fs::file_size(current) : 0;
+
+	// Readers stop at the first bad record, so anything appended after a torn one left by a
+	// crash would never be seen. Cut the file back to its last whole record first. This runs
+	// on the dispatcher, so it can't post about it.
+	if (file_size_ != 0)
+	{
+		boost::uintmax_t length = complete_length(current);
+
+		if (length < file_size_)
+		{
+			fs::resize_file(current, length);
+			file_size_ = length;
+		}
+	}
+
+	ofs_.open(current, std::ios::binary | std::ios::app);
+
+	// A file cut short before its header was written, or with a bad one, is no use. Start
+	// it again.
+	if (file_size_ < event_log_format::header_size)
+	{
+		ofs_.close();
+		ofs_.open(current, std::ios::binary | std::ios::trunc);
+
+		std::vector<char> header;
+		event_log_format::write_header(header);
+
+		ofs_.write(&header[0], header.size());
+		file_size_ = header.size();
+	}
+}
+
+void binary_event_log::rotate()
+{
+	if (ofs_.is_open()) ofs_.close();
+
+	boost::system::error_code ec;
+
+	fs::remove(file(max_files_ - 1), ec);
+
+	for (size_t n = max_files_ - 1; n > 0; --n)
+	{
+		if (fs::exists(file(n - 1)))
+			fs::rename(file(n - 1), file(n), ec);
+	}
+
+	fs::remove(file(0), ec);
+	file_size_ = 0;
+}
+
+fs::path binary_event_log::file(size_t n) const
+{
+	if (n == 0)
+		return directory_ / L"HaliteEvents.bin";
+	else
+		return directory_ / (wform(L"HaliteEvents.%1%.bin") % n).str();
+}
+
+}
@@ -0,0 +1,61 @@
+
+//         Copyright Ein O'Callaghan 2009 - 2009.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include "halEvent.hpp"
+#include "halEventLogFormat.hpp"
+
+namespace hal
+{
+
+// Append only binary sink for the event log, decoded offline by halEventDump. Records are
+// batched in memory and written when the batch fills, when it is a second old or when a
+// warning or worse arrives, so leaving it attached at full trace costs one buffer copy per
+// event. Files roll over by size, HaliteEvents.bin being the newest and HaliteEvents.N.bin
+// older, with the oldest deleted once there are max_files of them.
+class binary_event_log :
+	private boost::noncopyable
+{
+public:
+	binary_event_log(const fs::path& directory,
+		boost::uintmax_t max_file_size = 32*1024*1024, size_t max_files = 8);
+
+	~binary_event_log();
+
+	void connect();
+	void disconnect();
+
+	void flush();
+
+private:
+	static const size_t batch_size = 64*1024;
+
+	void on_event(boost::shared_ptr<EventDetail> event);
+
+	void flush_locked();
+	void open();
+	void rotate();
+
+	fs::path file(size_t n) const;
+
+	fs::path directory_;
+	boost::uintmax_t max_file_size_;
+	size_t max_files_;
+
+	boost::mutex mutex_;
+	fs::ofstream ofs_;
+	boost::uintmax_t file_size_;
+
+	std::vector<char> batch_;
+	event_log_format::record record_;
+	std::vector<std::wstring> args_;
+	pt::ptime last_flush_;
+
+	boost::signals2::connection conn_;
+};
+
+}
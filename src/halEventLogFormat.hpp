@@ -0,0 +1,197 @@
+
+//         Copyright Ein O'Callaghan 2009 - 2009.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+// Shared by the binary_event_log sink and the halEventDump decoder, so keep this to the
+// standard library and header only Boost.
+
+#include <cstring>
+#include <istream>
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/uuid/uuid.hpp>
+
+namespace hal
+{
+namespace event_log_format
+{
+
+// A log file is the magic and version followed by records until the end of the file. A record
+// is, little endian throughout,
+//
+//	u32	size of the rest of the record
+//	i64	microseconds since 1970-01-01 UTC
+//	u8	level
+//	u32	code
+//	u8[16]	torrent uuid, nil when the event isn't about a torrent
+//	u16	argument count, then per argument a u32 length and that many bytes of UTF-8
+//
+// The first argument is the event's format string, empty when the event was logged as a
+// finished message. A torn last record left by a crash is ignored on reading and cut off when
+// the sink next opens the file.
+
+static const char magic[8] = { 'H', 'A', 'L', 'E', 'V', 'L', 'G', '\0' };
+static const boost::uint32_t version = 1;
+
+static const size_t header_size = sizeof(magic) + 4;
+
+// Far beyond any real event, a bigger size can only come from a torn or damaged record.
+static const boost::uint32_t max_record_size = 16*1024*1024;
+
+struct record
+{
+	boost::int64_t time;
+	unsigned level;
+	unsigned code;
+	boost::uuids::uuid torrent;
+	std::string format;
+	std::vector<std::string> args;
+};
+
+namespace detail
+{
+
+template<typename T>
+void put(std::vector<char>& buf, T v)
+{
+	for (size_t i = 0; i < sizeof(T); ++i)
+		buf.push_back(static_cast<char>((static_cast<boost::uint64_t>(v) >> (8 * i)) & 0xff));
+}
+
+inline void put_string(std::vector<char>& buf, const std::string& s)
+{
+	put(buf, static_cast<boost::uint32_t>(s.size()));
+	buf.insert(buf.end(), s.begin(), s.end());
+}
+
+template<typename T>
+bool get(const char*& p, const char* end, T& v)
+{
+	if (static_cast<size_t>(end - p) < sizeof(T)) return false;
+
+	boost::uint64_t r = 0;
+	for (size_t i = 0; i < sizeof(T); ++i)
+		r |= static_cast<boost::uint64_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+
+	v = static_cast<T>(r);
+	p += sizeof(T);
+
+	return true;
+}
+
+inline bool get_string(const char*& p, const char* end, std::string& s)
+{
+	boost::uint32_t len;
+	if (!get(p, end, len) || static_cast<size_t>(end - p) < len) return false;
+
+	s.assign(p, p + len);
+	p += len;
+
+	return true;
+}
+
+}
+
+inline void write_header(std::vector<char>& buf)
+{
+	buf.insert(buf.end(), magic, magic + sizeof(magic));
+	detail::put(buf, version);
+}
+
+inline bool read_header(std::istream& is)
+{
+	char m[sizeof(magic)];
+	char v[4];
+
+	if (!is.read(m, sizeof(m)) || std::memcmp(m, magic, sizeof(magic)) != 0)
+		return false;
+
+	if (!is.read(v, sizeof(v)))
+		return false;
+
+	boost::uint32_t ver;
+	const char* p = v;
+	detail::get(p, v + sizeof(v), ver);
+
+	return ver == version;
+}
+
+inline void write_record(std::vector<char>& buf, const record& r)
+{
+	size_t start = buf.size();
+	detail::put(buf, boost::uint32_t(0));
+
+	detail::put(buf, r.time);
+	detail::put(buf, static_cast<boost::uint8_t>(r.level));
+	detail::put(buf, static_cast<boost::uint32_t>(r.code));
+	buf.insert(buf.end(), r.torrent.begin(), r.torrent.end());
+
+	detail::put(buf, static_cast<boost::uint16_t>(r.args.size() + 1));
+	detail::put_string(buf, r.format);
+	for (const std::string& a : r.args)
+		detail::put_string(buf, a);
+
+	boost::uint32_t size = static_cast<boost::uint32_t>(buf.size() - start - 4);
+	for (size_t i = 0; i < 4; ++i)
+		buf[start + i] = static_cast<char>((size >> (8 * i)) & 0xff);
+}
+
+// False at the end of the file or on a truncated or malformed record.
+inline bool read_record(std::istream& is, record& r, std::vector<char>& scratch)
+{
+	char s[4];
+	if (!is.read(s, sizeof(s))) return false;
+
+	boost::uint32_t size;
+	const char* sp = s;
+	detail::get(sp, s + sizeof(s), size);
+
+	if (size > max_record_size) return false;
+
+	scratch.resize(size);
+	if (size && !is.read(&scratch[0], size)) return false;
+
+	const char* p = scratch.data();
+	const char* end = p + size;
+
+	boost::uint8_t level;
+	boost::uint32_t code;
+	boost::uint16_t count;
+
+	if (!detail::get(p, end, r.time) || !detail::get(p, end, level) || !detail::get(p, end, code))
+		return false;
+
+	if (static_cast<size_t>(end - p) < r.torrent.size()) return false;
+	std::memcpy(r.torrent.data, p, r.torrent.size());
+	p += r.torrent.size();
+
+	if (!detail::get(p, end, count) || count == 0) return false;
+	if (!detail::get_string(p, end, r.format)) return false;
+
+	r.level = level;
+	r.code = code;
+	r.args.resize(count - 1);
+
+	for (std::string& a : r.args)
+		if (!detail::get_string(p, end, a)) return false;
+
+	return true;
+}
+
+// Mirrors the order of event_logger::eventLevel, which the decoder can't include.
+inline const char* level_name(unsigned level)
+{
+	static const char* const names[] =
+		{ "dev", "xml_dev", "torrent_dev", "debug", "info", "warning", "critical", "fatal", "none" };
+
+	return level < sizeof(names)/sizeof(names[0]) ? names[level] : "unknown";
+}
+
+}
+}
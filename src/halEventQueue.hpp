@@ -0,0 +1,124 @@
+
+//         Copyright Ein O'Callaghan 2009 - 2009.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#if defined(HALTORRENT_PCH)
+#	include "halPch.hpp"
+#else
+#	include <atomic>
+#	include <cstddef>
+#	include <boost/noncopyable.hpp>
+#	include <boost/scoped_array.hpp>
+#endif
+
+namespace hal
+{
+
+// Bounded queue for many producers and a single consumer, after Dmitry Vyukov's array based
+// design. Every cell carries a sequence number telling producers and the consumer whose turn
+// it is, so producers only contend on one compare and swap and never wait on each other.
+template<typename T>
+class bounded_mpsc_queue :
+	private boost::noncopyable
+{
+public:
+	// Capacity is rounded up to a power of two.
+	explicit bounded_mpsc_queue(size_t capacity) :
+		mask_(round_up(capacity) - 1),
+		cells_(new cell[mask_ + 1]),
+		enqueue_pos_(0),
+		dequeue_pos_(0)
+	{
+		for (size_t i = 0; i <= mask_; ++i)
+			cells_[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	size_t capacity() const { return mask_ + 1; }
+
+	// Fails rather than waits when the queue is full.
+	bool try_push(const T& value)
+	{
+		cell* c;
+		size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+
+		for ( ; ; )
+		{
+			c = &cells_[pos & mask_];
+			size_t seq = c->sequence.load(std::memory_order_acquire);
+			std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+
+			if (diff == 0)
+			{
+				if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0)
+				return false;
+			else
+				pos = enqueue_pos_.load(std::memory_order_relaxed);
+		}
+
+		c->value = value;
+		c->sequence.store(pos + 1, std::memory_order_release);
+
+		return true;
+	}
+
+	// Consumer thread only.
+	bool try_pop(T& value)
+	{
+		cell* c = &cells_[dequeue_pos_ & mask_];
+		size_t seq = c->sequence.load(std::memory_order_acquire);
+
+		if (static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(dequeue_pos_ + 1) < 0)
+			return false;
+
+		value = c->value;
+		c->value = T();
+		c->sequence.store(dequeue_pos_ + mask_ + 1, std::memory_order_release);
+
+		++dequeue_pos_;
+		return true;
+	}
+
+	// Consumer thread only.
+	bool empty() const
+	{
+		const cell* c = &cells_[dequeue_pos_ & mask_];
+
+		return static_cast<std::ptrdiff_t>(c->sequence.load(std::memory_order_acquire))
+			- static_cast<std::ptrdiff_t>(dequeue_pos_ + 1) < 0;
+	}
+
+private:
+	struct cell
+	{
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	static size_t round_up(size_t n)
+	{
+		size_t p = 2;
+		while (p < n) p <<= 1;
+
+		return p;
+	}
+
+	// Producers hammer enqueue_pos_, keep it off the consumer's cache line.
+	enum { cache_line = 64 };
+
+	const size_t mask_;
+	boost::scoped_array<cell> cells_;
+
+	char pad_enqueue_[cache_line];
+	std::atomic<size_t> enqueue_pos_;
+	char pad_dequeue_[cache_line];
+	size_t dequeue_pos_;
+};
+
+}
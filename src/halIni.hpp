@@ -13,6 +13,7 @@
 #endif
 
 #include "global/wtl_app.hpp"
+#include "global/work_file.hpp"
 #include "halEvent.hpp"
 
 namespace hal 
@@ -24,7 +25,8 @@ class IniBase
 public:
 	IniBase(boost::filesystem::wpath location, std::wstring name) :
 		name_(name),
-		directory_(app().get_working_directory() / L"config" / location)
+		directory_(app().get_working_directory() / L"config" / location),
+		file_((fs::wpath(L"config") / location / (name + L".xml")).wstring())
 	{
 		initialise();
 	}
@@ -37,51 +39,55 @@ public:
 			fs::create_directories(directory_);
 	}
 	
+	// Replaces the file whole once the archive is done, see work_file.
 	void save_to_ini()
 	{
-		fs::wofstream ofs(directory_ / (name_ + L".xml"));
+		shared_wostream_ptr ofs = file_.wostream();
 
-		ofs.imbue(std::locale(ofs.getloc(),
-			new std::codecvt_utf16<wchar_t, 0x10ffff, std::little_endian>));
-
-		boost::archive::xml_woarchive woa(ofs);
+		boost::archive::xml_woarchive woa(*ofs);
 
 		T* pT = static_cast<T*>(this);	
 		woa << boost::serialization::make_nvp(to_utf8(name_).c_str(), *pT);
 		
 	}
 		
+	// Falls back on the copies an interrupted save leaves when the main file won't load.
 	bool load_from_ini(bool report_exception = true)
 	{
-		try 
-		{
-
-		fs::wifstream ifs(directory_ / (name_ + L".xml"));
-
-		ifs.imbue(std::locale(ifs.getloc(),
-			new std::codecvt_utf16<wchar_t, 0x10ffff, std::little_endian>));
-
-		boost::archive::xml_wiarchive wia(ifs);
+		std::vector<fs::wpath> files = file_.candidates();
+		std::wstring contents;
 
-		T* pT = static_cast<T*>(this);	
-		wia >> boost::serialization::make_nvp(to_utf8(name_).c_str(), *pT);
-		
-		}
-		catch (const std::exception& e)
-		{			
-			if (report_exception)
-				hal::event_log().post(boost::shared_ptr<hal::EventDetail>(
-					new hal::EventXmlException(hal::from_utf8(e.what()), name_))); 
-
-			return false;
+		for (auto i = files.begin(), e = files.end(); i != e; ++i)
+		{
+			try 
+			{
+
+			if (!work_file::read(*i, contents)) continue;
+
+			std::wistringstream ifs(contents);
+			boost::archive::xml_wiarchive wia(ifs);
+
+			T* pT = static_cast<T*>(this);	
+			wia >> boost::serialization::make_nvp(to_utf8(name_).c_str(), *pT);
+
+			return true;
+			
+			}
+			catch (const std::exception& e)
+			{			
+				if (report_exception)
+					hal::event_log().post(boost::shared_ptr<hal::EventDetail>(
+						new hal::EventXmlException(hal::from_utf8(e.what()), name_))); 
+			}
 		}
 
-		return true;
+		return false;
 	}
 	
 private:
 	std::wstring name_;	
 	fs::wpath directory_;
+	work_file file_;
 };
 
 }
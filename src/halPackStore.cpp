@@ -0,0 +1,484 @@
+
+//         Copyright Ein O'Callaghan 2009 - 2009.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "halPch.hpp"
+
+#include "halPackStore.hpp"
+
+namespace hal
+{
+
+namespace
+{
+
+// The file starts with the magic and a version, then records of, little endian,
+//
+//	u32	record_magic
+//	u8	kind
+//	u8	flags, 1 for an erased key
+//	u16	reserved
+//	u8[20]	info hash
+//	u32	payload size
+//	u32	crc32 of the payload
+//	payload
+
+const char file_magic[8] = { 'H', 'A', 'L', 'P', 'A', 'C', 'K', '\0' };
+const boost::uint32_t file_version = 1;
+const size_t file_header_size = sizeof(file_magic) + 4;
+
+const boost::uint32_t record_magic = 0x4b504c48;	// "HLPK"
+const size_t record_header_size = 4 + 4 + 20 + 4 + 4;
+
+const boost::uint8_t erased_flag = 1;
+
+void put_u32(char* p, boost::uint32_t v)
+{
+	for (size_t i = 0; i < 4; ++i)
+		p[i] = static_cast<char>((v >> (8 * i)) & 0xff);
+}
+
+boost::uint32_t get_u32(const char* p)
+{
+	boost::uint32_t v = 0;
+	for (size_t i = 0; i < 4; ++i)
+		v |= static_cast<boost::uint32_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+
+	return v;
+}
+
+// The same CRC-32 as boost::crc_32_type, eight bytes a step rather than one. Every record
+// read is checked so this is most of what loading costs.
+class crc32_tables
+{
+public:
+	crc32_tables()
+	{
+		for (boost::uint32_t i = 0; i < 256; ++i)
+		{
+			boost::uint32_t c = i;
+			for (int k = 0; k < 8; ++k)
+				c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+
+			t_[0][i] = c;
+		}
+
+		for (boost::uint32_t i = 0; i < 256; ++i)
+			for (int n = 1; n < 8; ++n)
+				t_[n][i] = (t_[n-1][i] >> 8) ^ t_[0][t_[n-1][i] & 0xff];
+	}
+
+	boost::uint32_t operator()(const char* data, size_t size) const
+	{
+		const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+		boost::uint32_t c = 0xffffffff;
+
+		for (; size >= 8; size -= 8, p += 8)
+		{
+			boost::uint32_t lo = c ^ (p[0] | p[1] << 8 | p[2] << 16 | static_cast<boost::uint32_t>(p[3]) << 24);
+			boost::uint32_t hi = p[4] | p[5] << 8 | p[6] << 16 | static_cast<boost::uint32_t>(p[7]) << 24;
+
+			c = t_[7][lo & 0xff] ^ t_[6][(lo >> 8) & 0xff] ^ t_[5][(lo >> 16) & 0xff] ^ t_[4][lo >> 24] ^
+				t_[3][hi & 0xff] ^ t_[2][(hi >> 8) & 0xff] ^ t_[1][(hi >> 16) & 0xff] ^ t_[0][hi >> 24];
+		}
+
+		for (; size != 0; --size, ++p)
+			c = (c >> 8) ^ t_[0][(c ^ *p) & 0xff];
+
+		return c ^ 0xffffffff;
+	}
+
+private:
+	boost::uint32_t t_[8][256];
+};
+
+const crc32_tables crc32;
+
+boost::uint32_t checksum(const char* data, size_t size)
+{
+	return crc32(data, size);
+}
+
+}
+
+pack_store::pack_store(const fs::wpath& file) :
+	file_(file),
+	file_end_(0),
+	live_bytes_(0),
+	truncated_bytes_(0)
+{
+	open();
+}
+
+pack_store::~pack_store()
+{
+	try
+	{
+
+	boost::mutex::scoped_lock l(mutex_);
+	commit_locked();
+
+	}
+	catch (...)
+	{}
+}
+
+bool pack_store::get(const libt::sha1_hash& hash, record_kind kind, std::vector<char>& data) const
+{
+	boost::mutex::scoped_lock l(mutex_);
+
+	index_map::const_iterator i = index_.find(key_type(hash, kind));
+	if (i == index_.end()) return false;
+
+	return read(i->second, data);
+}
+
+bool pack_store::contains(const libt::sha1_hash& hash, record_kind kind) const
+{
+	boost::mutex::scoped_lock l(mutex_);
+
+	return index_.find(key_type(hash, kind)) != index_.end();
+}
+
+void pack_store::put(const libt::sha1_hash& hash, record_kind kind, const char* data, size_t size)
+{
+	boost::mutex::scoped_lock l(mutex_);
+
+	append(key_type(hash, kind), false, data, size);
+
+	if (pending_.size() >= commit_threshold)
+		commit_locked();
+}
+
+void pack_store::erase(const libt::sha1_hash& hash, record_kind kind)
+{
+	boost::mutex::scoped_lock l(mutex_);
+
+	if (index_.find(key_type(hash, kind)) != index_.end())
+		append(key_type(hash, kind), true, 0, 0);
+}
+
+void pack_store::commit()
+{
+	boost::mutex::scoped_lock l(mutex_);
+
+	commit_locked();
+
+	if (file_end_ > compact_threshold && file_end_ - file_header_size > 2*live_bytes_)
+		compact_locked();
+}
+
+void pack_store::compact()
+{
+	boost::mutex::scoped_lock l(mutex_);
+
+	commit_locked();
+	compact_locked();
+}
+
+size_t pack_store::size() const
+{
+	boost::mutex::scoped_lock l(mutex_);
+
+	return index_.size();
+}
+
+boost::uintmax_t pack_store::live_bytes() const
+{
+	boost::mutex::scoped_lock l(mutex_);
+
+	return live_bytes_;
+}
+
+boost::uintmax_t pack_store::file_bytes() const
+{
+	boost::mutex::scoped_lock l(mutex_);
+
+	return file_end_ + pending_.size();
+}
+
+void pack_store::open()
+{
+	if (!fs::exists(file_.parent_path()))
+		fs::create_directories(file_.parent_path());
+
+	if (!fs::exists(file_))
+	{
+		fs::ofstream create(file_, std::ios_base::binary);
+
+		char header[file_header_size];
+		std::copy(file_magic, file_magic + sizeof(file_magic), header);
+		put_u32(header + sizeof(file_magic), file_version);
+
+		create.write(header, sizeof(header));
+	}
+
+	scan();
+
+	stream_.open(file_, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+
+	if (!stream_.is_open())
+		throw fs::filesystem_error("pack_store: can't open", file_,
+			boost::system::errc::make_error_code(boost::system::errc::io_error));
+}
+
+// Only the headers are read, each payload is skipped. A crash can only tear the last record
+// so that alone has its payload checked here, the rest are checked as they are read.
+void pack_store::scan()
+{
+	struct header
+	{
+		key_type key;
+		bool erased;
+		location loc;
+	};
+
+	index_.clear();
+	live_bytes_ = 0;
+
+	boost::uintmax_t size = fs::file_size(file_);
+	fs::ifstream in(file_, std::ios_base::binary);
+
+	char fh[file_header_size];
+	if (!in.read(fh, sizeof(fh)) || !std::equal(file_magic, file_magic + sizeof(file_magic), fh)
+			|| get_u32(fh + sizeof(file_magic)) != file_version)
+		throw fs::filesystem_error("pack_store: not a pack file", file_,
+			boost::system::errc::make_error_code(boost::system::errc::invalid_argument));
+
+	boost::uint64_t offset = file_header_size;
+	std::vector<header> headers;
+
+	for ( ; ; )
+	{
+		char rh[record_header_size];
+
+		if (!in.read(rh, sizeof(rh)) || get_u32(rh) != record_magic)
+			break;
+
+		boost::uint32_t payload_size = get_u32(rh + 28);
+		if (payload_size > size - offset - record_header_size)
+			break;
+
+		header h;
+		std::copy(rh + 8, rh + 28, h.key.first.begin());
+		h.key.second = static_cast<unsigned char>(rh[4]);
+		h.erased = (rh[5] & erased_flag) != 0;
+
+		location loc = { offset + record_header_size, payload_size, get_u32(rh + 32) };
+		h.loc = loc;
+
+		headers.push_back(h);
+
+		offset += record_header_size + payload_size;
+		in.seekg(offset);
+	}
+
+	if (!headers.empty())
+	{
+		const location& last = headers.back().loc;
+		std::vector<char> payload(last.size);
+
+		in.clear();
+		in.seekg(last.offset);
+
+		if ((last.size && !in.read(&payload[0], last.size)) || checksum(payload.data(), payload.size()) != last.crc)
+		{
+			offset = last.offset - record_header_size;
+			headers.pop_back();
+		}
+	}
+
+	in.close();
+
+	for (const header& h : headers)
+	{
+		index_map::iterator i = index_.find(h.key);
+		if (i != index_.end())
+		{
+			live_bytes_ -= record_header_size + i->second.size;
+			index_.erase(i);
+		}
+
+		if (!h.erased)
+		{
+			index_.insert(std::make_pair(h.key, h.loc));
+			live_bytes_ += record_header_size + h.loc.size;
+		}
+	}
+
+	truncated_bytes_ = size - offset;
+
+	if (truncated_bytes_ != 0)
+		fs::resize_file(file_, offset);
+
+	file_end_ = offset;
+}
+
+void pack_store::append(const key_type& key, bool erased, const char* data, size_t size)
+{
+	char rh[record_header_size] = {};
+
+	put_u32(rh, record_magic);
+	rh[4] = static_cast<char>(key.second);
+	rh[5] = erased ? erased_flag : 0;
+	std::copy(key.first.begin(), key.first.end(), rh + 8);
+	boost::uint32_t crc = checksum(data, size);
+
+	put_u32(rh + 28, static_cast<boost::uint32_t>(size));
+	put_u32(rh + 32, crc);
+
+	boost::uint64_t offset = file_end_ + pending_.size();
+
+	pending_.insert(pending_.end(), rh, rh + sizeof(rh));
+	pending_.insert(pending_.end(), data, data + size);
+
+	index_map::iterator i = index_.find(key);
+	if (i != index_.end())
+	{
+		live_bytes_ -= record_header_size + i->second.size;
+		index_.erase(i);
+	}
+
+	if (!erased)
+	{
+		location loc = { offset + record_header_size, static_cast<boost::uint32_t>(size), crc };
+
+		index_.insert(std::make_pair(key, loc));
+		live_bytes_ += record_header_size + size;
+	}
+}
+
+void pack_store::commit_locked()
+{
+	if (pending_.empty()) return;
+
+	stream_.clear();
+	stream_.seekp(file_end_);
+	stream_.write(pending_.data(), pending_.size());
+	stream_.flush();
+
+	if (stream_.fail())
+	{
+		stream_.clear();
+
+		throw fs::filesystem_error("pack_store: write failed", file_,
+			boost::system::errc::make_error_code(boost::system::errc::io_error));
+	}
+
+	file_end_ += pending_.size();
+	pending_.clear();
+}
+
+// Copies the live records to a new file and renames it over the old one, a crash part way
+// leaves the old file as it was.
+void pack_store::compact_locked()
+{
+	fs::wpath temp = file_;
+	temp += L".compact";
+
+	index_map compacted;
+	boost::uint64_t offset = file_header_size;
+
+	{	fs::ofstream out(temp, std::ios_base::binary | std::ios_base::trunc);
+
+		char header[file_header_size];
+		std::copy(file_magic, file_magic + sizeof(file_magic), header);
+		put_u32(header + sizeof(file_magic), file_version);
+
+		out.write(header, sizeof(header));
+
+		std::vector<char> payload;
+		char rh[record_header_size] = {};
+		put_u32(rh, record_magic);
+
+		for (index_map::const_iterator i = index_.begin(), e = index_.end(); i != e; ++i)
+		{
+			// A damaged record isn't carried over, get couldn't return it anyway.
+			if (!read(i->second, payload)) continue;
+
+			rh[4] = static_cast<char>(i->first.second);
+			std::copy(i->first.first.begin(), i->first.first.end(), rh + 8);
+			put_u32(rh + 28, i->second.size);
+			put_u32(rh + 32, i->second.crc);
+
+			out.write(rh, sizeof(rh));
+			out.write(payload.data(), payload.size());
+
+			location loc = { offset + record_header_size, i->second.size, i->second.crc };
+			compacted.insert(compacted.end(), std::make_pair(i->first, loc));
+
+			offset += record_header_size + i->second.size;
+		}
+
+		out.close();
+
+		if (out.fail())
+		{
+			fs::remove(temp);
+			throw fs::filesystem_error("pack_store: compaction failed", temp,
+				boost::system::errc::make_error_code(boost::system::errc::io_error));
+		}
+	}
+
+	stream_.close();
+
+	try
+	{
+		fs::rename(temp, file_);
+	}
+	catch (const fs::filesystem_error&)
+	{
+		// The old file is untouched, carry on with it.
+		stream_.open(file_, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+
+		boost::system::error_code ec;
+		fs::remove(temp, ec);
+
+		throw;
+	}
+
+	index_.swap(compacted);
+	file_end_ = offset;
+	live_bytes_ = offset - file_header_size;
+
+	stream_.open(file_, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+
+	if (!stream_.is_open())
+		throw fs::filesystem_error("pack_store: can't reopen after compaction", file_,
+			boost::system::errc::make_error_code(boost::system::errc::io_error));
+}
+
+// Records still pending were checksummed from these same bytes, only those from the file
+// are checked.
+bool pack_store::read(const location& loc, std::vector<char>& data) const
+{
+	data.resize(loc.size);
+
+	if (loc.offset >= file_end_)
+	{
+		std::vector<char>::const_iterator first = pending_.begin() + static_cast<size_t>(loc.offset - file_end_);
+		std::copy(first, first + loc.size, data.begin());
+
+		return true;
+	}
+	else
+	{
+		stream_.clear();
+		stream_.seekg(loc.offset);
+		if (loc.size) stream_.read(&data[0], loc.size);
+
+		if (stream_.fail())
+		{
+			stream_.clear();
+
+			throw fs::filesystem_error("pack_store: read failed", file_,
+				boost::system::errc::make_error_code(boost::system::errc::io_error));
+		}
+	}
+
+	return checksum(data.data(), data.size()) == loc.crc;
+}
+
+}
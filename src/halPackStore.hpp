@@ -0,0 +1,99 @@
+
+//         Copyright Ein O'Callaghan 2009 - 2009.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#if defined(HALTORRENT_PCH)
+#	include "halPch.hpp"
+#else
+#	include <map>
+#	include <vector>
+#	include <boost/noncopyable.hpp>
+#	include <boost/thread/mutex.hpp>
+#	include <boost/filesystem/fstream.hpp>
+#	include <libtorrent/peer_id.hpp>
+#endif
+
+namespace hal
+{
+
+namespace fs = boost::filesystem;
+namespace libt = libtorrent;
+
+// Keeps every torrent's resume data, torrent info and .torrent file in one append only file
+// instead of three small files each. Records are keyed by info hash and kind, the newest
+// record for a key wins and an index of where each lives is rebuilt from the record headers
+// when the file is opened. Every record carries a checksum, which is checked when the record
+// is read. Only the last record is checked on opening, a torn one left there by a crash is
+// cut off and everything before it is kept. Superseded records are dropped by compact, which
+// commit runs once they outweigh the live ones.
+class pack_store :
+	private boost::noncopyable
+{
+public:
+	enum record_kind { fastresume = 0, torrent_info = 1, torrent_file = 2 };
+
+	explicit pack_store(const fs::wpath& file);
+	~pack_store();
+
+	// False too for a record which fails its checksum, the caller falls back as for none.
+	bool get(const libt::sha1_hash& hash, record_kind kind, std::vector<char>& data) const;
+	bool contains(const libt::sha1_hash& hash, record_kind kind) const;
+
+	// Both are buffered until commit, reads see them straight away.
+	void put(const libt::sha1_hash& hash, record_kind kind, const char* data, size_t size);
+	void erase(const libt::sha1_hash& hash, record_kind kind);
+
+	// Writes buffered records and flushes the file.
+	void commit();
+	void compact();
+
+	size_t size() const;
+	boost::uintmax_t live_bytes() const;
+	boost::uintmax_t file_bytes() const;
+	// Of incomplete records cut off the end when the file was opened.
+	boost::uintmax_t truncated_bytes() const { return truncated_bytes_; }
+
+	const fs::wpath& file() const { return file_; }
+
+private:
+	static const size_t commit_threshold = 1024*1024;
+	static const boost::uintmax_t compact_threshold = 4*1024*1024;
+
+	typedef std::pair<libt::sha1_hash, int> key_type;
+
+	struct location
+	{
+		boost::uint64_t offset;	// of the payload
+		boost::uint32_t size;
+		boost::uint32_t crc;
+	};
+
+	typedef std::map<key_type, location> index_map;
+
+	void open();
+	void scan();
+
+	void append(const key_type& key, bool erased, const char* data, size_t size);
+	void commit_locked();
+	void compact_locked();
+
+	bool read(const location& loc, std::vector<char>& data) const;
+
+	fs::wpath file_;
+
+	mutable boost::mutex mutex_;
+	mutable fs::fstream stream_;
+
+	index_map index_;
+	boost::uint64_t file_end_;
+	boost::uintmax_t live_bytes_;
+	boost::uintmax_t truncated_bytes_;
+
+	std::vector<char> pending_;
+};
+
+}
@@ -23,11 +23,17 @@
 #include <iterator>
 #include <iomanip>
 #include <map>
+#include <deque>
 #include <algorithm>
 #include <string>
 #include <vector>
 #include <codecvt>
 #include <locale>
+#include <atomic>
+#include <mutex>
+#include <future>
+#include <type_traits>
+#include <tuple>
 
 #include <boost/regex.hpp>
 #include <boost/foreach.hpp>
@@ -89,12 +95,14 @@
 
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index/hashed_index.hpp>
 #include <boost/multi_index/indexed_by.hpp>
 #include <boost/multi_index/identity.hpp>
 #include <boost/multi_index/random_access_index.hpp>
 #include <boost/multi_index/mem_fun.hpp>
 #include <boost/multi_index/tag.hpp>
 #include <boost/multi_index/member.hpp>
+#include <boost/unordered_map.hpp>
 
 #include <boost/statechart/event.hpp>
 #include <boost/statechart/asynchronous_state_machine.hpp>
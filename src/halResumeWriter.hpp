@@ -0,0 +1,325 @@
+
+//         Copyright Ein O'Callaghan 2009 - 2009.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#if defined(HALTORRENT_PCH)
+#	include "halPch.hpp"
+#else
+#	include "halTypes.hpp"
+#endif
+
+#include "halEvent.hpp"
+#include "halPackStore.hpp"
+
+namespace hal
+{
+
+namespace libt = libtorrent;
+
+// Writes .fastresume files on its own thread so the alert handler never waits on the disk.
+// Jobs are keyed by info hash, a torrent whose resume data arrives again before the first
+// lot was written keeps its place in the queue and only the newest data is written. Each
+// file is encoded into memory, written beside the target and renamed over it, so a crash
+// part way through leaves the previous resume data intact. With a pack store set a batch goes
+// into it instead, committed together.
+class resume_data_writer :
+	private boost::noncopyable
+{
+public:
+	typedef boost::shared_ptr<const libt::entry> entry_ptr;
+
+	resume_data_writer() :
+		running_(true),
+		enqueued_(0),
+		in_flight_(0),
+		pack_(0)
+	{
+		thread_.reset(new thread_t(boost::bind(&resume_data_writer::run, this)));
+	}
+
+	~resume_data_writer()
+	{
+		stop();
+	}
+
+	// Replaces anything still queued for the torrent. After stop the file is written here.
+	void write(const libt::sha1_hash& hash, const fs::wpath& file, entry_ptr data)
+	{
+		pack_store* pack;
+
+		{	boost::mutex::scoped_lock l(mutex_);
+
+			if (running_)
+			{
+				pending_map::iterator i = pending_.find(hash);
+
+				if (i != pending_.end())
+				{
+					i->second.file = file;
+					i->second.data = data;
+				}
+				else
+				{
+					job j = { ++enqueued_, hash, file, data };
+
+					pending_.insert(std::make_pair(hash, j));
+					order_.push_back(hash);
+				}
+
+				wake_.notify_one();
+				return;
+			}
+
+			pack = pack_;
+		}
+
+		if (pack)
+		{
+			write_pack(*pack, hash, *data);
+			commit_pack(*pack);
+		}
+		else
+			write_file(file, *data);
+	}
+
+	// Null goes back to writing files, flush first so nothing queued goes to the wrong place.
+	void set_pack_store(pack_store* p)
+	{
+		boost::mutex::scoped_lock l(mutex_);
+
+		pack_ = p;
+	}
+
+	// Drops a queued write, for when the torrent's resume data is being removed. A write
+	// already under way is waited for, so what the caller removes next stays removed.
+	void cancel(const libt::sha1_hash& hash)
+	{
+		boost::mutex::scoped_lock l(mutex_);
+
+		if (pending_.erase(hash))
+			order_.erase(std::find(order_.begin(), order_.end(), hash));
+
+		complete_waiters();
+
+		while (std::find(writing_.begin(), writing_.end(), hash) != writing_.end())
+			written_.wait(l);
+	}
+
+	// Ready once everything queued before the call has been written.
+	std::shared_future<void> flush()
+	{
+		boost::mutex::scoped_lock l(mutex_);
+
+		std::shared_ptr<std::promise<void> > p(new std::promise<void>());
+		std::shared_future<void> f = p->get_future().share();
+
+		if (order_.empty() && in_flight_ == 0)
+			p->set_value();
+		else
+			waiters_.push_back(std::make_pair(enqueued_, p));
+
+		return f;
+	}
+
+	// Torrents with data queued or being written.
+	size_t queue_depth() const
+	{
+		boost::mutex::scoped_lock l(mutex_);
+
+		return order_.size() + in_flight_;
+	}
+
+	// Writes whatever is still queued before returning.
+	void stop()
+	{
+		{	boost::mutex::scoped_lock l(mutex_);
+
+			if (!running_) return;
+			running_ = false;
+		}
+		wake_.notify_one();
+
+		thread_->join();
+	}
+
+	// Encodes and writes one file on the calling thread, problems are logged not thrown.
+	static void write_file(const fs::wpath& file, const libt::entry& data)
+	{
+		try
+		{
+
+		std::vector<char> buffer;
+		libt::bencode(std::back_inserter(buffer), data);
+
+		if (!fs::exists(file.parent_path()))
+			fs::create_directories(file.parent_path());
+
+		fs::wpath temp = file;
+		temp += L".tmp";
+
+		{	fs::ofstream out(temp, std::ios_base::binary | std::ios_base::trunc);
+
+			out.write(buffer.data(), buffer.size());
+			out.close();
+
+			if (out.fail())
+			{
+				event_log().post(shared_ptr<EventDetail>(
+					new EventMsg(hal::wform(L"Resume data write to %1% failed.") % temp, event_logger::warning)));
+				return;
+			}
+		}
+
+		fs::rename(temp, file);
+
+		}
+		catch (const fs::filesystem_error& e)
+		{
+			event_log().post(shared_ptr<EventDetail>(
+				new EventMsg(hal::wform(L"Resume data write to %1% failed, %2%.") % file % from_utf8_safe(e.what()),
+					event_logger::warning)));
+		}
+	}
+
+	static void write_pack(pack_store& pack, const libt::sha1_hash& hash, const libt::entry& data)
+	{
+		try
+		{
+
+		std::vector<char> buffer;
+		libt::bencode(std::back_inserter(buffer), data);
+
+		pack.put(hash, pack_store::fastresume, buffer.data(), buffer.size());
+
+		}
+		catch (const fs::filesystem_error& e)
+		{
+			event_log().post(shared_ptr<EventDetail>(
+				new EventMsg(hal::wform(L"Resume data write to pack store failed, %1%.") % from_utf8_safe(e.what()),
+					event_logger::warning)));
+		}
+	}
+
+	static void commit_pack(pack_store& pack)
+	{
+		try
+		{
+
+		boost::uintmax_t before = pack.file_bytes();
+		pack.commit();
+
+		if (pack.file_bytes() < before)
+			{HAL_DEV_FORMAT(L"Pack store compacted from %1% to %2% bytes", before, pack.file_bytes());}
+
+		}
+		catch (const fs::filesystem_error& e)
+		{
+			event_log().post(shared_ptr<EventDetail>(
+				new EventMsg(hal::wform(L"Pack store commit failed, %1%.") % from_utf8_safe(e.what()),
+					event_logger::warning)));
+		}
+	}
+
+private:
+	static const size_t batch_limit = 64;
+
+	struct job
+	{
+		boost::uint64_t seq;
+		libt::sha1_hash hash;
+		fs::wpath file;
+		entry_ptr data;
+	};
+
+	typedef std::map<libt::sha1_hash, job> pending_map;
+
+	void run()
+	{
+		std::vector<job> batch;
+		pack_store* pack = 0;
+
+		for ( ; ; )
+		{
+			{	boost::mutex::scoped_lock l(mutex_);
+
+				in_flight_ = 0;
+				complete_waiters();
+
+				writing_.clear();
+				written_.notify_all();
+
+				while (order_.empty() && running_)
+					wake_.wait(l);
+
+				if (order_.empty()) break;
+
+				while (!order_.empty() && batch.size() < batch_limit)
+				{
+					pending_map::iterator i = pending_.find(order_.front());
+
+					batch.push_back(i->second);
+					writing_.push_back(i->first);
+					pending_.erase(i);
+					order_.pop_front();
+				}
+
+				in_flight_ = batch.size();
+				pack = pack_;
+			}
+
+			if (pack)
+			{
+				for (const job& j : batch)
+					write_pack(*pack, j.hash, *j.data);
+
+				commit_pack(*pack);
+			}
+			else
+			{
+				for (const job& j : batch)
+					write_file(j.file, *j.data);
+			}
+
+			batch.clear();
+		}
+	}
+
+	// Waiters queued up to and including a sequence number are done once nothing that old
+	// is pending, jobs keep their first sequence number so order_ stays sorted by it.
+	void complete_waiters()
+	{
+		if (in_flight_ != 0) return;
+
+		boost::uint64_t oldest = order_.empty() ? enqueued_ + 1 : pending_[order_.front()].seq;
+
+		waiter_list::iterator i = waiters_.begin();
+		for (; i != waiters_.end() && i->first < oldest; ++i)
+			i->second->set_value();
+
+		waiters_.erase(waiters_.begin(), i);
+	}
+
+	typedef std::vector<std::pair<boost::uint64_t, std::shared_ptr<std::promise<void> > > > waiter_list;
+
+	mutable boost::mutex mutex_;
+	boost::condition_variable wake_;
+	boost::condition_variable written_;
+
+	bool running_;
+	boost::uint64_t enqueued_;
+	size_t in_flight_;
+	pack_store* pack_;
+
+	pending_map pending_;
+	std::deque<libt::sha1_hash> order_;
+	std::vector<libt::sha1_hash> writing_;
+	waiter_list waiters_;
+
+	boost::scoped_ptr<thread_t> thread_;
+};
+
+}
@@ -0,0 +1,247 @@
+
+//         Copyright Ein O'Callaghan 2009 - 2009.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#if defined(HALTORRENT_PCH)
+#	include "halPch.hpp"
+#else
+#	include "halTypes.hpp"
+#endif
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/strand.hpp>
+
+#include "win32_exception.hpp"
+
+#include "halEvent.hpp"
+#include "halSpans.hpp"
+#include "halTorrentDetails.hpp"
+
+namespace hal
+{
+
+// A pool of threads running one io_service. The size can be changed while running, a
+// shrinking pool posts one retire handler per thread to go, each ends whichever thread
+// runs it. Stopping lets everything already queued finish, so timers must be cancelled
+// first.
+class service_pool :
+	private boost::noncopyable
+{
+public:
+	service_pool() :
+		size_(0)
+	{}
+
+	~service_pool()
+	{
+		stop();
+	}
+
+	boost::asio::io_service& io_service() { return io_service_; }
+
+	// Zero picks one thread per core, no more than four.
+	void resize(size_t threads)
+	{
+		boost::mutex::scoped_lock l(mutex_);
+
+		if (threads == 0)
+		{
+			unsigned cores = boost::thread::hardware_concurrency();
+			threads = cores == 0 ? 1 : (cores > 4 ? 4 : cores);
+		}
+
+		if (!work_)
+			work_.reset(new boost::asio::io_service::work(io_service_));
+
+		for (; size_ < threads; ++size_)
+			threads_.push_back(boost::shared_ptr<thread_t>(
+				new thread_t(boost::bind(&service_pool::run, this, size_))));
+
+		for (; size_ > threads; --size_)
+			io_service_.post(&service_pool::retire);
+
+		HAL_DEV_MSG(hal::wform(L"Service pool running %1% threads") % size_);
+	}
+
+	size_t size() const
+	{
+		boost::mutex::scoped_lock l(mutex_);
+
+		return size_;
+	}
+
+	bool running() const
+	{
+		boost::mutex::scoped_lock l(mutex_);
+
+		return static_cast<bool>(work_);
+	}
+
+	void stop()
+	{
+		std::vector<boost::shared_ptr<thread_t> > threads;
+
+		{	boost::mutex::scoped_lock l(mutex_);
+
+			work_.reset();
+			threads.swap(threads_);
+			size_ = 0;
+		}
+
+		for (auto i = threads.begin(), e = threads.end(); i != e; ++i)
+			(*i)->join();
+
+		io_service_.reset();
+	}
+
+private:
+	struct retired {};
+
+	static void retire()
+	{
+		throw retired();
+	}
+
+	void run(size_t id)
+	{
+		win32_exception::install_handler();
+		spans().name_thread("Service pool");
+
+		HAL_DEV_MSG(hal::wform(L"Beginning a service thread, id %1%") % id);
+
+		for ( ; ; )
+		{
+			try
+			{
+				io_service_.run();
+
+				// run exited normally
+				break; 
+			}
+			catch (const retired&)
+			{
+				break;
+			}
+			HAL_GENERIC_FN_EXCEPTION_CATCH(L"service_pool::run()")
+		}
+
+		HAL_DEV_MSG(hal::wform(L"Service thread id %1% exiting") % id);
+	}
+
+	mutable boost::mutex mutex_;
+
+	boost::asio::io_service io_service_;
+	boost::scoped_ptr<boost::asio::io_service::work> work_;
+
+	size_t size_;
+	std::vector<boost::shared_ptr<thread_t> > threads_;
+};
+
+// Handlers posted to a strand run one at a time and in order on the pool's threads, so a
+// subsystem's work needs no locking against itself while separate strands run side by side.
+// Each handler is timed from being posted to starting and from starting to finishing.
+// With the pool stopped handlers run on the calling thread.
+class service_strand :
+	private boost::noncopyable
+{
+public:
+	typedef std::chrono::steady_clock clock;
+
+	service_strand(service_pool& pool, const char* name) :
+		pool_(pool),
+		strand_(pool.io_service()),
+		name_(name)
+	{
+		details_.name = from_utf8(name);
+	}
+
+	template<typename F>
+	void post(F f)
+	{
+		{	boost::mutex::scoped_lock l(mutex_);
+
+			++details_.pending;
+		}
+
+		clock::time_point posted = clock::now();
+
+		if (pool_.running())
+			strand_.post([this, f, posted]() mutable { invoke(f, posted); });
+		else
+			invoke(f, posted);
+	}
+
+	// For async operations, the completion is posted to the strand with its error code.
+	template<typename F>
+	boost::function<void (const boost::system::error_code&)> wrap(F f)
+	{
+		return [this, f](const boost::system::error_code& ec) { post(boost::bind<void>(f, ec)); };
+	}
+
+	// Ready once everything posted before the call has run.
+	std::shared_future<void> flush()
+	{
+		std::shared_ptr<std::promise<void> > p(new std::promise<void>());
+		std::shared_future<void> f = p->get_future().share();
+
+		post([p]() { p->set_value(); });
+
+		return f;
+	}
+
+	service_strand_details details() const
+	{
+		boost::mutex::scoped_lock l(mutex_);
+
+		return details_;
+	}
+
+private:
+	template<typename F>
+	void invoke(F& f, clock::time_point posted)
+	{
+		clock::time_point start = clock::now();
+
+		try
+		{
+
+		HAL_SPAN(name_);
+		f();
+
+		}
+		HAL_GENERIC_FN_EXCEPTION_CATCH(L"service_strand::invoke()")
+
+		clock::time_point end = clock::now();
+
+		boost::int64_t wait_us = std::chrono::duration_cast<std::chrono::microseconds>(start - posted).count();
+		boost::int64_t run_us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+		boost::mutex::scoped_lock l(mutex_);
+
+		service_strand_details& d = details_;
+
+		--d.pending;
+		++d.handled;
+
+		d.total_wait_us += wait_us;
+		d.total_run_us += run_us;
+		if (wait_us > d.max_wait_us) d.max_wait_us = wait_us;
+		if (run_us > d.max_run_us) d.max_run_us = run_us;
+
+		d.mean_wait_us = d.total_wait_us / static_cast<boost::int64_t>(d.handled);
+		d.mean_run_us = d.total_run_us / static_cast<boost::int64_t>(d.handled);
+	}
+
+	service_pool& pool_;
+	boost::asio::io_service::strand strand_;
+	const char* name_;
+
+	mutable boost::mutex mutex_;
+	service_strand_details details_;
+};
+
+}
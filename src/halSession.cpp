@@ -17,6 +17,8 @@
 #include "halEvent.hpp"
 #include "halSignaler.hpp"
 #include "halSession.hpp"
+#include "halSpans.hpp"
+#include "halAlertDispatch.hpp"
 #include "halAlertHandler.hpp"
 
 
@@ -24,7 +26,16 @@ namespace hal
 {
 
 bit_impl::bit_impl() :
-	action_timer_(io_service_),
+	scheduling_(service_, "Scheduling"),
+	persistence_(service_, "Persistence"),
+	metadata_(service_, "Metadata"),
+	action_timer_(service_.io_service()),
+	state_changes_(0),
+	shutdown_deadline_(pt::seconds(30)),
+	checkpoint_timer_(service_.io_service()),
+	checkpoint_round_(pt::minutes(5)),
+	checkpoints_running_(false),
+	checkpoint_ticks_left_(0),
 	default_torrent_max_connections_(-1),
 	default_torrent_max_uploads_(-1),
 	default_torrent_download_(-1),
@@ -35,13 +46,20 @@ bit_impl::bit_impl() :
 	ip_filter_changed_(false),
 	ip_filter_count_(0),
 	dht_on_(false),
-	alert_caller_([this](void*)
-		{
-			alert_handler();
-		}),
-	alert_timer_(100, nullptr, &alert_caller_, 	true	),
+	upnp_(NULL),
+	natpmp_(NULL),
+	upnp_on_(false),
+	natpmp_on_(false),
+	plugins_(0),
+	settings_depth_(0),
+	pending_changes_(0),
+	alert_pending_(true),
+	alert_pump_running_(false),
+	alert_batch_limit_(500),
 	the_session_{libt::fingerprint(HALITE_FINGERPRINT)}
 {
+	HAL_SPAN("bit_impl::bit_impl");
+
 	session_.reset(new libt::session(libt::fingerprint(HALITE_FINGERPRINT), 0, 
 		libt::alert::error_notification | libt::alert::status_notification));
 
@@ -53,6 +71,8 @@ bit_impl::bit_impl() :
 	{
 		try
 		{
+			HAL_SPAN("Load libtorrent.state");
+
 			libt::lazy_entry state;
 			lazy_bdecode_file(state_file, state);
 			session_->load_state(state);
@@ -74,21 +94,20 @@ bit_impl::bit_impl() :
 	session_->set_settings(s);
 	
 	torrent_internal::set_the_session(&session_);
-	
-	hal::event_log().post(shared_ptr<hal::EventDetail>(
-		new hal::EventMsg(L"Loading BitTorrent.xml.", hal::event_logger::info)));		
-	hal::event_log().post(shared_ptr<hal::EventDetail>(
-		new hal::EventMsg(L"Loading torrent parameters.", hal::event_logger::info)));	
-	the_torrents_.load_from_ini();
-	hal::event_log().post(shared_ptr<hal::EventDetail>(
-		new hal::EventMsg(L"Loading done!", hal::event_logger::info)));
+	torrent_internal::set_resume_writer(&resume_writer_);
+	torrent_internal::set_metadata_strand(&metadata_);
+	torrent_internal::set_state_signal(bind(&bit_impl::notify_state_change, this));
 
-	//acquire_work_object();
-	start_alert_handler();
+	// The alert pump starts each torrent as it's read, so it has to be running before
+	// resume_all loads them.
+	{	HAL_SPAN("Start alert handler");
 
-	service_threads_.push_back(shared_thread_ptr(new 
-		thread_t(boost::bind(&boost::asio::io_service::run, &io_service_))));
+		start_alert_handler();
+	}
 
+	// Sized from the config once it's applied, until then one thread per core.
+	service_.resize(0);
+	start_checkpoints();
 
 	} HAL_GENERIC_FN_EXCEPTION_CATCH(L"bit_impl::bit_impl()")
 }
@@ -99,15 +118,28 @@ bit_impl::~bit_impl()
 	{
 	HAL_DEV_MSG(L"Commence ~BitTorrent_impl"); 
 
-//	discard_work_object();
+	stop_checkpoints();
+	schedual_cancel();
 
 	stop_alert_handler();
 //	alert_timer_.wait();
 
-	io_service_.stop();
-	for (std::vector<shared_thread_ptr>::iterator i=service_threads_.begin(), e=service_threads_.end(); i != e; ++i)
-		(*i)->join();
-	
+	// Runs whatever the strands still hold, the timers are cancelled so nothing is left waiting.
+	service_.stop();
+	torrent_internal::set_metadata_strand(0);
+
+	resume_writer_.stop();
+	torrent_internal::set_resume_writer(0);
+	torrent_internal::set_state_signal(function<void ()>());
+
+	if (pack_store_)
+	{
+		pack_store_->commit();
+
+		resume_writer_.set_pack_store(0);
+		torrent_internal::set_pack_store(0);
+	}
+
 	HAL_DEV_MSG(L"Handler stopped!"); 
 	if (ip_filter_changed_)
 	{	
@@ -232,36 +264,48 @@ void bit_impl::ensure_dht_off()
 	}
 }
 
+// Starting a mapping that is already running would tear it down and rediscover the router,
+// so only a change is acted on.
 void bit_impl::set_mapping(bool upnp, bool nat_pmp)
 {
-//	upnp = true;
+	unique_lock_t l(mutex_);
 
-	if (upnp)
+	if (upnp != upnp_on_)
 	{
-		event_log().post(shared_ptr<EventDetail>(new EventMsg(L"Starting UPnP mapping.")));
+		if (upnp)
+		{
+			event_log().post(shared_ptr<EventDetail>(new EventMsg(L"Starting UPnP mapping.")));
 
-		session_->start_upnp();
-	}
-	else
-	{
-		event_log().post(shared_ptr<EventDetail>(new EventMsg(L"Stopping UPnP mapping.")));
+			session_->start_upnp();
+		}
+		else
+		{
+			event_log().post(shared_ptr<EventDetail>(new EventMsg(L"Stopping UPnP mapping.")));
+
+			session_->stop_upnp();
+			upnp_ = NULL;
+		}
 
-		session_->stop_upnp();
-		upnp_ = NULL;
+		upnp_on_ = upnp;
 	}
 
-	if (nat_pmp)
+	if (nat_pmp != natpmp_on_)
 	{
-		event_log().post(shared_ptr<EventDetail>(new EventMsg(L"Starting NAT-PMP mapping.")));
+		if (nat_pmp)
+		{
+			event_log().post(shared_ptr<EventDetail>(new EventMsg(L"Starting NAT-PMP mapping.")));
 
-		session_->start_natpmp();
-	}
-	else
-	{
-		event_log().post(shared_ptr<EventDetail>(new EventMsg(L"Stopping NAT-PMP mapping.")));
+			session_->start_natpmp();
+		}
+		else
+		{
+			event_log().post(shared_ptr<EventDetail>(new EventMsg(L"Stopping NAT-PMP mapping.")));
+
+			session_->stop_natpmp();
+			natpmp_ = NULL;
+		}
 
-		session_->stop_natpmp();
-		natpmp_ = NULL;
+		natpmp_on_ = nat_pmp;
 	}
 }
 
@@ -275,19 +319,18 @@ std::wstring bit_impl::upnp_router_model()
 
 void bit_impl::set_timeouts(int peers, int tracker)
 {
-	libt::session_settings settings = session_->settings();
-	settings.peer_connect_timeout = peers;
-	settings.tracker_completion_timeout = tracker;
-
-	session_->set_settings(settings);
-
-	event_log().post(shared_ptr<EventDetail>(new EventMsg(
-		hal::wform(L"Set Timeouts, peer %1%, tracker %2%.") % peers % tracker)));
+	if (edit_settings([&](settings_edit& s)
+		{
+			s.set(&libt::session_settings::peer_connect_timeout, peers);
+			s.set(&libt::session_settings::tracker_completion_timeout, tracker);
+		}))
+		event_log().post(shared_ptr<EventDetail>(new EventMsg(
+			hal::wform(L"Set Timeouts, peer %1%, tracker %2%.") % peers % tracker)));
 }
 
 cache_settings bit_impl::get_cache_settings()
 {
-	libt::session_settings settings = session_->settings();
+	libt::session_settings settings = current_settings();
 	cache_settings cache;
 
 	cache.cache_size = settings.cache_size;
@@ -298,21 +341,19 @@ cache_settings bit_impl::get_cache_settings()
 
 void bit_impl::set_cache_settings(const cache_settings& cache)
 {
-	libt::session_settings settings = session_->settings();
-
-	settings.cache_size = cache.cache_size;
-	settings.cache_expiry = cache.cache_expiry;
-
-	session_->set_settings(settings);
-
-	event_log().post(shared_ptr<EventDetail>(new EventMsg(
-		hal::wform(L"Set cache parameters, %1% size and %2% expiry.") 
-			% settings.cache_size % settings.cache_expiry)));
+	if (edit_settings([&](settings_edit& s)
+		{
+			s.set(&libt::session_settings::cache_size, cache.cache_size);
+			s.set(&libt::session_settings::cache_expiry, cache.cache_expiry);
+		}))
+		event_log().post(shared_ptr<EventDetail>(new EventMsg(
+			hal::wform(L"Set cache parameters, %1% size and %2% expiry.") 
+				% cache.cache_size % cache.cache_expiry)));
 }
 
 queue_settings bit_impl::get_queue_settings()
 {		
-	libt::session_settings settings = session_->settings();
+	libt::session_settings settings = current_settings();
 	queue_settings queue;
 
 	queue.auto_manage_interval = settings.auto_manage_interval;
@@ -332,30 +373,28 @@ queue_settings bit_impl::get_queue_settings()
 
 void bit_impl::set_queue_settings(const queue_settings& queue)
 {
-	libt::session_settings settings = session_->settings();
-
-	settings.auto_manage_interval = queue.auto_manage_interval;
-	settings.active_downloads = queue.active_downloads;
-	settings.active_seeds = queue.active_seeds;
-	settings.active_limit = queue.seeds_hard_limit;
-	settings.share_ratio_limit = queue.seed_ratio_limit;
-	settings.seed_time_ratio_limit = queue.seed_ratio_time_limit;
-	settings.seed_time_limit = queue.seed_time_limit;
-	settings.dont_count_slow_torrents = queue.dont_count_slow_torrents;
-	settings.auto_scrape_min_interval = queue.auto_scrape_min_interval;
-	settings.auto_scrape_interval = queue.auto_scrape_interval;
-	settings.close_redundant_connections = queue.close_redundant_connections;
-
-	session_->set_settings(settings);
-
-	event_log().post(shared_ptr<EventDetail>(new EventMsg(
-		hal::wform(L"Set queue parameters, %1% downloads and %2% active seeds.") 
-			% settings.active_downloads % settings.active_seeds)));
+	if (edit_settings([&](settings_edit& s)
+		{
+			s.set(&libt::session_settings::auto_manage_interval, queue.auto_manage_interval);
+			s.set(&libt::session_settings::active_downloads, queue.active_downloads);
+			s.set(&libt::session_settings::active_seeds, queue.active_seeds);
+			s.set(&libt::session_settings::active_limit, queue.seeds_hard_limit);
+			s.set(&libt::session_settings::share_ratio_limit, queue.seed_ratio_limit);
+			s.set(&libt::session_settings::seed_time_ratio_limit, queue.seed_ratio_time_limit);
+			s.set(&libt::session_settings::seed_time_limit, queue.seed_time_limit);
+			s.set(&libt::session_settings::dont_count_slow_torrents, queue.dont_count_slow_torrents);
+			s.set(&libt::session_settings::auto_scrape_min_interval, queue.auto_scrape_min_interval);
+			s.set(&libt::session_settings::auto_scrape_interval, queue.auto_scrape_interval);
+			s.set(&libt::session_settings::close_redundant_connections, queue.close_redundant_connections);
+		}))
+		event_log().post(shared_ptr<EventDetail>(new EventMsg(
+			hal::wform(L"Set queue parameters, %1% downloads and %2% active seeds.") 
+				% queue.active_downloads % queue.active_seeds)));
 }
 
 timeouts bit_impl::get_timeouts()
 {		
-	libt::session_settings settings = session_->settings();
+	libt::session_settings settings = current_settings();
 	timeouts times;
 
 	times.tracker_completion_timeout = settings.tracker_completion_timeout;
@@ -377,55 +416,52 @@ timeouts bit_impl::get_timeouts()
 
 void bit_impl::set_timeouts(const timeouts& times)
 {
-	libt::session_settings settings = session_->settings();
-
-	settings.tracker_completion_timeout = times.tracker_completion_timeout;
-	settings.tracker_receive_timeout = times.tracker_receive_timeout;
-	settings.stop_tracker_timeout = times.stop_tracker_timeout;
-
-	settings.request_queue_time = boost::numeric_cast<int>(times.request_queue_time);
-	settings.piece_timeout = times.piece_timeout;
-	settings.min_reconnect_time = times.min_reconnect_time;		
-
-	settings.peer_timeout = times.peer_timeout;
-	settings.urlseed_timeout = times.urlseed_timeout;
-	settings.peer_connect_timeout = times.peer_connect_timeout;
-	settings.inactivity_timeout = times.inactivity_timeout;
-	settings.handshake_timeout = times.handshake_timeout;
-
-	session_->set_settings(settings);
-
-	event_log().post(shared_ptr<EventDetail>(new EventMsg(
-		hal::wform(L"Set timeouts, peers- %1% secs, tracker- %2% secs.") 
-			% settings.peer_timeout % settings.tracker_receive_timeout)));
+	if (edit_settings([&](settings_edit& s)
+		{
+			s.set(&libt::session_settings::tracker_completion_timeout, times.tracker_completion_timeout);
+			s.set(&libt::session_settings::tracker_receive_timeout, times.tracker_receive_timeout);
+			s.set(&libt::session_settings::stop_tracker_timeout, times.stop_tracker_timeout);
+
+			s.set(&libt::session_settings::request_queue_time, boost::numeric_cast<int>(times.request_queue_time));
+			s.set(&libt::session_settings::piece_timeout, times.piece_timeout);
+			s.set(&libt::session_settings::min_reconnect_time, times.min_reconnect_time);
+
+			s.set(&libt::session_settings::peer_timeout, times.peer_timeout);
+			s.set(&libt::session_settings::urlseed_timeout, times.urlseed_timeout);
+			s.set(&libt::session_settings::peer_connect_timeout, times.peer_connect_timeout);
+			s.set(&libt::session_settings::inactivity_timeout, times.inactivity_timeout);
+			s.set(&libt::session_settings::handshake_timeout, times.handshake_timeout);
+		}))
+		event_log().post(shared_ptr<EventDetail>(new EventMsg(
+			hal::wform(L"Set timeouts, peers- %1% secs, tracker- %2% secs.") 
+				% times.peer_timeout % times.tracker_receive_timeout)));
 }
 
 void bit_impl::set_session_limits(int maxConn, int maxUpload)
 {		
-	libt::session_settings s = session_->settings();
-
-	s.unchoke_slots_limit = maxUpload;
-	s.connections_limit = maxConn;
-
-	session_->set_settings(s);
-		
-	event_log().post(shared_ptr<EventDetail>(new EventMsg(
-		hal::wform(L"Set connections totals %1% and uploads %2%.") 
-			% maxConn % maxUpload)));
+	if (edit_settings([&](settings_edit& s)
+		{
+			s.set(&libt::session_settings::unchoke_slots_limit, maxUpload);
+			s.set(&libt::session_settings::connections_limit, maxConn);
+		}))
+		event_log().post(shared_ptr<EventDetail>(new EventMsg(
+			hal::wform(L"Set connections totals %1% and uploads %2%.") 
+				% maxConn % maxUpload)));
 }
 
 void bit_impl::set_session_speed(float download, float upload)
 {
-	libt::session_settings s = session_->settings();
-
-	s.download_rate_limit = (download > 0) ? static_cast<int>(download*1024) : -1;
-	s.upload_rate_limit = (upload > 0) ? static_cast<int>(upload*1024) : -1;
+	int download_limit = (download > 0) ? static_cast<int>(download*1024) : -1;
+	int upload_limit = (upload > 0) ? static_cast<int>(upload*1024) : -1;
 
-	session_->set_settings(s);
-		
-	event_log().post(shared_ptr<EventDetail>(new EventMsg(
-		hal::wform(L"Set session rates at download %1% and upload %2%.") 
-			% s.download_rate_limit % s.upload_rate_limit)));
+	if (edit_settings([&](settings_edit& s)
+		{
+			s.set(&libt::session_settings::download_rate_limit, download_limit);
+			s.set(&libt::session_settings::upload_rate_limit, upload_limit);
+		}))
+		event_log().post(shared_ptr<EventDetail>(new EventMsg(
+			hal::wform(L"Set session rates at download %1% and upload %2%.") 
+				% download_limit % upload_limit)));
 }
 
 cache_details bit_impl::get_cache_details() const
@@ -738,7 +774,7 @@ void bit_impl::schedual_action(boost::posix_time::time_duration duration, bit::t
 	schedual_cancel();
 
 	action_timer_.expires_from_now(duration);
-	action_timer_.async_wait(bind(&bit_impl::execute_action, this, _1, action));
+	action_timer_.async_wait(scheduling_.wrap(bind(&bit_impl::execute_action, this, _1, action)));
 }
 
 void bit_impl::schedual_callback(boost::posix_time::ptime time, action_callback_t action)
@@ -758,9 +794,234 @@ void bit_impl::schedual_callback(boost::posix_time::time_duration duration, acti
 	schedual_cancel();
 
 	action_timer_.expires_from_now(duration);
-	action_timer_.async_wait(bind(&bit_impl::execute_callback, this, _1, action));
+	action_timer_.async_wait(scheduling_.wrap(bind(&bit_impl::execute_callback, this, _1, action)));
 }	
 
+size_t bit_impl::count_unsettled()
+{
+	size_t num_active = 0;
+
+	for (auto i=the_torrents_.begin(), e=the_torrents_.end(); i != e; ++i)
+	{
+		if (i->torrent && (
+			i->torrent->state() == torrent_details::torrent_active ||
+			i->torrent->state() == torrent_details::torrent_pausing ||
+			i->torrent->state() == torrent_details::torrent_stopping ||
+			i->torrent->awaiting_resume_data()))
+		{
+#			ifdef HAL_TORRENT_DEV_MSGES
+				(*i).torrent->output_torrent_debug_details();
+#			endif
+			num_active += 1;
+		}
+	}
+
+	return num_active;
+}
+
+void bit_impl::notify_state_change()
+{
+	{	boost::mutex::scoped_lock l(state_mutex_);
+
+		++state_changes_;
+	}
+	state_cond_.notify_all();
+}
+
+boost::uint64_t bit_impl::state_changes()
+{
+	boost::mutex::scoped_lock l(state_mutex_);
+
+	return state_changes_;
+}
+
+// Returns once anything has changed since seen was read, or at until.
+void bit_impl::wait_state_change(boost::uint64_t seen, pt::ptime until)
+{
+	boost::mutex::scoped_lock l(state_mutex_);
+
+	while (state_changes_ == seen)
+		if (!state_cond_.timed_wait(l, until)) break;
+}
+
+void bit_impl::start_checkpoints()
+{
+	unique_lock_t l(mutex_);
+
+	if (checkpoints_running_) return;
+
+	checkpoints_running_ = true;
+	checkpoint_ticks_left_ = 0;
+
+	checkpoint_timer_.expires_from_now(checkpoint_round_ / static_cast<int>(checkpoint_ticks));
+	checkpoint_timer_.async_wait(persistence_.wrap(bind(&bit_impl::checkpoint_tick, this, _1)));
+}
+
+void bit_impl::stop_checkpoints()
+{
+	unique_lock_t l(mutex_);
+
+	checkpoints_running_ = false;
+	checkpoint_timer_.cancel();
+	checkpoint_queue_.clear();
+}
+
+// Each round queues the torrents libtorrent has new resume data for, the most changed first,
+// and every tick asks for an even share of what's left, no more than checkpoint_tick_budget,
+// so resume data is saved at a steady rate rather than all at once.
+void bit_impl::checkpoint_tick(const boost::system::error_code& ec)
+{
+	if (ec == boost::asio::error::operation_aborted) return;
+
+	try
+	{
+
+	typedef std::pair<float, torrent_internal_ptr> candidate;
+
+	std::vector<torrent_internal_ptr> torrents;
+	std::vector<torrent_internal_ptr> due;
+
+	{	unique_lock_t l(mutex_);
+
+		if (!checkpoints_running_) return;
+
+		if (checkpoint_ticks_left_ == 0)
+			for (auto i = the_torrents_.begin(), e = the_torrents_.end(); i != e; ++i)
+				if (i->torrent) torrents.push_back(i->torrent);
+	}
+
+	// Asking libtorrent is a round trip to its thread, so done without the session lock.
+	if (!torrents.empty())
+	{
+		std::vector<candidate> changed;
+
+		for (const torrent_internal_ptr& t : torrents)
+		{
+			float priority = t->checkpoint_priority();
+			if (priority >= 0) changed.push_back(candidate(priority, t));
+		}
+
+		std::stable_sort(changed.begin(), changed.end(),
+			[](const candidate& a, const candidate& b) { return a.first > b.first; });
+
+		HAL_DEV_FORMAT(L"Checkpoint round, %1% of %2% torrents changed", changed.size(), torrents.size());
+
+		unique_lock_t l(mutex_);
+
+		checkpoint_queue_.clear();
+		for (const candidate& c : changed)
+			checkpoint_queue_.push_back(c.second);
+	}
+
+	{	unique_lock_t l(mutex_);
+
+		if (!checkpoints_running_) return;
+
+		if (checkpoint_ticks_left_ == 0)
+			checkpoint_ticks_left_ = checkpoint_ticks;
+
+		size_t share = (checkpoint_queue_.size() + checkpoint_ticks_left_ - 1) / checkpoint_ticks_left_;
+		if (share > checkpoint_tick_budget) share = checkpoint_tick_budget;
+
+		for (; share != 0 && !checkpoint_queue_.empty(); --share)
+		{
+			if (torrent_internal_ptr t = checkpoint_queue_.front().lock())
+				due.push_back(t);
+
+			checkpoint_queue_.pop_front();
+		}
+
+		--checkpoint_ticks_left_;
+
+		checkpoint_timer_.expires_at(checkpoint_timer_.expires_at() + checkpoint_round_ / static_cast<int>(checkpoint_ticks));
+		checkpoint_timer_.async_wait(persistence_.wrap(bind(&bit_impl::checkpoint_tick, this, _1)));
+	}
+
+	// Still changed, nothing started a save since the round began.
+	for (const torrent_internal_ptr& t : due)
+		if (t->checkpoint_priority() >= 0)
+			t->checkpoint_resume_data();
+
+	}
+	HAL_GENERIC_FN_EXCEPTION_CATCH(L"bit_impl::checkpoint_tick()")
+}
+
+void bit_impl::use_pack_store(bool b)
+{
+	unique_lock_t l(mutex_);
+
+	if (b == static_cast<bool>(pack_store_)) return;
+
+	try
+	{
+
+	pt::ptime start = pt::microsec_clock::universal_time();
+
+	// Nothing queued may land in the store being switched away from.
+	resume_writer_.flush().wait();
+
+	if (b)
+	{
+		pack_store_.reset(new pack_store(hal::app().get_working_directory()/L"resume"/L"torrents.pack"));
+
+		if (boost::uintmax_t truncated = pack_store_->truncated_bytes())
+			event_log().post(shared_ptr<EventDetail>(new EventMsg(
+				hal::wform(L"Pack store %1% had %2% bytes of incomplete records, truncated.") 
+					% pack_store_->file() % truncated,
+				event_logger::warning)));
+
+		// Readers try the pack first and the files after, so switch before copying.
+		resume_writer_.set_pack_store(pack_store_.get());
+		torrent_internal::set_pack_store(pack_store_.get());
+
+		move_files_to_pack();
+
+		event_log().post(shared_ptr<EventDetail>(new EventMsg(
+			hal::wform(L"Pack store holds %1% records in %2% bytes, opened in %3%ms.")
+				% pack_store_->size() % pack_store_->file_bytes()
+				% (pt::microsec_clock::universal_time() - start).total_milliseconds())));
+	}
+	else
+	{
+		// Detached first, then whatever was handed the store before that is let finish
+		// before it's copied out and destroyed.
+		resume_writer_.set_pack_store(0);
+		torrent_internal::set_pack_store(0);
+
+		resume_writer_.flush().wait();
+		metadata_.flush().wait();
+
+		for (auto i = the_torrents_.begin(), e = the_torrents_.end(); i != e; ++i)
+			if (i->torrent) i->torrent->copy_pack_to_files(*pack_store_);
+
+		fs::wpath file = pack_store_->file();
+		pack_store_.reset();
+		fs::remove(file);
+
+		event_log().post(shared_ptr<EventDetail>(new EventMsg(
+			hal::wform(L"Pack store moved back to the resume directory in %1%ms.")
+				% (pt::microsec_clock::universal_time() - start).total_milliseconds())));
+	}
+
+	}
+	HAL_GENERIC_FN_EXCEPTION_CATCH(L"bit_impl::use_pack_store()")
+}
+
+void bit_impl::move_files_to_pack()
+{
+	unique_lock_t l(mutex_);
+
+	if (!pack_store_) return;
+
+	for (auto i = the_torrents_.begin(), e = the_torrents_.end(); i != e; ++i)
+		if (i->torrent) i->torrent->copy_files_to_pack(*pack_store_);
+
+	pack_store_->commit();
+
+	for (auto i = the_torrents_.begin(), e = the_torrents_.end(); i != e; ++i)
+		if (i->torrent) i->torrent->remove_packed_files(*pack_store_);
+}
+
 void bit_impl::schedual_cancel()
 {
 	if (action_timer_.cancel() > 0)
@@ -770,48 +1031,53 @@ void bit_impl::schedual_cancel()
 void bit_impl::start_alert_handler()
 {
 	unique_lock_t l(mutex_);
+
+	{	boost::mutex::scoped_lock al(alert_mutex_);
+
+		if (alert_pump_running_) return;
+
+		alert_pump_running_ = true;
+		alert_pending_ = true;
+	}
 	
 	HAL_DEV_MSG(L"Start alert handler");
-	alert_timer_.start();
+
+	session_->set_alert_notify(boost::bind(&bit_impl::notify_alert_pump, this));
+	the_torrents_.set_event_notify(boost::bind(&bit_impl::notify_alert_pump, this));
+
+	alert_thread_.reset(new thread_t(boost::bind(&bit_impl::alert_pump, this)));
 }
 	
 void bit_impl::stop_alert_handler()
 {
-	unique_lock_t l(mutex_);
-		
 	HAL_DEV_MSG(L"Stop alert handler...");
 
-	alert_timer_.stop();
-	alert_handler();
-	the_torrents_.terminate_all();
+	boost::scoped_ptr<thread_t> thread;
 
-	HAL_DEV_MSG(L" ... stopped");
-}
-	
-void bit_impl::service_thread(size_t id)
-{
-	win32_exception::install_handler();
+	{	unique_lock_t l(mutex_);
 
-	HAL_DEV_MSG(hal::wform(L"Beginning a service thread, id %1%") % id);
+		{	boost::mutex::scoped_lock al(alert_mutex_);
 
-	for ( ; ; )
-	{
-		try
-		{
-			io_service_.run();
-
-			// run exited normally
-			break; 
+			alert_pump_running_ = false;
+		}
 
-		} 
-		HAL_GENERIC_FN_EXCEPTION_CATCH(L"bit_impl::service_thread()")
+		alert_thread_.swap(thread);
 	}
+	alert_cond_.notify_one();
 
-	HAL_DEV_MSG(hal::wform(L"Service thread id %1% exiting normally") % id);
-}
+	// Joined without mutex_, handlers finishing the last batch may need it.
+	if (thread) thread->join();
 
+	unique_lock_t l(mutex_);
 
+	session_->set_alert_notify(boost::function<void()>());
 
+	alert_handler();
+	the_torrents_.terminate_all();
+
+	HAL_DEV_MSG(L" ... stopped");
+}
+	
 void bit_impl::alert_handler()
 {
 //	HAL_DEV_MSG(L" *** Alert Handler ***");
@@ -826,18 +1092,96 @@ void bit_impl::alert_handler()
 	std::vector<libt::alert*> alerts;
 	session_->pop_alerts(&alerts);
 
-	for (auto i = alerts.begin(), end(alerts.end()); i != end; ++i)
+	// Alerts are handled in batches of at most alert_batch_limit_, queued state machine
+	// events are run between batches so a burst of alerts can't hold them back.
+	size_t first = 0;
+	do
 	{
-		if (handler.handle_alert_alt(*i))
+		size_t last = std::min(first + alert_batch_limit_, alerts.size());
+
+		// Stamped per batch, a later batch has waited on the ones before it.
+		libt::time_point now = libt::clock_type::now();
+		boost::int64_t total_latency = 0;
+		boost::int64_t max_latency = 0;
+
+		for (size_t i = first; i != last; ++i)
 		{
-		//	HAL_DEV_MSG(hal::wform(L"unhandled_alert() - %1%") % e.what());
+			boost::int64_t latency = libt::total_microseconds(now - alerts[i]->timestamp());
+			total_latency += latency;
+			max_latency = std::max(max_latency, latency);
+
+			if (handler.handle_alert_alt(alerts[i]))
+			{
+			//	HAL_DEV_MSG(hal::wform(L"unhandled_alert() - %1%") % e.what());
+			}
+		}
+
+		// Torrents streamed in at startup are inserted here.
+		{	unique_lock_t l(mutex_);
+
+			the_torrents_.process_events();
 		}
-	}
 
-	the_torrents_.process_events();
+		if (last != first)
+			record_alert_batch(last - first, total_latency, max_latency);
+
+		first = last;
+	}
+	while (first < alerts.size());
 			
 	} 
 	HAL_GENERIC_FN_EXCEPTION_CATCH(L"bit_impl::alert_handler()")
 }
 
+void bit_impl::alert_pump()
+{
+	win32_exception::install_handler();
+	spans().name_thread("Alert pump");
+
+	HAL_DEV_MSG(L"Alert pump running");
+
+	for ( ; ; )
+	{
+		{	boost::mutex::scoped_lock l(alert_mutex_);
+
+			while (!alert_pending_ && alert_pump_running_)
+				alert_cond_.wait(l);
+
+			if (!alert_pump_running_) break;
+
+			alert_pending_ = false;
+		}
+
+		alert_handler();
+	}
+
+	HAL_DEV_MSG(L"Alert pump exiting");
+}
+
+void bit_impl::notify_alert_pump()
+{
+	// Called from libtorrent's network thread, so nothing here may touch the session.
+	{	boost::mutex::scoped_lock l(alert_mutex_);
+
+		alert_pending_ = true;
+	}
+	alert_cond_.notify_one();
+}
+
+void bit_impl::record_alert_batch(size_t size, boost::int64_t total_latency_us, boost::int64_t max_latency_us)
+{
+	boost::mutex::scoped_lock l(alert_mutex_);
+
+	alert_pump_details& d = alert_pump_details_;
+
+	d.total_latency_us += total_latency_us;
+	d.alerts += size;
+	++d.batches;
+
+	d.last_batch = size;
+	d.largest_batch = std::max(d.largest_batch, size);
+	d.max_latency_us = std::max(d.max_latency_us, max_latency_us);
+	d.mean_latency_us = d.total_latency_us / static_cast<boost::int64_t>(d.alerts);
+}
+
 }
@@ -18,11 +18,10 @@
 #include "halTorrentSerialization.hpp"
 #include "halTorrentInternal.hpp"
 #include "halTorrentManager.hpp"
+#include "halServicePool.hpp"
 #include "halSignaler.hpp"
 #include "halCatchDefines.hpp"
 
-#include <agents.h>
-
 namespace hal
 {
 
@@ -50,6 +49,34 @@ inline bool operator!=(const libt::dht_settings& lhs, const libt::dht_settings&
            lhs.max_fail_count != rhs.max_fail_count;
 }
 
+// Assigns session settings only where they differ, counting those that did.
+class settings_edit
+{
+public:
+	settings_edit(libt::session_settings& settings, size_t& changes) :
+		settings_(settings),
+		changes_(changes)
+	{}
+
+	template<typename T, typename V>
+	void set(T libt::session_settings::* field, const V& value)
+	{
+		T v = static_cast<T>(value);
+
+		if (!(settings_.*field == v))
+		{
+			settings_.*field = v;
+			++changes_;
+		}
+	}
+
+	const libt::session_settings& settings() const { return settings_; }
+
+private:
+	libt::session_settings& settings_;
+	size_t& changes_;
+};
+
 template<typename Addr>
 void write_range(fs::ofstream& ofs, const libt::ip_range<Addr>& range)
 { 
@@ -255,42 +282,105 @@ public:
 			event_log().post(shared_ptr<EventDetail>(new EventMsg(L"Not resolving countries.")));
 	}
 	
-	void set_announce_to_all(bool trackers, bool tiers)
-	{
-		libt::session_settings settings = session_->settings();
+	// Switches between keeping resume data, torrent info and .torrent files in the resume
+	// directory and in one pack file, moving whatever is already saved across.
+	void use_pack_store(bool b);
 
-		settings.announce_to_all_trackers = trackers;
-		settings.announce_to_all_tiers = tiers;
+	// Whether bittorrent.xml is saved as XML or as bittorrent.bin, takes effect on the next save.
+	void use_binary_torrent_state(bool b)
+	{
+		unique_lock_t l(mutex_);
 
-		session_->set_settings(settings);
+		the_torrents_.set_binary_format(b);
+	}
+	
+	void set_announce_to_all(bool trackers, bool tiers)
+	{
+		if (edit_settings([&](settings_edit& s)
+			{
+				s.set(&libt::session_settings::announce_to_all_trackers, trackers);
+				s.set(&libt::session_settings::announce_to_all_tiers, tiers);
+			}))
+			event_log().post(shared_ptr<EventDetail>(new EventMsg(
+				hal::wform(L"Set announcing style- Trackers: %1%, Tiers: %2%.") 
+					% trackers % tiers)));
+	}
 
-		event_log().post(shared_ptr<EventDetail>(new EventMsg(
-			hal::wform(L"Set announcing style- Trackers: %1%, Tiers: %2%.") 
-				% settings.announce_to_all_trackers % settings.announce_to_all_tiers)));
+	void set_session_half_open_limit(int half_open)
+	{
+		if (edit_settings([&](settings_edit& s)
+			{
+				s.set(&libt::session_settings::half_open_limit, half_open);
+			}))
+			event_log().post(shared_ptr<EventDetail>(new EventMsg(
+				hal::wform(L"Set half-open connections limit to %1%.") % half_open)));
 	}
 
 	void start_smart_ban_plugin()
 	{
-		session_->add_extension(&libt::create_smart_ban_plugin);
-		event_log().post(shared_ptr<EventDetail>(new EventMsg(L"Started smart ban plugin.")));
+		if (add_plugin(smart_ban_plugin, &libt::create_smart_ban_plugin))
+			event_log().post(shared_ptr<EventDetail>(new EventMsg(L"Started smart ban plugin.")));
 	}
 
 	void start_ut_pex_plugin()
 	{
-		session_->add_extension(&libt::create_ut_pex_plugin);
-		event_log().post(shared_ptr<EventDetail>(new EventMsg(L"Started uTorrent peer exchange plugin.")));
+		if (add_plugin(ut_pex_plugin, &libt::create_ut_pex_plugin))
+			event_log().post(shared_ptr<EventDetail>(new EventMsg(L"Started uTorrent peer exchange plugin.")));
 	}
 
 	void start_ut_metadata_plugin()
 	{
-		session_->add_extension(&libt::create_ut_metadata_plugin);
-		event_log().post(shared_ptr<EventDetail>(new EventMsg(L"Started uTorrent metadata plugin.")));
+		if (add_plugin(ut_metadata_plugin, &libt::create_ut_metadata_plugin))
+			event_log().post(shared_ptr<EventDetail>(new EventMsg(L"Started uTorrent metadata plugin.")));
 	}
 
 	void start_lt_trackers_plugin()
 	{
-		session_->add_extension(&libt::create_lt_trackers_plugin);
-		event_log().post(shared_ptr<EventDetail>(new EventMsg(L"Started lt tracker plugin.")));
+		if (add_plugin(lt_trackers_plugin, &libt::create_lt_trackers_plugin))
+			event_log().post(shared_ptr<EventDetail>(new EventMsg(L"Started lt tracker plugin.")));
+	}
+
+	// Settings calls between these share one copy of the session settings, which is applied
+	// when the outermost transaction commits and only if something in it changed.
+	void begin_settings()
+	{
+		unique_lock_t l(mutex_);
+
+		if (settings_depth_++ == 0)
+		{
+			pending_settings_ = session_->settings();
+			pending_changes_ = 0;
+		}
+	}
+
+	void commit_settings()
+	{
+		unique_lock_t l(mutex_);
+
+		if (settings_depth_ == 0 || --settings_depth_ != 0) return;
+
+		if (pending_changes_ != 0)
+		{
+			session_->set_settings(pending_settings_);
+
+			HAL_DEV_MSG(hal::wform(L"Applied %1% session setting changes") % pending_changes_);
+		}
+		else
+			HAL_DEV_MSG(L"Session settings unchanged");
+	}
+
+	// Closes a transaction without applying anything, what the outermost one gathered is
+	// dropped.
+	void rollback_settings()
+	{
+		unique_lock_t l(mutex_);
+
+		if (settings_depth_ == 0 || --settings_depth_ != 0) return;
+
+		if (pending_changes_ != 0)
+			{HAL_DEV_MSG(hal::wform(L"Dropped %1% session setting changes") % pending_changes_);}
+
+		pending_changes_ = 0;
 	}
 
 	void ip_v4_filter_block(boost::asio::ip::address_v4 first, boost::asio::ip::address_v4 last)
@@ -373,6 +463,33 @@ public:
 	void start_alert_handler();
 	void stop_alert_handler();
 	void alert_handler();
+	void alert_pump();
+	void notify_alert_pump();
+	void record_alert_batch(size_t size, boost::int64_t total_latency_us, boost::int64_t max_latency_us);
+
+	alert_pump_details get_alert_pump_details() const
+	{
+		boost::mutex::scoped_lock l(alert_mutex_);
+		return alert_pump_details_;
+	}
+
+	// Zero sizes the pool to the machine.
+	void set_service_threads(size_t threads)
+	{
+		service_.resize(threads);
+	}
+
+	service_pool_details get_service_pool_details() const
+	{
+		service_pool_details details;
+
+		details.threads = service_.size();
+		details.strands.push_back(scheduling_.details());
+		details.strands.push_back(persistence_.details());
+		details.strands.push_back(metadata_.details());
+
+		return details;
+	}
 
 	void add_torrent(const wpath& file, const wpath& save_directory, bool start_stopped, bool managed, bit::allocations alloc, 
 			const wpath& move_to_directory) 
@@ -380,8 +497,12 @@ public:
 		try 
 		{	
 
-		torrent_internal_ptr TIp =
-			the_torrents_.create_torrent(file, save_directory, alloc, move_to_directory);
+		torrent_internal_ptr TIp;
+
+		{	unique_lock_t l(mutex_);
+
+			TIp = the_torrents_.create_torrent(file, save_directory, alloc, move_to_directory);
+		}
 
 		if (TIp)
 		{
@@ -411,7 +532,12 @@ public:
 		try 
 		{	
 
-		torrent_internal_ptr TIp = the_torrents_.create_torrent(uri, save_directory, alloc, move_to_directory);
+		torrent_internal_ptr TIp;
+
+		{	unique_lock_t l(mutex_);
+
+			TIp = the_torrents_.create_torrent(uri, save_directory, alloc, move_to_directory);
+		}
 		
 		HAL_DEV_MSG(hal::wform(L"URI Torrent: Created"));
 
@@ -454,7 +580,10 @@ public:
 		boost::shared_ptr<file_details_vec> files = boost::shared_ptr<file_details_vec>(new file_details_vec());		
 		torrent_internal_ptr pTI = the_torrents_.get(id);
 		
-		the_torrents_.remove_torrent(id);
+		{	unique_lock_t l(mutex_);
+
+			the_torrents_.remove_torrent(id);
+		}
 		
 		event_log().post(shared_ptr<EventDetail>(new EventMsg(L"Removed")));
 		
@@ -476,6 +605,7 @@ public:
 			pTI->clear_resume_data();
 			pTI->delete_torrent_file();
 
+			unique_lock_t l(mutex_);
 			the_torrents_.remove_torrent(id);
 		}		
 
@@ -508,8 +638,24 @@ public:
 	{
 		try {
 			
+		// Loaded here rather than with the session so that the pack store, IP filter, limits and
+		// listen interface from the config are all in place before the first torrent starts.
+		if (!the_torrents_.loaded())
+		{
+			event_log().post(shared_ptr<EventDetail>(new EventMsg(L"Loading torrent parameters.", event_logger::info)));
+
+			the_torrents_.load_streaming();
+
+			// The pack store was opened with nothing loaded, so whatever files these still
+			// have are moved in now.
+			move_files_to_pack();
+
+			event_log().post(shared_ptr<EventDetail>(new EventMsg(L"Loading done!", event_logger::info)));
+		}
+
 		event_log().post(shared_ptr<EventDetail>(new EventMsg(L"Resuming all torrents.")));
 		
+		unique_lock_t l(mutex_);
 		the_torrents_.start_all();
 
 		} HAL_GENERIC_TORRENT_EXCEPTION_CATCH(uuid(), "bit_impl::resume_all")
@@ -521,68 +667,93 @@ public:
 		return true;
 	}
 	
+	// Pausing the session has every torrent save its resume data at once. Each one signals
+	// as it settles, so this waits on that rather than polling, for no longer than
+	// shutdown_deadline_. The XML is saved first, it must record the states before pausing.
 	void close_all(boost::optional<report_num_active> fn)
 	{
 		try 
 		{	
 
+		pt::ptime start = pt::microsec_clock::universal_time();
+		pt::ptime phase = start;
+
+		auto lap = [&phase]() -> boost::int64_t
+		{
+			pt::ptime now = pt::microsec_clock::universal_time();
+			boost::int64_t ms = (now - phase).total_milliseconds();
+
+			phase = now;
+			return ms;
+		};
+
+		stop_checkpoints();
+
 		event_log().post(shared_ptr<EventDetail>(new EventInfo(L"Saving torrent data ...")));
 
 		save_torrent_data();
 
+		boost::int64_t saving_ms = lap();
+
 		event_log().post(shared_ptr<EventDetail>(new EventInfo(L"	... stopping all torrents")));
 
 		session_->pause();		
 
-		// Ok this polling loop here is a bit crude, but a blocking wait is actually appropriate.		
-		{ 
-		int num_active = 1;
+		{	pt::ptime deadline = phase + shutdown_deadline_;
+			size_t num_active = 0;
+			size_t reported = ~size_t(0);
 
-		while (num_active > 0)
-		{
-			num_active = 0;
-
-			for (auto i=the_torrents_.begin(), e=the_torrents_.end(); i != e; ++i)
+			for ( ; ; )
 			{
-	/*			if (	(*i).torrent 
-					&& 
-					(*i).torrent->state() != torrent_details::torrent_in_error
-					&& 
-					(*i).torrent->state() != torrent_details::torrent_starting
-					&& 
-					(*i).torrent->state() != torrent_details::torrent_invalid
-					&& 
-					(	(	(*i).torrent->state() != torrent_details::torrent_stopped 
-							&& 
-							(*i).torrent->state() != torrent_details::torrent_paused
-						)
-						|| 
-						(*i).torrent->awaiting_resume_data()
-					)
-				)
-*/
-				if (i->torrent && (
-					i->torrent->state() == torrent_details::torrent_active ||
-					i->torrent->state() == torrent_details::torrent_pausing ||
-					i->torrent->state() == torrent_details::torrent_stopping ||
-					i->torrent->awaiting_resume_data()))
+				boost::uint64_t seen = state_changes();
+
+				num_active = count_unsettled();
+
+				if (num_active != reported)
 				{
-#					ifdef HAL_TORRENT_DEV_MSGES
-						(*i).torrent->output_torrent_debug_details();
-#					endif
-					num_active += 1;
+					event_log().post(shared_ptr<EventDetail>(new EventInfo(hal::wform(L"	... %1% still active, %2% resume files queued") 
+						% num_active % resume_writer_.queue_depth())));
+					reported = num_active;
 				}
+
+				if (fn)	(*fn)(num_active);
+
+				if (num_active == 0 || pt::microsec_clock::universal_time() >= deadline) break;
+
+				// Woken by the next torrent to settle, the timeout only keeps the report ticking.
+				pt::ptime report = pt::microsec_clock::universal_time() + pt::milliseconds(500);
+				wait_state_change(seen, report < deadline ? report : deadline);
 			}
 
-			event_log().post(shared_ptr<EventDetail>(new EventInfo(hal::wform(L"	... %1% still active") % (num_active))));
+			if (num_active != 0)
+				event_log().post(shared_ptr<EventDetail>(new EventMsg(hal::wform(L"Shutdown deadline passed with %1% torrents still active.") 
+					% num_active, event_logger::warning)));
+		}
 
-			if (fn)	(*fn)(num_active);
-			boost::this_thread::sleep(pt::milliseconds(500));
-		} 
-		
+		boost::int64_t pausing_ms = lap();
+
+		{	std::shared_future<void> written = resume_writer_.flush();
+
+			event_log().post(shared_ptr<EventDetail>(new EventInfo(hal::wform(L"	... writing %1% resume files") 
+				% resume_writer_.queue_depth())));
+
+			written.wait();
+		}
+
+		// Torrent info writes queued by torrents settling go into the pack too.
+		metadata_.flush().wait();
+
+		{	unique_lock_t l(mutex_);
+
+			if (pack_store_) pack_store_->commit();
 		}
+
+		boost::int64_t writing_ms = lap();
 		
 		event_log().post(shared_ptr<EventDetail>(new EventInfo(L"	... all torrents stopped.")));		
+
+		event_log().post(shared_ptr<EventDetail>(new EventInfo(hal::wform(L"Shutdown took %1%ms, saving torrent data %2%ms, pausing %3%ms, writing resume data %4%ms.")
+			% (pt::microsec_clock::universal_time() - start).total_milliseconds() % saving_ms % pausing_ms % writing_ms)));
 		
 		} HAL_GENERIC_TORRENT_EXCEPTION_CATCH(uuid(), "close_all()")
 	}
@@ -619,51 +790,133 @@ public:
 private:
 	bool create_torrent(const create_torrent_params& params, fs::wpath out_file, progress_callback fn);
 
-	void service_thread(size_t);
-
 	void execute_action(const boost::system::error_code&, bit::timeout_actions action);
 	void execute_callback(const boost::system::error_code&, action_callback_t action);
 
-	void acquire_work_object()
+	// Applies f to the open transaction's settings or straight to the session's, in which
+	// case they are only set if f changed something. Returns the number of values changed.
+	template<typename F>
+	size_t edit_settings(F f)
+	{
+		unique_lock_t l(mutex_);
+
+		size_t changes = 0;
+
+		if (settings_depth_ != 0)
+		{
+			settings_edit edit(pending_settings_, changes);
+			f(edit);
+
+			pending_changes_ += changes;
+		}
+		else
+		{
+			libt::session_settings settings = session_->settings();
+
+			settings_edit edit(settings, changes);
+			f(edit);
+
+			if (changes != 0) session_->set_settings(settings);
+		}
+
+		return changes;
+	}
+
+	// What the session will have once any open transaction commits.
+	libt::session_settings current_settings() const
 	{
-		HAL_DEV_MSG(hal::wform(L"Acquiring service work object."));
+		unique_lock_t l(mutex_);
 
-		work_.reset(new boost::asio::io_service::work(io_service_));
+		return settings_depth_ != 0 ? pending_settings_ : session_->settings();
 	}
 
-	void discard_work_object()
+	enum plugin_flags
+	{
+		smart_ban_plugin = 1,
+		ut_pex_plugin = 2,
+		ut_metadata_plugin = 4,
+		lt_trackers_plugin = 8
+	};
+
+	// An extension can't be taken out of a session again, so each is only added the once.
+	template<typename F>
+	bool add_plugin(unsigned flag, F create)
 	{
-		work_.reset();
+		unique_lock_t l(mutex_);
+
+		if (plugins_ & flag) return false;
 
-		HAL_DEV_MSG(hal::wform(L"Discarded service work object"));
+		session_->add_extension(create);
+		plugins_ |= flag;
+
+		return true;
 	}
 
+	// Copies the loaded torrents' files into the pack store, then removes the ones it holds.
+	void move_files_to_pack();
+
 	void schedual_action(boost::posix_time::ptime time, bit::timeout_actions action);
 	void schedual_action(boost::posix_time::time_duration duration, bit::timeout_actions action);
 	void schedual_callback(boost::posix_time::ptime time, action_callback_t action);
 	void schedual_callback(boost::posix_time::time_duration duration, action_callback_t action);	
 	void schedual_cancel();
+
+	// Counting torrents yet to pause and hand over their resume data, for close_all.
+	size_t count_unsettled();
+	void notify_state_change();
+	boost::uint64_t state_changes();
+	void wait_state_change(boost::uint64_t seen, pt::ptime until);
+
+	void start_checkpoints();
+	void stop_checkpoints();
+	void checkpoint_tick(const boost::system::error_code& ec);
 	
 	boost::scoped_ptr<libt::session> session_;	
 	SessionDetail session_details_;
 
+	resume_data_writer resume_writer_;
+	boost::scoped_ptr<pack_store> pack_store_;
+
+	// Also held whenever torrents join or leave the_torrents_, so a walk over the whole list
+	// from another thread, as the details producer makes, takes it too.
 	mutable mutex_t mutex_;
 	
 //	ini_file bittorrent_ini_;
 	torrent_manager the_torrents_;	
 
-	boost::asio::io_service io_service_;
-	std::auto_ptr<boost::asio::io_service::work> work_;
+	// Background work, scheduled actions run on scheduling_, resume data checkpoints on
+	// persistence_ and torrent info writes on metadata_.
+	service_pool service_;
+	service_strand scheduling_;
+	service_strand persistence_;
+	service_strand metadata_;
 
 	boost::asio::deadline_timer action_timer_;
 
-	concurrency::call<void*> alert_caller_;
-	concurrency::timer<void*> alert_timer_;
+	// Resume data checkpoints, each round of checkpoint_round_ is spread over checkpoint_ticks ticks.
+	static const size_t checkpoint_ticks = 60;
+	static const size_t checkpoint_tick_budget = 8;
+
+	boost::mutex state_mutex_;
+	boost::condition_variable state_cond_;
+	boost::uint64_t state_changes_;
+	pt::time_duration shutdown_deadline_;
+
+	boost::asio::deadline_timer checkpoint_timer_;
+	pt::time_duration checkpoint_round_;
+	bool checkpoints_running_;
+	size_t checkpoint_ticks_left_;
+	std::deque<boost::weak_ptr<torrent_internal> > checkpoint_queue_;
+
+	// Woken by libtorrent's alert notification and by queued torrent state events.
+	mutable boost::mutex alert_mutex_;
+	boost::condition_variable alert_cond_;
+	bool alert_pending_;
+	bool alert_pump_running_;
+	size_t alert_batch_limit_;
+	alert_pump_details alert_pump_details_;
+	boost::scoped_ptr<thread_t> alert_thread_;
 
-	typedef boost::shared_ptr<thread_t> shared_thread_ptr;
-
-	std::vector<shared_thread_ptr> service_threads_;
-	
 	int default_torrent_max_connections_;
 	int default_torrent_max_uploads_;
 	float default_torrent_download_;
@@ -690,6 +943,14 @@ private:
 
 	libt::upnp* upnp_;
 	libt::natpmp* natpmp_;
+	bool upnp_on_;
+	bool natpmp_on_;
+
+	unsigned plugins_;
+
+	size_t settings_depth_;
+	libt::session_settings pending_settings_;
+	size_t pending_changes_;
 
 	libt::session the_session_;
 };
@@ -0,0 +1,205 @@
+
+//         Copyright Ein O'Callaghan 2009 - 2009.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "halPch.hpp"
+
+#include "halEvent.hpp"
+#include "halSpans.hpp"
+
+namespace hal
+{
+
+namespace
+{
+
+void write_json_string(std::ostream& os, const char* s)
+{
+	os << '"';
+
+	for (; *s; ++s)
+	{
+		unsigned char c = static_cast<unsigned char>(*s);
+
+		if (c == '"' || c == '\\')
+			os << '\\' << *s;
+		else if (c < 0x20)
+			os << "\\u" << std::hex << std::setw(4) << std::setfill('0') << unsigned(c) << std::dec;
+		else
+			os << *s;
+	}
+
+	os << '"';
+}
+
+}
+
+span_log::span_log() :
+	enabled_(false),
+	epoch_(clock::now()),
+	max_records_(0),
+	dropped_(0)
+{}
+
+void span_log::enable(size_t max_records)
+{
+	boost::mutex::scoped_lock l(mutex_);
+
+	max_records_ = max_records;
+	records_.reserve(max_records_ < 4096 ? max_records_ : 4096);
+
+	enabled_.store(true);
+}
+
+void span_log::disable()
+{
+	enabled_.store(false);
+}
+
+void span_log::name_thread(const char* name)
+{
+	if (!enabled()) return;
+
+	boost::mutex::scoped_lock l(mutex_);
+
+	thread_names_[this_thread()] = name;
+}
+
+size_t span_log::size() const
+{
+	boost::mutex::scoped_lock l(mutex_);
+
+	return records_.size();
+}
+
+size_t span_log::dropped() const
+{
+	boost::mutex::scoped_lock l(mutex_);
+
+	return dropped_;
+}
+
+unsigned span_log::this_thread()
+{
+	static std::atomic<unsigned> next(1);
+	static thread_local unsigned id = next++;
+
+	return id;
+}
+
+unsigned& span_log::this_depth()
+{
+	static thread_local unsigned depth = 0;
+
+	return depth;
+}
+
+void span_log::add(record& r)
+{
+	r.thread = this_thread();
+
+	boost::mutex::scoped_lock l(mutex_);
+
+	if (records_.size() < max_records_)
+	{
+		records_.push_back(record());
+		std::swap(records_.back(), r);
+	}
+	else
+		++dropped_;
+}
+
+// Complete ("X") events, one per span, with the thread names as metadata ("M") events.
+// Timestamps and durations are in microseconds as the format expects.
+bool span_log::write_chrome_trace(const fs::wpath& file) const
+{
+	try
+	{
+
+	if (!file.parent_path().empty() && !fs::exists(file.parent_path()))
+		fs::create_directories(file.parent_path());
+
+	fs::ofstream ofs(file, std::ios_base::binary | std::ios_base::trunc);
+
+	boost::mutex::scoped_lock l(mutex_);
+
+	ofs << "{\"traceEvents\":[\n";
+
+	bool first = true;
+
+	for (std::map<unsigned, std::string>::const_iterator i = thread_names_.begin(), e = thread_names_.end(); i != e; ++i)
+	{
+		ofs << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << i->first
+			<< ",\"args\":{\"name\":";
+		write_json_string(ofs, i->second.c_str());
+		ofs << "}}";
+
+		first = false;
+	}
+
+	for (std::vector<record>::const_iterator i = records_.begin(), e = records_.end(); i != e; ++i)
+	{
+		ofs << (first ? "" : ",\n") << "{\"name\":";
+		write_json_string(ofs, i->name);
+		ofs << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << i->thread 
+			<< ",\"ts\":" << i->start << ",\"dur\":" << i->duration
+			<< ",\"args\":{\"depth\":" << i->depth;
+
+		if (!i->detail.empty())
+		{
+			ofs << ",\"detail\":";
+			write_json_string(ofs, i->detail.c_str());
+		}
+
+		ofs << "}}";
+
+		first = false;
+	}
+
+	ofs << "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped\":" << dropped_ << "}}\n";
+
+	ofs.close();
+
+	if (ofs.fail())
+	{
+		event_log().post(shared_ptr<EventDetail>(
+			new EventMsg(hal::wform(L"Span trace write to %1% failed.") % file, event_logger::warning)));
+		return false;
+	}
+
+	event_log().post(shared_ptr<EventDetail>(
+		new EventMsg(hal::wform(L"Wrote %1% spans to %2%, %3% dropped.") % records_.size() % file % dropped_, 
+			event_logger::info)));
+
+	return true;
+
+	}
+	catch (const fs::filesystem_error& e)
+	{
+		event_log().post(shared_ptr<EventDetail>(
+			new EventMsg(hal::wform(L"Span trace write to %1% failed, %2%.") % file % from_utf8_safe(e.what()),
+				event_logger::warning)));
+
+		return false;
+	}
+}
+
+void span::end()
+{
+	span_log& log = spans();
+
+	span_log::record r;
+	r.name = name_;
+	r.detail.swap(detail_);
+	r.depth = depth_;
+	r.start = start_;
+	r.duration = log.now() - start_;
+
+	--span_log::this_depth();
+
+	log.add(r);
+}
+
+}
@@ -0,0 +1,132 @@
+
+//         Copyright Ein O'Callaghan 2009 - 2009.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#if defined(HALTORRENT_PCH)
+#	include "halPch.hpp"
+#else
+#	include "halTypes.hpp"
+#endif
+
+#include <chrono>
+
+namespace hal
+{
+
+// Timed, nested spans of work, kept in memory while enabled and written out as a Chrome
+// trace_event file for chrome://tracing or Perfetto. A span records its thread, how deep
+// it sits inside other spans on that thread and its wall time. While disabled a span
+// costs one relaxed load, so they can stay in the code. Recording stops once max_records
+// spans are held, later ones are only counted.
+class span_log :
+	private boost::noncopyable
+{
+public:
+	typedef std::chrono::steady_clock clock;
+
+	struct record
+	{
+		const char* name;
+		std::string detail;
+		unsigned thread;
+		unsigned depth;
+		boost::int64_t start;		// microseconds since the log was created
+		boost::int64_t duration;
+	};
+
+	span_log();
+
+	void enable(size_t max_records = 64*1024);
+	void disable();
+
+	bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+	// Labels the calling thread in the trace.
+	void name_thread(const char* name);
+
+	size_t size() const;
+	size_t dropped() const;
+
+	// Writes everything recorded so far, returns false if the file couldn't be written.
+	bool write_chrome_trace(const fs::wpath& file) const;
+
+	boost::int64_t now() const
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - epoch_).count();
+	}
+
+	friend class span;
+
+private:
+	static unsigned this_thread();
+	static unsigned& this_depth();
+
+	void add(record& r);
+
+	std::atomic<bool> enabled_;
+	clock::time_point epoch_;
+
+	mutable boost::mutex mutex_;
+	size_t max_records_;
+	size_t dropped_;
+	std::vector<record> records_;
+	std::map<unsigned, std::string> thread_names_;
+};
+
+inline span_log& spans()
+{
+	static span_log span_log_;
+	return span_log_;
+}
+
+// Times the enclosing scope. The name must outlive the log, a literal in practice.
+class span :
+	private boost::noncopyable
+{
+public:
+	explicit span(const char* name) :
+		name_(spans().enabled() ? name : 0)
+	{
+		if (name_) begin();
+	}
+
+	span(const char* name, const std::wstring& detail) :
+		name_(spans().enabled() ? name : 0)
+	{
+		if (name_)
+		{
+			detail_ = to_utf8(detail);
+			begin();
+		}
+	}
+
+	~span()
+	{
+		if (name_) end();
+	}
+
+private:
+	void begin()
+	{
+		depth_ = span_log::this_depth()++;
+		start_ = spans().now();
+	}
+
+	void end();
+
+	const char* name_;
+	std::string detail_;
+	unsigned depth_;
+	boost::int64_t start_;
+};
+
+}
+
+#define HAL_SPAN_CAT_(a, b) a##b
+#define HAL_SPAN_CAT(a, b) HAL_SPAN_CAT_(a, b)
+
+#define HAL_SPAN(...) hal::span HAL_SPAN_CAT(hal_span_, __LINE__)(__VA_ARGS__)
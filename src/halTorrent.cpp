@@ -20,6 +20,7 @@
 #include "halTorrentManager.hpp"
 #include "halSession.hpp"
 #include "halConfig.hpp"
+#include "halTorrentDetailsProducer.hpp"
 
 #include <algorithm>
 
@@ -91,8 +92,7 @@ bool file_details::less(const file_details& r, size_t index) const
 	{
 	case branch_e: return branch < r.branch;
 	case filename_e: 
-		return (boost::algorithm::to_upper_copy(filename.wstring()) 
-			< boost::algorithm::to_upper_copy(r.filename.wstring()));
+		return filename_key < r.filename_key;
 
 	case type_e: return type < r.type;
 	case size_e: return size < r.size;
@@ -178,8 +178,7 @@ bool torrent_details::less(const torrent_details& r, size_t index) const
 	switch (index)
 	{
 	case name_e: 
-		return (boost::algorithm::to_upper_copy(name_) 
-			< boost::algorithm::to_upper_copy(r.name_));
+		return name_key_ < r.name_key_;
 	case state_e: return state_ < r.state_;
 
 	case speed_down_e: return speed_.first < r.speed_.first;
@@ -398,10 +397,16 @@ web_seed_or_dht_node_detail::web_seed_or_dht_node_detail(std::wstring u, int p)
 
 bit::bit() :
 	pimpl_(new bit_impl())
-{}
+{
+	details_producer_.reset(new torrent_details_producer(
+		bind(&bit::collect_torrents, this, _1), 
+		bind(&bit::publish_torrent_details, this, _1)));
+}
 
 bit::~bit()
-{}
+{
+	details_producer_.reset();
+}
 
 bit_impl* bit::pimpl()
 {
@@ -521,6 +526,21 @@ void bit::set_resolve_countries(bool b)
 	pimpl()->set_resolve_countries(b);
 }
 
+void bit::use_pack_store(bool b)
+{
+	pimpl()->use_pack_store(b);
+}
+
+void bit::use_binary_torrent_state(bool b)
+{
+	pimpl()->use_binary_torrent_state(b);
+}
+
+void bit::set_service_threads(size_t threads)
+{
+	pimpl()->set_service_threads(threads);
+}
+
 void bit::set_announce_to_all(bool trackers, bool tiers)
 {
 	pimpl()->set_announce_to_all(trackers, tiers);
@@ -621,14 +641,19 @@ const SessionDetail bit::get_session_details()
 	return details;
 }
 
-void bit::set_session_half_open_limit(int halfConn)
+const alert_pump_details bit::get_alert_pump_details() const
 {
-	libt::session_settings s = pimpl()->session_->settings();
-	s.half_open_limit = halfConn;
-	pimpl()->session_->set_settings(s);
+	return pimpl()->get_alert_pump_details();
+}
 
-	event_log().post(shared_ptr<EventDetail>(new EventMsg(
-		hal::wform(L"Set half-open connections limit to %1%.") % s.half_open_limit)));
+const service_pool_details bit::get_service_pool_details() const
+{
+	return pimpl()->get_service_pool_details();
+}
+
+void bit::set_session_half_open_limit(int halfConn)
+{
+	pimpl()->set_session_half_open_limit(halfConn);
 }
 
 void bit::set_torrent_defaults(const connections& defaults)
@@ -669,36 +694,36 @@ const torrent_details_manager& bit::update_torrent_details_manager(const uuid& f
 {
 	try {
 
-	boost::thread t(boost::bind(&bit::update_torrent_details_manager_thread, this, focused, selected));
-	t.join();
+	torrent_details_.set_selection(focused, selected);
+
+	// Status arrives asynchronously as a state_update_alert for changed torrents only,
+	// so this snapshot reflects the previous request.
+	pimpl()->session_->post_torrent_updates();
+
+	// Callers see the last completed snapshot, the next one is built in the background.
+	details_producer_->request();
 	
 	} HAL_GENERIC_TORRENT_EXCEPTION_CATCH(uuid(), "updatetorrent_details_manager")
 	
 	return torrent_details_;
 }
 
-void bit::update_torrent_details_manager_thread(const uuid& focused, const std::set<uuid>& selected)
+// Runs on the details producer's thread, alongside the UI and alert threads changing the list.
+void bit::collect_torrents(std::vector<torrent_internal_ptr>& torrents)
 {
-	try {	
+	unique_lock_t l(pimpl()->mutex_);
+
+	torrents.reserve(pimpl()->the_torrents_.size());
 
-	torrent_details_map tmp_map;
-	
 	for (torrent_manager::torrent_by_name::iterator i=pimpl()->the_torrents_.begin(), e=pimpl()->the_torrents_.end(); i != e; ++i)
 	{
-		torrent_details_ptr pT = (*i).torrent->get_torrent_details_ptr();				
-		tmp_map[(*i).torrent->id()] = pT;
+		if ((*i).torrent) torrents.push_back((*i).torrent);
 	}
+}
 
-	{	
-		unique_lock_t l(torrent_details_.mutex_);
-
-		torrent_details_.focused_ = focused;
-		torrent_details_.selected_names_ = selected;
-
-		std::swap(tmp_map, torrent_details_.torrent_map_);
-	}
-	
-	} HAL_GENERIC_TORRENT_EXCEPTION_CATCH(uuid(), "updatetorrent_details_manager")
+void bit::publish_torrent_details(const torrent_details_map& details)
+{
+	torrent_details_.publish(details);
 }
 
 void bit::resume_all()
@@ -885,6 +910,33 @@ void bit::connect_torrent_completed_signal(function<void (wstring torrent_name)>
 	pimpl()->signals.torrent_completed.connect(fn);
 }
 
+bit::settings_transaction::settings_transaction(bit& b) :
+	bit_(b),
+	open_(true)
+{
+	bit_.pimpl()->begin_settings();
+}
+
+bit::settings_transaction::~settings_transaction()
+{
+	try
+	{
+
+	if (open_)
+		bit_.pimpl()->rollback_settings();
+
+	}
+	HAL_GENERIC_FN_EXCEPTION_CATCH(L"bit::settings_transaction::~settings_transaction()")
+}
+
+void bit::settings_transaction::commit()
+{
+	if (!open_) return;
+
+	open_ = false;
+	bit_.pimpl()->commit_settings();
+}
+
 bit::torrent::torrent() //:
 //	files(*this)
 {}
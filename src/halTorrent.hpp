@@ -51,6 +51,7 @@ typedef boost::function<void (wpath path, boost::shared_ptr<std::vector<std::wst
 
 class bit_impl;
 class torrent_internal;
+class torrent_details_producer;
 	
 class invalid_torrent : public std::exception
 {
@@ -109,6 +110,23 @@ public:
 		virtual ~null_torrent() throw () {}
 	};
 
+	// Session settings set while one is open are gathered and handed to the session in one
+	// go on commit, and only if any of them changed. One going out of scope without a commit,
+	// as when an exception unwinds it, is rolled back and nothing is applied.
+	class settings_transaction :
+		private boost::noncopyable
+	{
+	public:
+		explicit settings_transaction(bit& b);
+		~settings_transaction();
+
+		void commit();
+
+	private:
+		bit& bit_;
+		bool open_;
+	};
+
 	class torrent
 	{
 		typedef torrent class_type;
@@ -274,6 +292,9 @@ public:
 	void set_announce_to_all(bool trackers, bool tiers);
 
 	void set_resolve_countries(bool);
+	void use_pack_store(bool);
+	void use_binary_torrent_state(bool);
+	void set_service_threads(size_t);
 	void start_smart_ban_plugin();
 	void start_ut_pex_plugin();
 	void start_ut_metadata_plugin();
@@ -304,6 +325,8 @@ public:
 	cache_settings get_cache_settings() const;
 	
 	const SessionDetail get_session_details();
+	const alert_pump_details get_alert_pump_details() const;
+	const service_pool_details get_service_pool_details() const;
 
 	void set_torrent_defaults(const connections& defaults);	
 
@@ -371,10 +394,11 @@ private:
 
 	boost::scoped_ptr<bit_impl> pimpl_;
 
-	void update_torrent_details_manager_thread(
-		const uuid& focused, const std::set<uuid>& selected);
+	void collect_torrents(std::vector<boost::shared_ptr<torrent_internal> >& torrents);
+	void publish_torrent_details(const torrent_details_map& details);
 	
 	torrent_details_manager torrent_details_;
+	boost::scoped_ptr<torrent_details_producer> details_producer_;
 };
 
 inline bit& bittorrent()
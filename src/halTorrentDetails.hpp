@@ -74,6 +74,7 @@ struct file_details
 			unsigned t=file_details::file) :
 		branch(p.parent_path()),
 		filename(p.filename()),
+		filename_key(boost::algorithm::to_upper_copy(filename.wstring())),
 		type(t),
 		size(s),
 		progress(pg),
@@ -104,6 +105,7 @@ struct file_details
 	
 	boost::filesystem::path branch;
 	boost::filesystem::path filename;
+	std::wstring filename_key;
 	unsigned type;
 	boost::int64_t size;
 	boost::int64_t progress;
@@ -153,9 +155,11 @@ public:
 			const pt::ptime& srt=pt::second_clock::universal_time(), 
 			const pt::ptime& fin=pt::second_clock::universal_time(), 
 			int q_p=-1, 
-			bool man=false) :
+			bool man=false,
+			const std::wstring& nk=std::wstring()) :
 		filename_(f),
 		name_(n),
+		name_key_(nk.empty() ? boost::algorithm::to_upper_copy(n) : nk),
 		save_dir_(sd),
 		state_(s),
 		uuid_(id),
@@ -183,10 +187,12 @@ public:
 		start_time_(srt),
 		finish_time_(fin),
 		queue_position_(q_p),
-		managed_(man)
+		managed_(man),
+		generation_(0)
 	{}
 
 	torrent_details() :	
+		generation_(0),
 		peer_details_filled_(false),
 		file_details_filled_(false)
 	{};
@@ -235,6 +241,7 @@ public:
 	
 //	const std::wstring& filename() const { return filename_; }
 	const std::wstring& name() const { return name_; }
+	const std::wstring& name_key() const { return name_key_; }
 	const std::wstring& save_directory() const { return save_dir_; }
 	const std::wstring& state() const { return state_; }
 	const std::wstring& hash() const { return hash_; }
@@ -262,6 +269,22 @@ public:
 	
 	const peer_details_vec& get_peer_details() const;
 	const file_details_vec& get_file_details() const;
+
+	// Peers and files are fetched on first use and aren't covered by the generation, so a
+	// cached copy which has fetched them is replaced by one which will fetch them again.
+	bool lazy_details_filled() const { return peer_details_filled_ || file_details_filled_; }
+
+	std::shared_ptr<torrent_details> unfilled_copy() const
+	{
+		std::shared_ptr<torrent_details> d(new torrent_details(*this));
+
+		d->peer_details_filled_ = false;
+		d->peer_details_.clear();
+		d->file_details_filled_ = false;
+		d->file_details_.clear();
+
+		return d;
+	}
 	
 	const pt::time_duration& active() { return active_; }
 	const pt::time_duration& seeding() { return seeding_; }
@@ -270,6 +293,7 @@ public:
 
 	int queue_position() const { return queue_position_; }
 	bool managed() const { return managed_; }
+	boost::uint64_t generation() const { return generation_; }
 
 	bool less(const torrent_details& r, size_t index = 0) const;
 	std::wstring to_wstring(size_t index = 0);
@@ -277,6 +301,7 @@ public:
 public:
 	std::wstring filename_;
 	std::wstring name_;
+	std::wstring name_key_;
 	std::wstring hash_;
 	boost::uuids::uuid uuid_;
 	std::wstring save_dir_;
@@ -309,6 +334,8 @@ public:
 
 	int queue_position_;
 	bool managed_;
+
+	boost::uint64_t generation_;
 	
 private:
 	mutable bool peer_details_filled_;
@@ -326,52 +353,424 @@ typedef std::vector<torrent_details_ptr> torrent_details_vec;
 typedef std::set<torrent_details_ptr> torrent_details_set;
 typedef std::map<uuid, torrent_details_ptr> torrent_details_map;
 
+// Torrents added, removed or changed between two snapshot versions. When reset is set the
+// requested version is older than the retained history and consumers should resync in full.
+struct torrent_details_delta
+{
+	torrent_details_delta() :
+		from(0),
+		to(0),
+		reset(false)
+	{}
+
+	boost::uint64_t from;
+	boost::uint64_t to;
+	bool reset;
+
+	std::set<uuid> added;
+	std::set<uuid> removed;
+	std::set<uuid> changed;
+};
+
+// Compile time description of a list column that sorts on a plain numeric key. Columns
+// without a specialisation keep going through torrent_details::less.
+template<size_t Column>
+struct torrent_column
+{
+	static const bool numeric = false;
+};
+
+#define HAL_TORRENT_NUMERIC_COLUMN(column, type, key) \
+template<> \
+struct torrent_column<torrent_details::column> \
+{ \
+	static const bool numeric = true; \
+	typedef type value_type; \
+	static value_type get(const torrent_details& t) { return key; } \
+};
+
+HAL_TORRENT_NUMERIC_COLUMN(progress_e, float, t.completion_)
+HAL_TORRENT_NUMERIC_COLUMN(speed_down_e, int, t.speed_.first)
+HAL_TORRENT_NUMERIC_COLUMN(speed_up_e, int, t.speed_.second)
+HAL_TORRENT_NUMERIC_COLUMN(peers_e, size_type, t.peers_)
+HAL_TORRENT_NUMERIC_COLUMN(seeds_e, size_type, t.seeds_)
+HAL_TORRENT_NUMERIC_COLUMN(eta_e, boost::int64_t, t.estimated_time_left_.ticks())
+HAL_TORRENT_NUMERIC_COLUMN(distributed_copies_e, float, t.distributed_copies_)
+HAL_TORRENT_NUMERIC_COLUMN(update_tracker_in_e, boost::int64_t, t.update_tracker_in_.ticks())
+HAL_TORRENT_NUMERIC_COLUMN(ratio_e, float, t.total_payload_downloaded_ 
+	? static_cast<float>(t.total_payload_uploaded_) / static_cast<float>(t.total_payload_downloaded_) : 0)
+HAL_TORRENT_NUMERIC_COLUMN(total_wanted_e, size_type, t.total_wanted_)
+HAL_TORRENT_NUMERIC_COLUMN(completed_e, size_type, t.total_wanted_done_)
+HAL_TORRENT_NUMERIC_COLUMN(remaining_e, size_type, t.total_wanted_ - t.total_wanted_done_)
+HAL_TORRENT_NUMERIC_COLUMN(downloaded_e, size_type, t.total_payload_downloaded_)
+HAL_TORRENT_NUMERIC_COLUMN(uploaded_e, size_type, t.total_payload_uploaded_)
+HAL_TORRENT_NUMERIC_COLUMN(active_time_e, boost::int64_t, t.active_.ticks())
+HAL_TORRENT_NUMERIC_COLUMN(seeding_time_e, boost::int64_t, t.seeding_.ticks())
+HAL_TORRENT_NUMERIC_COLUMN(queue_position_e, int, t.queue_position_)
+HAL_TORRENT_NUMERIC_COLUMN(managed_e, bool, t.managed_)
+
+#undef HAL_TORRENT_NUMERIC_COLUMN
+
+// The numeric columns of a snapshot laid out as one contiguous array per column, all carved
+// out of a single allocation. Row i of every column belongs to the snapshot's i-th torrent.
+class torrent_details_columns :
+	private boost::noncopyable
+{
+public:
+	enum { column_count = torrent_details::hash_e + 1 };
+
+	explicit torrent_details_columns(const torrent_details_vec& torrents) :
+		size_(torrents.size()),
+		offsets_()
+	{
+		arena_.reset(new char[std::max<size_t>(layout<0>(0), 1)]);
+		fill<0>(torrents);
+	}
+
+	size_t size() const { return size_; }
+
+	template<size_t Column>
+	const typename torrent_column<Column>::value_type* column() const
+	{
+		return reinterpret_cast<const typename torrent_column<Column>::value_type*>(arena_.get() + offsets_[Column]);
+	}
+
+	static bool has(size_t column) { return has_from<0>(column); }
+
+	// Calls f with a pointer to the column's values, false if the column isn't numeric.
+	template<typename F>
+	bool visit(size_t column, F f) const { return visit_from<0>(column, f); }
+
+private:
+	template<size_t C>
+	struct is_numeric : std::integral_constant<bool, torrent_column<C>::numeric> {};
+
+	template<size_t C>
+	typename std::enable_if<(C < column_count), size_t>::type layout(size_t offset)
+	{
+		return layout<C + 1>(place<C>(offset, is_numeric<C>()));
+	}
+
+	template<size_t C>
+	typename std::enable_if<(C == column_count), size_t>::type layout(size_t offset) { return offset; }
+
+	template<size_t C>
+	size_t place(size_t offset, std::false_type) { return offset; }
+
+	template<size_t C>
+	size_t place(size_t offset, std::true_type)
+	{
+		typedef typename torrent_column<C>::value_type value_type;
+		const size_t align = std::alignment_of<value_type>::value;
+
+		offsets_[C] = (offset + align - 1) / align * align;
+		return offsets_[C] + size_ * sizeof(value_type);
+	}
+
+	template<size_t C>
+	typename std::enable_if<(C < column_count)>::type fill(const torrent_details_vec& torrents)
+	{
+		fill_column<C>(torrents, is_numeric<C>());
+		fill<C + 1>(torrents);
+	}
+
+	template<size_t C>
+	typename std::enable_if<(C == column_count)>::type fill(const torrent_details_vec&) {}
+
+	template<size_t C>
+	void fill_column(const torrent_details_vec&, std::false_type) {}
+
+	template<size_t C>
+	void fill_column(const torrent_details_vec& torrents, std::true_type)
+	{
+		typedef typename torrent_column<C>::value_type value_type;
+		value_type* values = reinterpret_cast<value_type*>(arena_.get() + offsets_[C]);
+
+		for (size_t i = 0; i < size_; ++i)
+			values[i] = torrent_column<C>::get(*torrents[i]);
+	}
+
+	template<size_t C>
+	static typename std::enable_if<(C < column_count), bool>::type has_from(size_t column)
+	{
+		return column == C ? is_numeric<C>::value : has_from<C + 1>(column);
+	}
+
+	template<size_t C>
+	static typename std::enable_if<(C == column_count), bool>::type has_from(size_t) { return false; }
+
+	template<size_t C, typename F>
+	typename std::enable_if<(C < column_count), bool>::type visit_from(size_t column, F& f) const
+	{
+		return column == C ? visit_column<C>(f, is_numeric<C>()) : visit_from<C + 1>(column, f);
+	}
+
+	template<size_t C, typename F>
+	typename std::enable_if<(C == column_count), bool>::type visit_from(size_t, F&) const { return false; }
+
+	template<size_t C, typename F>
+	bool visit_column(F&, std::false_type) const { return false; }
+
+	template<size_t C, typename F>
+	bool visit_column(F& f, std::true_type) const
+	{
+		f(column<C>());
+		return true;
+	}
+
+	size_t size_;
+	size_t offsets_[column_count];
+	boost::scoped_array<char> arena_;
+};
+
+// An immutable view of every torrent's details, sorted by uuid. Once published it is never
+// modified, so any number of readers can hold and walk one without synchronisation.
+class torrent_details_snapshot
+{
+public:
+	typedef torrent_details_vec::const_iterator const_iterator;
+	typedef const_iterator iterator;
+
+	torrent_details_snapshot() :
+		version_(0)
+	{}
+
+	const_iterator begin() const { return torrents_.begin(); }
+	const_iterator end() const { return torrents_.end(); }
+
+	size_t size() const { return torrents_.size(); }
+	bool empty() const { return torrents_.empty(); }
+
+	torrent_details_ptr find(const uuid& u) const
+	{
+		const_iterator i = std::lower_bound(torrents_.begin(), torrents_.end(), u, uuid_less());
+
+		if (i != torrents_.end() && (*i)->uuid() == u)
+			return *i;
+		else
+			return torrent_details_ptr();
+	}
+
+	boost::optional<size_t> row(const uuid& u) const
+	{
+		const_iterator i = std::lower_bound(torrents_.begin(), torrents_.end(), u, uuid_less());
+
+		if (i != torrents_.end() && (*i)->uuid() == u)
+			return static_cast<size_t>(std::distance(torrents_.begin(), i));
+		else
+			return boost::optional<size_t>();
+	}
+
+	// Built on first use, most snapshots are never sorted by a numeric column.
+	const torrent_details_columns& columns() const
+	{
+		std::call_once(columns_once_, [this] { columns_.reset(new torrent_details_columns(torrents_)); });
+
+		return *columns_;
+	}
+
+	torrent_details_ptr focused_torrent() const { return find(focused_); }
+
+	const uuid& focused() const { return focused_; }
+	const std::set<uuid>& selected() const { return selected_; }
+
+	boost::uint64_t version() const { return version_; }
+
+	friend class torrent_details_manager;
+
+private:
+	struct uuid_less
+	{
+		bool operator()(const torrent_details_ptr& l, const uuid& r) const { return l->uuid() < r; }
+	};
+
+	torrent_details_vec torrents_;
+
+	uuid focused_;
+	std::set<uuid> selected_;
+
+	boost::uint64_t version_;
+
+	mutable std::once_flag columns_once_;
+	mutable boost::scoped_ptr<const torrent_details_columns> columns_;
+};
+
+typedef std::shared_ptr<const torrent_details_snapshot> torrent_details_snapshot_ptr;
+
 class torrent_details_manager
 {
 public:		
-	const torrent_details_set torrents() const 
+	torrent_details_manager() :
+		current_(std::make_shared<torrent_details_snapshot>()),
+		history_floor_(0)
+	{}
+
+	// Readers pin the current snapshot and work from it, publishing only swaps the pointer.
+	torrent_details_snapshot_ptr snapshot() const
 	{
-		unique_lock_t l(mutex_);	
+		return std::atomic_load(&current_);
+	}
 
-		torrent_details_set torrents;
+	boost::uint64_t version() const
+	{
+		return snapshot()->version();
+	}
 
-		for (torrent_details_map::const_iterator i = torrent_map_.begin(), e = torrent_map_.end();
-				i != e; ++i)
-			torrents.insert(i->second);
+	torrent_details_delta changes_since(boost::uint64_t from) const
+	{
+		unique_lock_t l(mutex_);
 
-		return torrents; 
+		torrent_details_delta delta;
+		delta.from = from;
+		delta.to = current_->version();
+
+		if (from < history_floor_ || from > delta.to)
+		{
+			delta.reset = true;
+			return delta;
+		}
+
+		// first: present at 'from', second: present now
+		std::map<uuid, std::pair<bool, bool> > net;
+
+		for (change_log::const_reverse_iterator i = changes_.rbegin(), e = changes_.rend(); 
+				i != e && i->version > from; ++i)
+		{
+			std::pair<std::map<uuid, std::pair<bool, bool> >::iterator, bool> p = 
+				net.insert(std::make_pair(i->id, std::make_pair(true, i->kind != removed_e)));
+
+			// Walking backwards, so the oldest change seen decides whether it existed at 'from'.
+			p.first->second.first = (i->kind != added_e);
+		}
+
+		for (std::map<uuid, std::pair<bool, bool> >::const_iterator i = net.begin(), e = net.end(); i != e; ++i)
+		{
+			if (!i->second.first && i->second.second)
+				delta.added.insert(i->first);
+			else if (i->second.first && !i->second.second)
+				delta.removed.insert(i->first);
+			else if (i->second.first && i->second.second)
+				delta.changed.insert(i->first);
+		}
+
+		return delta;
 	}
 
 	const torrent_details_ptr focused_torrent() const 
 	{
-		return get(focused_); 
+		return snapshot()->focused_torrent(); 
 	}
 
 	const std::set<uuid> selected_uuids() const
 	{
-		unique_lock_t l(mutex_);
-		return selected_names_; 
+		return snapshot()->selected(); 
 	}
 	
 	const torrent_details_ptr get(const uuid& u) const
 	{
-		unique_lock_t l(mutex_);	
-		
-		torrent_details_map::const_iterator i = torrent_map_.find(u);
-		
-		if (i != torrent_map_.end())
-			return i->second;
-		else
-			return torrent_details_ptr();
+		return snapshot()->find(u);
 	}
 	
 	friend class bit;
 
 private:
-	std::set<uuid> selected_names_;
-	torrent_details_map torrent_map_;
+	enum change_kind
+	{
+		added_e,
+		removed_e,
+		changed_e
+	};
 
+	struct change_entry
+	{
+		change_entry(boost::uint64_t v, const uuid& u, change_kind k) :
+			version(v), id(u), kind(k)
+		{}
+
+		boost::uint64_t version;
+		uuid id;
+		change_kind kind;
+	};
+
+	typedef std::deque<change_entry> change_log;
+
+	// Roughly half a minute of UI ticks.
+	static const boost::uint64_t history_versions = 64;
+
+	// Picked up by the next publish.
+	void set_selection(const uuid& focused, const std::set<uuid>& selected)
+	{
+		unique_lock_t l(mutex_);
+
+		focused_ = focused;
+		selected_names_ = selected;
+	}
+
+	// Builds the next snapshot from 'details' and swaps it in. Nothing is published when
+	// neither the torrents nor the selection changed.
+	void publish(const torrent_details_map& details)
+	{
+		unique_lock_t l(mutex_);
+
+		const torrent_details_snapshot& current = *current_;
+
+		boost::uint64_t version = current.version_ + 1;
+		size_t logged = changes_.size();
+
+		std::shared_ptr<torrent_details_snapshot> next = std::make_shared<torrent_details_snapshot>();
+		next->torrents_.reserve(details.size());
+
+		torrent_details_vec::const_iterator o = current.torrents_.begin(), oe = current.torrents_.end();
+		torrent_details_map::const_iterator n = details.begin(), ne = details.end();
+
+		while (o != oe || n != ne)
+		{
+			if (n == ne || (o != oe && (*o)->uuid() < n->first))
+			{
+				changes_.push_back(change_entry(version, (*o)->uuid(), removed_e));
+				++o;
+			}
+			else if (o == oe || n->first < (*o)->uuid())
+			{
+				changes_.push_back(change_entry(version, n->first, added_e));
+				next->torrents_.push_back(n->second);
+				++n;
+			}
+			else
+			{
+				if (*o != n->second)
+					changes_.push_back(change_entry(version, n->first, changed_e));
+				next->torrents_.push_back(n->second);
+				++o; ++n;
+			}
+		}
+
+		bool changed = changes_.size() != logged;
+
+		if (!changed && focused_ == current.focused_ && selected_names_ == current.selected_)
+			return;
+
+		next->focused_ = focused_;
+		next->selected_ = selected_names_;
+		next->version_ = changed ? version : current.version_;
+
+		std::atomic_store(&current_, torrent_details_snapshot_ptr(next));
+
+		while (!changes_.empty() && changes_.front().version + history_versions <= next->version_)
+		{
+			history_floor_ = changes_.front().version;
+			changes_.pop_front();
+		}
+	}
+
+	// Only swapped through atomic_load/atomic_store, mutex_ serialises the writers.
+	torrent_details_snapshot_ptr current_;
+
+	std::set<uuid> selected_names_;
 	uuid focused_;
+
+	boost::uint64_t history_floor_;
+	change_log changes_;
 	
 	mutable mutex_t mutex_;
 };
@@ -457,6 +856,68 @@ struct SessionDetail
 	size_t ip_ranges_filtered;
 };
 
+struct alert_pump_details
+{
+	alert_pump_details() :
+		alerts(0),
+		batches(0),
+		last_batch(0),
+		largest_batch(0),
+		mean_latency_us(0),
+		max_latency_us(0),
+		total_latency_us(0)
+	{}
+
+	boost::uint64_t alerts;
+	boost::uint64_t batches;
+
+	size_t last_batch;
+	size_t largest_batch;
+
+	// Time from libtorrent posting an alert to Halite handling it.
+	boost::int64_t mean_latency_us;
+	boost::int64_t max_latency_us;
+	boost::int64_t total_latency_us;
+};
+
+struct service_strand_details
+{
+	service_strand_details() :
+		pending(0),
+		handled(0),
+		mean_wait_us(0),
+		max_wait_us(0),
+		total_wait_us(0),
+		mean_run_us(0),
+		max_run_us(0),
+		total_run_us(0)
+	{}
+
+	std::wstring name;
+
+	size_t pending;
+	boost::uint64_t handled;
+
+	// Time from a handler being posted to it starting, then how long it ran.
+	boost::int64_t mean_wait_us;
+	boost::int64_t max_wait_us;
+	boost::int64_t total_wait_us;
+
+	boost::int64_t mean_run_us;
+	boost::int64_t max_run_us;
+	boost::int64_t total_run_us;
+};
+
+struct service_pool_details
+{
+	service_pool_details() :
+		threads(0)
+	{}
+
+	size_t threads;
+	std::vector<service_strand_details> strands;
+};
+
 typedef std::pair<wstring, wstring> wstring_pair;
 typedef std::pair<float, float> float_pair;
 typedef std::pair<int, int> int_pair;
@@ -0,0 +1,189 @@
+
+//         Copyright Ein O'Callaghan 2009 - 2009.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include "halTorrentInternal.hpp"
+#include "halCatchDefines.hpp"
+
+namespace hal
+{
+
+// Builds torrent_details_map snapshots on a long lived set of threads. A request wakes the
+// coordinator, which collects the torrents, splits them across the workers and hands the
+// finished map to publish. The per worker parts are kept between rounds so their storage
+// is reused rather than reallocated every tick.
+class torrent_details_producer :
+	private boost::noncopyable
+{
+public:
+	typedef function<void (std::vector<torrent_internal_ptr>&)> source_fn;
+	typedef function<void (const torrent_details_map&)> publish_fn;
+
+	torrent_details_producer(source_fn source, publish_fn publish,
+			unsigned workers = std::max(1u, std::min(boost::thread::hardware_concurrency(), 4u))) :
+		source_(source),
+		publish_(publish),
+		running_(true),
+		requested_(false),
+		round_(0),
+		remaining_(0),
+		next_(0),
+		parts_(workers)
+	{
+		for (unsigned i = 0; i < workers; ++i)
+			workers_.create_thread(boost::bind(&torrent_details_producer::work, this, i));
+
+		coordinator_.reset(new thread_t(boost::bind(&torrent_details_producer::produce, this)));
+	}
+
+	~torrent_details_producer()
+	{
+		stop();
+	}
+
+	// Never blocks, requests arriving while a snapshot is being built are coalesced into one.
+	void request()
+	{
+		{	boost::mutex::scoped_lock l(mutex_);
+
+			requested_ = true;
+		}
+		wake_.notify_one();
+	}
+
+	void stop()
+	{
+		{	boost::mutex::scoped_lock l(mutex_);
+
+			if (!running_) return;
+			running_ = false;
+		}
+		wake_.notify_all();
+		work_ready_.notify_all();
+
+		coordinator_->join();
+		workers_.join_all();
+	}
+
+private:
+	typedef std::vector<std::pair<uuid, torrent_details_ptr> > details_part;
+
+	static const size_t chunk_size = 64;
+
+	void produce()
+	{
+		for ( ; ; )
+		{
+			{	boost::mutex::scoped_lock l(mutex_);
+
+				while (!requested_ && running_)
+					wake_.wait(l);
+
+				if (!running_) break;
+
+				requested_ = false;
+			}
+
+			try
+			{
+
+			pending_.clear();
+			source_(pending_);
+
+			build_parts();
+
+			back_.clear();
+			for (details_part& part : parts_)
+			{
+				back_.insert(part.begin(), part.end());
+				part.clear();
+			}
+
+			publish_(back_);
+
+			} HAL_GENERIC_TORRENT_EXCEPTION_CATCH(uuid(), "torrent_details_producer::produce()")
+		}
+	}
+
+	void build_parts()
+	{
+		{	boost::mutex::scoped_lock l(mutex_);
+
+			next_ = 0;
+			remaining_ = parts_.size();
+			++round_;
+		}
+		work_ready_.notify_all();
+
+		boost::mutex::scoped_lock l(mutex_);
+
+		while (remaining_ != 0)
+			work_done_.wait(l);
+	}
+
+	void work(unsigned id)
+	{
+		size_t seen = 0;
+
+		for ( ; ; )
+		{
+			{	boost::mutex::scoped_lock l(mutex_);
+
+				while (round_ == seen && running_)
+					work_ready_.wait(l);
+
+				// Only exit between rounds, build_parts is waiting on every worker.
+				if (round_ == seen) break;
+
+				seen = round_;
+			}
+
+			try
+			{
+
+			for (size_t first = next_.fetch_add(chunk_size); first < pending_.size(); first = next_.fetch_add(chunk_size))
+			{
+				for (size_t i = first, e = std::min(first + chunk_size, pending_.size()); i != e; ++i)
+				{
+					if (torrent_details_ptr d = pending_[i]->get_torrent_details_ptr())
+						parts_[id].push_back(std::make_pair(d->uuid(), d));
+				}
+			}
+
+			} HAL_GENERIC_TORRENT_EXCEPTION_CATCH(uuid(), "torrent_details_producer::work()")
+
+			{	boost::mutex::scoped_lock l(mutex_);
+
+				--remaining_;
+			}
+			work_done_.notify_one();
+		}
+	}
+
+	source_fn source_;
+	publish_fn publish_;
+
+	boost::mutex mutex_;
+	boost::condition_variable wake_;
+	boost::condition_variable work_ready_;
+	boost::condition_variable work_done_;
+
+	bool running_;
+	bool requested_;
+	size_t round_;
+	size_t remaining_;
+	std::atomic<size_t> next_;
+
+	std::vector<torrent_internal_ptr> pending_;
+	std::vector<details_part> parts_;
+	torrent_details_map back_;
+
+	boost::thread_group workers_;
+	boost::scoped_ptr<thread_t> coordinator_;
+};
+
+}
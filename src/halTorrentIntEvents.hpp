@@ -39,7 +39,19 @@ private:
 	bool pause_;
 };
 
-struct ev_start : sc::event<ev_start> {};
+struct ev_start : sc::event<ev_start>
+{
+public:
+	ev_start(boost::shared_ptr<libt::torrent_info const> info = boost::shared_ptr<libt::torrent_info const>()) :
+		info_(info)
+	{}
+
+	// Metadata already parsed off the scheduler thread, may be empty.
+	const boost::shared_ptr<libt::torrent_info const>& info() const { return info_; }
+
+private:
+	boost::shared_ptr<libt::torrent_info const> info_;
+};
 
 struct ev_error_alert : sc::event<ev_error_alert>
 {
@@ -13,12 +13,12 @@
 #pragma warning (pop) 
 
 #include "halEvent.hpp"
+#include "halSpans.hpp"
+
 #ifndef HAL_TORRENT_STATE_LOGGING
 #	define TORRENT_STATE_LOG(s)
 #else
-#	define TORRENT_STATE_LOG(msg) \
-	hal::event_log().post(boost::shared_ptr<hal::EventDetail>( \
-			new hal::EventMsg(msg, hal::event_logger::torrent_dev))) 
+#	define TORRENT_STATE_LOG(msg) HAL_LEVEL_MSG(hal::event_logger::torrent_dev, msg)
 #endif
 
 namespace hal
@@ -67,6 +67,8 @@ in_the_session::in_the_session(base_type::my_context ctx) :
 		torrent_internal& t_i = *tp.get();
 		upgrade_lock l(t_i.mutex_);
 
+		HAL_SPAN("in_the_session", t_i.name_);
+
 		{	upgrade_to_unique_lock up_l(l);
 
 			if (!t_i.handle_.is_valid())
@@ -138,11 +140,15 @@ sc::result out_of_session::react(const ev_add_to_session& evt)
 		torrent_internal& t_i = *tp.get();
 		upgrade_lock l(t_i.mutex_);
 
+		HAL_SPAN("out_of_session ev_add_to_session", t_i.name_);
+
 		libt::add_torrent_params p;
 		path resume_file = (hal::app().get_working_directory()/L"resume" / (t_i.name_ + L".fastresume")).wstring();
 
 		boost::system::error_code ec;
-		p.resume_data = load_file<std::vector<char>>(resume_file, ec);
+		pack_store* pack = t_i.pack_;
+		if (!pack || !pack->get(t_i.hash_, pack_store::fastresume, p.resume_data))
+			p.resume_data = load_file<std::vector<char>>(resume_file, ec);
 
 		if (!p.resume_data.empty())
 			{HAL_DEV_MSG(L" -- Using resume data");}
@@ -150,7 +156,8 @@ sc::result out_of_session::react(const ev_add_to_session& evt)
 		p.save_path = path_to_utf8(t_i.save_directory_);
 		p.storage_mode = hal_allocation_to_libt(t_i.allocation_);
 
-		p.flags = 
+		// Status only arrives through state_update_alert, which reports subscribed torrents.
+		p.flags = libt::add_torrent_params::flag_update_subscribe |
 			(evt.pause() ? libt::add_torrent_params::flag_paused : 0) | 
 			(t_i.managed_ ? libt::add_torrent_params::flag_auto_managed : 0);
 
@@ -208,11 +215,16 @@ sc::result out_of_session::react(const sc::exception_thrown& e)
 	}
 	catch (const torrent_state_exception& e)
 	{
-		event_log().post(shared_ptr<EventDetail>(new EventGeneral(event_logger::critical, wform(L"Torrent State Exception: %1%") % e.what())));
+		event_log().post(shared_ptr<EventDetail>(new EventTorrentMsg(e.who(), wform(L"Torrent State Exception: %1%") % e.what(), event_logger::critical)));
 	}
 	catch (const std::exception& e)
 	{
-		event_log().post(shared_ptr<EventDetail>(new EventGeneral(event_logger::critical, wform(L"Torrent Std Exception: %1%") % e.what())));
+		// The torrent's lock may still be held by whoever posted the event, uuid_ is set once.
+		uuid id = uuid();
+		if (torrent_internal_ptr tp = context<torrent_internal_sm>().ptr_.lock())
+			id = tp->uuid_;
+
+		event_log().post(shared_ptr<EventDetail>(new EventTorrentMsg(id, wform(L"Torrent Std Exception: %1%") % e.what(), event_logger::critical)));
 	}
 	
 	return transit<invalid>();
@@ -482,12 +494,24 @@ sc::result not_started::react(const ev_start& evt)
 		torrent_internal& t_i = *tp.get();
 		{	upgrade_lock l(t_i.mutex_);
 
-			if (!t_i.info_memory(l) && !t_i.name_.empty())
+			HAL_SPAN("not_started ev_start", t_i.name_);
+
+			if (!t_i.info_memory(l) && evt.info())
+			{
+				HAL_DEV_MSG(L"Using prefetched torrent info");
+				t_i.info_memory_reset(evt.info(), l);
+			}
+			else if (!t_i.info_memory(l) && !t_i.name_.empty())
 			{		
 				path torrent_info_file = (hal::app().get_working_directory()/L"resume" / (t_i.name_ + L".torrent_info"));
 				path torrent_file = (hal::app().get_working_directory()/L"torrents"/t_i.filename_);
 
-				if (fs::exists(torrent_info_file))
+				if (torrent_internal::torrent_info_ptr info = torrent_internal::info_from_pack(t_i.hash_))
+				{
+					HAL_DEV_MSG(L"Using packed torrent info");
+					t_i.info_memory_reset(info, l);
+				}
+				else if (fs::exists(torrent_info_file))
 				{
 					upgrade_to_unique_lock up_l(l);
 
@@ -552,6 +576,8 @@ resume_data_waiting::resume_data_waiting(base_type::my_context ctx) :
 	
 	if (torrent_internal_ptr tp = context<torrent_internal_sm>().ptr_.lock())
 	{
+		HAL_SPAN("resume_data_waiting");
+
 		tp->save_resume_and_info_data();
 		tp->awaiting_resume_data_ = true;
 	}
@@ -562,7 +588,10 @@ resume_data_waiting::~resume_data_waiting()
 	TORRENT_STATE_LOG(L"Exiting ~resume_data_waiting()");
 	
 	if (torrent_internal_ptr tp = context<torrent_internal_sm>().ptr_.lock())
+	{
 		tp->awaiting_resume_data_ = false;
+		tp->signal_state();
+	}
 }
 
 resume_data_idling::resume_data_idling()
@@ -6,6 +6,8 @@
 
 #include "halPch.hpp"
 
+#include <boost/crc.hpp>
+
 #pragma warning (push, 1)
 //#	include <libtorrent/escape_string.hpp>
 #	include <libtorrent/magnet_uri.hpp>
@@ -19,6 +21,10 @@ namespace hal
 
 	
 boost::scoped_ptr<libt::session>* torrent_internal::the_session_ = 0;	
+resume_data_writer* torrent_internal::resume_writer_ = 0;
+std::atomic<pack_store*> torrent_internal::pack_(0);
+service_strand* torrent_internal::metadata_strand_ = 0;
+function<void ()> torrent_internal::state_signal_;
 
 template<typename F>
 void iterate_info_files(const libt::torrent_info& info, F&& f)
@@ -37,6 +43,8 @@ void iterate_handle_files(const libt::torrent_handle& handle, F&& f)
 // Constructors
 
 #define TORRENT_INTERNALS_DEFAULTS \
+	generation_(1), \
+	details_generation_(0), \
 	transfer_limit_(std::make_pair(-1.f, -1.f)), \
 	connections_(-1), \
 	uploads_(-1), \
@@ -44,11 +52,14 @@ void iterate_handle_files(const libt::torrent_handle& handle, F&& f)
 	total_uploaded_(0), \
 	total_base_(0), \
 	progress_(0), \
+	checkpoint_progress_(0), \
+	checkpoint_time_(boost::posix_time::second_clock::universal_time()), \
 	managed_(false), \
 	start_time_(boost::posix_time::second_clock::universal_time()), \
 	in_session_(false), \
 	queue_position_(-1), \
 	hash_(0), \
+	info_checksum_(0), \
 	awaiting_resume_data_(false), \
 	superseeding_(false), \
 	files_(mutex_, \
@@ -126,6 +137,115 @@ void torrent_internal::set_the_session(boost::scoped_ptr<libt::session>* s)
 	the_session_ = s;
 }
 
+void torrent_internal::set_resume_writer(resume_data_writer* w)
+{
+	resume_writer_ = w;
+}
+
+void torrent_internal::set_metadata_strand(service_strand* s)
+{
+	metadata_strand_ = s;
+}
+
+void torrent_internal::set_pack_store(pack_store* p)
+{
+	pack_ = p;
+}
+
+void torrent_internal::set_state_signal(function<void ()> f)
+{
+	state_signal_ = f;
+}
+
+torrent_internal::torrent_info_ptr torrent_internal::info_from_pack(const libt::sha1_hash& hash)
+{
+	pack_store* pack = pack_;
+	if (!pack || hash.is_all_zeros()) return torrent_info_ptr();
+
+	std::vector<char> buffer;
+
+	if (pack->get(hash, pack_store::torrent_info, buffer) || pack->get(hash, pack_store::torrent_file, buffer))
+	{
+		libt::error_code ec;
+		torrent_info_ptr info = boost::make_shared<libt::torrent_info>(buffer.data(), static_cast<int>(buffer.size()), ec);
+
+		if (!ec)
+			return info;
+		else
+			HAL_DEV_MSG(hal::wform(L"Packed torrent info invalid: %1%") % from_utf8(ec.message()));
+	}
+
+	return torrent_info_ptr();
+}
+
+std::vector<std::pair<pack_store::record_kind, wpath> > torrent_internal::store_files(upgrade_lock& l) const
+{
+	std::vector<std::pair<pack_store::record_kind, wpath> > files;
+	wpath resume_dir = hal::app().get_working_directory()/L"resume";
+
+	files.push_back(std::make_pair(pack_store::fastresume, resume_dir/(name(l) + L".fastresume")));
+	files.push_back(std::make_pair(pack_store::torrent_info, resume_dir/(name(l) + L".torrent_info")));
+
+	if (!filename_.empty())
+		files.push_back(std::make_pair(pack_store::torrent_file, hal::app().get_working_directory()/L"torrents"/filename_));
+
+	return files;
+}
+
+// Records the pack already has are newer than the files, they were written since it opened.
+void torrent_internal::copy_files_to_pack(pack_store& pack) const
+{
+	upgrade_lock l(mutex_);
+
+	if (hash_.is_all_zeros()) return;
+
+	for (const auto& f : store_files(l))
+	{
+		if (pack.contains(hash_, f.first) || !fs::exists(f.second)) continue;
+
+		boost::system::error_code ec;
+		std::vector<char> data = load_file<std::vector<char>>(f.second, ec);
+
+		if (!ec)
+			pack.put(hash_, f.first, data.data(), data.size());
+	}
+}
+
+void torrent_internal::remove_packed_files(const pack_store& pack) const
+{
+	upgrade_lock l(mutex_);
+
+	if (hash_.is_all_zeros()) return;
+
+	for (const auto& f : store_files(l))
+	{
+		boost::system::error_code ec;
+
+		if (pack.contains(hash_, f.first))
+			fs::remove(f.second, ec);
+	}
+}
+
+void torrent_internal::copy_pack_to_files(const pack_store& pack) const
+{
+	upgrade_lock l(mutex_);
+
+	if (hash_.is_all_zeros()) return;
+
+	std::vector<char> data;
+
+	for (const auto& f : store_files(l))
+	{
+		if (fs::exists(f.second) || !pack.get(hash_, f.first, data)) continue;
+
+		if (!fs::exists(f.second.parent_path()))
+			fs::create_directories(f.second.parent_path());
+
+		fs::ofstream out(f.second, std::ios_base::binary);
+		out.write(data.data(), data.size());
+	}
+}
+
 bool torrent_internal::in_session() const
 {	
 	upgrade_lock l(mutex_);
@@ -154,6 +274,8 @@ void torrent_internal::adjust_queue_position(bit::queue_adjustments adjust)
 			handle_.queue_position_bottom();
 			break;
 		};
+
+		touch();
 	}
 }
 
@@ -168,6 +290,7 @@ void torrent_internal::set_managed(bool m)
 	upgrade_to_unique_lock up_l(l);
 
 	managed_ = m;
+	touch();
 	
 	if (in_session(l))
 		handle_.auto_managed(managed_);
@@ -196,6 +319,7 @@ bool torrent_internal::is_finished(upgrade_lock& l) const
 void torrent_internal::alert_finished()
 {
 	upgrade_lock l(mutex_);
+	touch();
 
 	if (finish_time_.is_special())
 	{
@@ -214,6 +338,7 @@ void torrent_internal::alert_finished()
 			handle_.move_storage(path_to_utf8(move_to_directory_));
 
 			save_directory_ = move_to_directory_;
+			touch();
 		}
 
 		apply_superseeding(l);
@@ -268,11 +393,26 @@ const wstring& torrent_internal::name(upgrade_lock& l) const
 		upgrade_to_unique_lock up_l(l);
 			
 		name_ = hal::from_utf8_safe(handle_.status(libt::torrent_handle::query_name).name);
+		name_key_.clear();
 	}
 	
 	return name_; 
 }
 
+const wstring& torrent_internal::name_key(upgrade_lock& l) const
+{
+	// Upper cased once per name change, the lists sort on this rather than the name.
+	if (name_key_.empty())
+	{
+		const wstring& n = name(l);
+
+		upgrade_to_unique_lock up_l(l);
+		name_key_ = boost::algorithm::to_upper_copy(n);
+	}
+
+	return name_key_;
+}
+
 void torrent_internal::set_name(const wstring& n)
 {
 	upgrade_lock l(mutex_);
@@ -281,6 +421,7 @@ void torrent_internal::set_name(const wstring& n)
 			
 		//name_ = n;
 		files_.set_root_name(n, l);
+		touch();
 	}
 
 	init_file_details(l);
@@ -490,12 +631,25 @@ torrent_details_ptr torrent_internal::get_torrent_details_ptr() const
 {	
 	if (scoped_try_lock ll = scoped_try_lock(details_mutex_))
 	{
+		boost::uint64_t generation = generation_;
+
 		upgrade_lock l(mutex_);
 
 		try
 		{
 
-		renew_status_cache(l);	
+		// The totals and durations are saved with the torrent, so they're brought up to date
+		// on every call whether or not the details are rebuilt.
+		update_totals(l);
+
+		if (details_ptr_ && details_generation_ == generation)
+		{
+			if (details_ptr_->lazy_details_filled())
+				details_ptr_ = details_ptr_->unfilled_copy();
+
+			return details_ptr_;
+		}
+
 		wstring state_str = state_string(l);
 		
 		pt::time_duration td(pt::pos_infin);
@@ -506,34 +660,6 @@ torrent_details_ptr torrent_internal::get_torrent_details_ptr() const
 				long(float(status_cache(l).total_wanted-status_cache(l).total_wanted_done) / status_cache(l).download_payload_rate));
 		}
 		
-		{	upgrade_to_unique_lock up_l(l);
-				
-			auto& sc = status_cache(l);
-
-			total_uploaded_ += (sc.total_payload_upload - total_base_);
-			total_base_ = sc.total_payload_upload;
-			
-			uploaded_.update(sc.total_upload);
-			payload_uploaded_.update(sc.total_payload_upload);
-			downloaded_.update(sc.total_download);
-			payload_downloaded_.update(sc.total_payload_download);
-
-			// just in case these were wrong
-
-//			managed_ = sc.auto_managed;
-//			superseeding_ = sc.super_seeding;
-		}
-		
-		if (is_active(l))
-		{
-			upgrade_to_unique_lock up_l(l);
-
-			active_duration_.update();
-			
-			if (libt::torrent_status::seeding == status_cache(l).state)
-				seeding_duration_.update();
-		}	
-		
 		boost::tuple<size_t, size_t, size_t, size_t> connections = update_peers(l);	
 
 		details_ptr_.reset(new torrent_details(
@@ -557,7 +683,11 @@ torrent_details_ptr torrent_internal::get_torrent_details_ptr() const
 			start_time_,
 			finish_time_,
 			queue_position_,
-			status_cache(l).auto_managed));
+			status_cache(l).auto_managed,
+			name_key(l)));
+
+		details_ptr_->generation_ = generation;
+		details_generation_ = generation;
 
 		}
 	/*	catch (const libt::invalid_handle&)
@@ -698,6 +828,8 @@ void torrent_internal::prepare(upgrade_lock& l, torrent_info_ptr info)
 
 void torrent_internal::update_manager(upgrade_lock& l)
 {
+	touch();
+
 	if (update_manager_)
 	{
 		l.unlock();
@@ -713,13 +845,16 @@ void torrent_internal::extract_names(upgrade_lock& l)
 		upgrade_to_unique_lock up_l(l);
 
 		name_ = hal::from_utf8_safe(info_memory(l)->name());
+		name_key_.clear();
 		
 		filename_ = name_;
 		if (!boost::find_last(filename_, L".torrent")) 
 				filename_ += L".torrent";
 		
-		event_log().post(shared_ptr<EventDetail>(new EventMsg(
+		event_log().post(shared_ptr<EventDetail>(new EventTorrentMsg(id(l),
 			hal::wform(L"Loaded names: %1%, %2%") % name_ % filename_)));
+
+		touch();
 	}
 }
 
@@ -749,7 +884,7 @@ void torrent_internal::extract_hash(upgrade_lock& l)
 		p.save_path = path_to_utf8(save_directory_);
 		p.storage_mode = hal_allocation_to_libt(allocation_);
 
-		p.flags = libt::add_torrent_params::flag_paused || libt::add_torrent_params::flag_update_subscribe;
+		p.flags = libt::add_torrent_params::flag_paused | libt::add_torrent_params::flag_update_subscribe;
 		
 		libt::error_code ec;		
 		libt::parse_magnet_uri(magnet_uri_, p, ec);
@@ -779,6 +914,7 @@ void torrent_internal::extract_hash(upgrade_lock& l)
 	{	upgrade_to_unique_lock up_l(l);
 
 		hash_str_ = from_utf8(libt::base32encode(std::string((char const*)&ih[0], 20)));
+		touch();
 	}
 
 	files_.set_hash(hash_str_);
@@ -816,24 +952,81 @@ void torrent_internal::extract_filenames(upgrade_lock& l)
 		}
 }
 
+// Covers everything create_torrent copies out of a torrent_info that can change once the
+// metadata is known, the info dictionary itself plus trackers and web seeds.
+boost::uint32_t torrent_internal::info_checksum(const libt::torrent_info& info)
+{
+	boost::crc_32_type crc;
+
+	crc.process_bytes(info.info_hash().begin(), libt::sha1_hash::size);
+	crc.process_bytes(info.metadata().get(), info.metadata_size());
+
+	for (const libt::announce_entry& a : info.trackers())
+	{
+		crc.process_bytes(a.url.data(), a.url.size() + 1);
+		crc.process_byte(a.tier);
+	}
+
+	for (const libt::web_seed_entry& w : info.web_seeds())
+		crc.process_bytes(w.url.data(), w.url.size() + 1);
+
+	// Zero is kept for nothing written.
+	return crc.checksum() ? crc.checksum() : 1;
+}
+
 void torrent_internal::write_torrent_info(upgrade_lock& l) const
 {
 	try {
 
 	if (auto info_ptr = info_memory(l))
 	{
-		wpath resume_dir = hal::app().get_working_directory()/L"resume";
-		
-		if (!exists(resume_dir))
-			fs::create_directories(resume_dir);
-
-		boost::filesystem::ofstream out(resume_dir/(name(l) + L".torrent_info"), std::ios_base::binary);
-		out.unsetf(std::ios_base::skipws);
-
 		if (info_ptr->metadata())
 		{
+			wpath torrent_info_file = hal::app().get_working_directory()/L"resume"/(name(l) + L".torrent_info");
+			boost::uint32_t checksum = info_checksum(*info_ptr);
+			pack_store* pack = pack_;
+
+			// Metadata doesn't change once known, only write it when it is new or differs from
+			// what was last written and that copy is still there.
+			if (checksum == info_checksum_ && (pack ?
+					pack->contains(hash_, pack_store::torrent_info) : fs::exists(torrent_info_file)))
+			{
+				HAL_DEV_MSG(L"Torrent info unchanged");
+				return;
+			}
+
 			libt::create_torrent t(*info_ptr);
-			bencode(std::ostream_iterator<char>(out), t.generate());
+
+			if (pack)
+			{
+				std::vector<char> buffer;
+				bencode(std::back_inserter(buffer), t.generate());
+
+				pack->put(hash_, pack_store::torrent_info, buffer.data(), buffer.size());
+				pack->commit();
+			}
+			else
+			{
+				if (!exists(torrent_info_file.parent_path()))
+					fs::create_directories(torrent_info_file.parent_path());
+
+				boost::filesystem::ofstream out(torrent_info_file, std::ios_base::binary);
+				out.unsetf(std::ios_base::skipws);
+
+				bencode(std::ostream_iterator<char>(out), t.generate());
+				out.close();
+
+				if (out.fail())
+				{
+					event_log().post(shared_ptr<EventDetail>(
+						new EventTorrentMsg(id(l), L"Write torrent info error.", event_logger::warning)));
+					return;
+				}
+			}
+
+			{	upgrade_to_unique_lock up_l(l);
+				info_checksum_ = checksum;
+			}
 
 			HAL_DEV_MSG(L"Torrent info written!");
 		}
@@ -847,7 +1040,7 @@ void torrent_internal::write_torrent_info(upgrade_lock& l) const
 	catch (const boost::filesystem::filesystem_error&)
 	{
 		event_log().post(shared_ptr<EventDetail>(
-			new EventMsg(L"Write torrent info error.", event_logger::warning)));
+			new EventTorrentMsg(id(l), L"Write torrent info error.", event_logger::warning)));
 	}
 	catch (const libt::libtorrent_exception&)
 	{
@@ -1099,7 +1292,10 @@ void torrent_internal::state(upgrade_lock& l, unsigned s)
 	{	upgrade_to_unique_lock up_l(l);
 			
 		state_ = s;
+		touch();
 	}
+
+	signal_state();
 }
 
 void torrent_internal::initialize_non_serialized(sc::fifo_scheduler<>::processor_handle h, 
@@ -1139,21 +1335,72 @@ libt::torrent_status& torrent_internal::renew_status_cache(upgrade_lock& l) cons
 			progress_ = status_memory_.progress;
 			queue_position_ = handle_.queue_position();
 		}
+
+		touch();
 	}
 	else
+		clear_status_rates(l);
+
+	return status_memory_;
+}
+
+void torrent_internal::update_totals(upgrade_lock& l) const
+{
+	// status_memory_ is kept current by state_update_alerts, see update_status_cache.
+	if (!in_session(l) || !is_active(l))
+		clear_status_rates(l);
+
+	{	upgrade_to_unique_lock up_l(l);
+			
+		auto& sc = status_cache(l);
+
+		total_uploaded_ += (sc.total_payload_upload - total_base_);
+		total_base_ = sc.total_payload_upload;
+		
+		uploaded_.update(sc.total_upload);
+		payload_uploaded_.update(sc.total_payload_upload);
+		downloaded_.update(sc.total_download);
+		payload_downloaded_.update(sc.total_payload_download);
+
+		// just in case these were wrong
+
+//		managed_ = sc.auto_managed;
+//		superseeding_ = sc.super_seeding;
+	}
+	
+	if (is_active(l))
 	{
 		upgrade_to_unique_lock up_l(l);
 
-		// Wipe these cause they don't make sense for a non-active torrent.
+		active_duration_.update();
 		
-		status_memory_.download_payload_rate = 0;
-		status_memory_.upload_payload_rate = 0;
-		status_memory_.total_payload_download = 0;
-		status_memory_.total_payload_upload = 0;
-		status_memory_.next_announce = libt::time_duration::zero();		
-	}
+		if (libt::torrent_status::seeding == status_cache(l).state)
+			seeding_duration_.update();
+	}	
+}
 
-	return status_memory_;
+void torrent_internal::clear_status_rates(upgrade_lock& l) const
+{
+	upgrade_to_unique_lock up_l(l);
+
+	// Wipe these cause they don't make sense for a non-active torrent.
+	
+	status_memory_.download_payload_rate = 0;
+	status_memory_.upload_payload_rate = 0;
+	status_memory_.total_payload_download = 0;
+	status_memory_.total_payload_upload = 0;
+	status_memory_.next_announce = libt::time_duration::zero();		
+}
+
+void torrent_internal::update_status_cache(const libt::torrent_status& ts)
+{
+	upgrade_lock l(mutex_);
+	upgrade_to_unique_lock up_l(l);
+
+	status_memory_ = ts;
+	progress_ = status_memory_.progress;
+	queue_position_ = status_memory_.queue_position;
+	touch();
 }
 	
 wstring torrent_internal::state_string(upgrade_lock& l) const
@@ -1256,6 +1503,43 @@ torrent_internal::torrent_info_ptr torrent_internal::info_memory(upgrade_lock& l
 	return info_memory_;
 }
 
+torrent_internal::torrent_info_ptr torrent_internal::prefetch_torrent_info() const
+{
+	wpath torrent_info_file;
+	wpath torrent_file;
+	libt::sha1_hash hash;
+
+	{	upgrade_lock l(mutex_);
+
+		if (info_memory_ || name_.empty())
+			return torrent_info_ptr();
+
+		torrent_info_file = hal::app().get_working_directory()/L"resume"/(name_ + L".torrent_info");
+		torrent_file = hal::app().get_working_directory()/L"torrents"/filename_;
+		hash = hash_;
+	}
+
+	// Parsing happens outside the lock so any number of torrents can be loaded at once.
+	// On failure nothing is returned and not_started falls back to loading the files itself.
+	try 
+	{
+
+	if (torrent_info_ptr info = info_from_pack(hash))
+		return info;
+	else if (fs::exists(torrent_info_file))
+		return boost::make_shared<libt::torrent_info>(path_to_utf8(torrent_info_file));
+	else if (fs::exists(torrent_file))
+		return boost::make_shared<libt::torrent_info>(path_to_utf8(torrent_file));
+
+	}
+	catch (const std::exception& e)
+	{
+		HAL_DEV_MSG(hal::wform(L"Prefetching torrent info failed: %1%") % from_utf8(e.what()));
+	}
+
+	return torrent_info_ptr();
+}
+
 void torrent_internal::info_memory_reset(torrent_info_ptr im, upgrade_lock& l)
 {	
 	upgrade_to_unique_lock up_l(l);
@@ -1271,6 +1555,7 @@ void torrent_internal::info_memory_reset(torrent_info_ptr im, upgrade_lock& l)
 	}
 
 	info_memory_ = im;
+	touch();
 
 	// This informs the Files manager about names loaded from a fast resume file.
 	files_.set_hash(hash_str_);	
@@ -1355,6 +1640,8 @@ void torrent_internal::set_file_priority_cb(size_t i, int p, upgrade_lock& l)
 		file_priorities_[i] = p;
 		file_details_memory_[i].priority = p;
 	}
+
+	touch();
 }
 	
 };
@@ -21,6 +21,8 @@
 #include "halTorrentSerialization.hpp"
 #include "halTorrentFile.hpp"
 #include "halTorrentIntEvents.hpp"
+#include "halResumeWriter.hpp"
+#include "halServicePool.hpp"
 
 namespace hal 
 {
@@ -252,9 +254,23 @@ public:
 	~torrent_internal() {}
 
 	static void set_the_session(boost::scoped_ptr<libt::session>*);
+	static void set_resume_writer(resume_data_writer*);
+	static void set_pack_store(pack_store*);
+	// Torrent info writes are posted here, they run in line when it is null.
+	static void set_metadata_strand(service_strand*);
+	// Called whenever a torrent's state changes or it stops waiting on resume data.
+	static void set_state_signal(function<void ()>);
+
+	// Moving between the resume directory and the pack store, see bit_impl::use_pack_store.
+	void copy_files_to_pack(pack_store& pack) const;
+	void remove_packed_files(const pack_store& pack) const;
+	void copy_pack_to_files(const pack_store& pack) const;
 	bool in_session() const;
 	
 	torrent_details_ptr get_torrent_details_ptr() const;
+	torrent_info_ptr prefetch_torrent_info() const;
+	boost::uint64_t generation() const { return generation_; }
+	void update_status_cache(const libt::torrent_status& ts);
 
 	void adjust_queue_position(bit::queue_adjustments adjust);
 
@@ -352,10 +368,10 @@ public:
 		HAL_DEV_MSG(L" ... ev_stop done");
 	}
 	
-	void start()
+	void start(torrent_info_ptr info = torrent_info_ptr())
 	{		
 		HAL_DEV_MSG(L"process_event(ev_start())");
-		process_event(new ev_start());
+		process_event(new ev_start(info));
 		HAL_DEV_MSG(L" ... ev_start done");
 	}
 	
@@ -371,31 +387,75 @@ public:
 		process_event(new ev_force_recheck());	
 	}
 	
-	void write_resume_data(const libt::entry& ent)
+	// Hands the data to the resume writer, the file is written on its thread.
+	void write_resume_data(resume_data_writer::entry_ptr ent)
 	{		
 		upgrade_lock l(mutex_);
 			
 		HAL_DEV_MSG(L"write_resume_data()");
 
-		wpath resume_dir = hal::app().get_working_directory()/L"resume";
-		
-		if (!exists(resume_dir))
-			fs::create_directories(resume_dir);
+		wpath resume_file = hal::app().get_working_directory()/L"resume"/(name(l) + L".fastresume");
 
-		boost::filesystem::ofstream out(resume_dir/(name(l) + L".fastresume"), std::ios_base::binary);
-		out.unsetf(std::ios_base::skipws);
-		bencode(std::ostream_iterator<char>(out), ent);
+		if (resume_writer_)
+			resume_writer_->write(hash_, resume_file, ent);
+		else
+			resume_data_writer::write_file(resume_file, *ent);
 
-		HAL_DEV_MSG(L"Written!");
+		HAL_DEV_MSG(L"Queued!");
 	}
 
-	void save_resume_and_info_data() const
+	// How far the torrent has moved since its last checkpoint, plus an hour's wait counting
+	// the same as the whole torrent so nothing is put off for ever. Negative when libtorrent
+	// has nothing new to save or a save is already on its way.
+	float checkpoint_priority() const
+	{
+		upgrade_lock l(mutex_);
+
+		if (!in_session(l) || awaiting_resume_data_ || !handle_.need_save_resume_data())
+			return -1.f;
+
+		pt::time_duration waited = pt::second_clock::universal_time() - checkpoint_time_;
+
+		return std::abs(progress_ - checkpoint_progress_) + waited.total_seconds() / 3600.f;
+	}
+
+	void checkpoint_resume_data() const
 	{
 		upgrade_lock l(mutex_);
 
+		if (!in_session(l)) return;
+
+		{	upgrade_to_unique_lock up_l(l);
+			checkpoint_progress_ = progress_;
+			checkpoint_time_ = pt::second_clock::universal_time();
+		}
+
 		handle_.save_resume_data();
+	}
 
-		write_torrent_info(l);
+	void save_resume_and_info_data() const
+	{
+		{	upgrade_lock l(mutex_);
+
+			handle_.save_resume_data();
+		}
+
+		// Generating and checksumming the metadata is kept off the alert thread.
+		if (metadata_strand_)
+		{
+			boost::shared_ptr<const torrent_internal> self = shared_from_this();
+
+			metadata_strand_->post([self]()
+			{
+				upgrade_lock l(self->mutex_);
+				self->write_torrent_info(l);
+			});
+		}
+		else
+		{
+			upgrade_lock l(mutex_);
+			write_torrent_info(l);
+		}
 	}
 	
 	void clear_resume_data()
@@ -404,6 +464,11 @@ public:
 
 		try {
 
+		if (resume_writer_)
+			resume_writer_->cancel(hash_);
+		if (pack_store* pack = pack_)
+			pack->erase(hash_, pack_store::fastresume);
+
 		wpath resume_file = hal::app().get_working_directory() / L"resume" / (name(l) + L".fastresume");
 
 		if (exists(resume_file))
@@ -413,7 +478,7 @@ public:
 		catch (const boost::filesystem::filesystem_error&)
 		{
 			event_log().post(shared_ptr<EventDetail>(
-				new EventMsg(L"Resume data removal error.", event_logger::warning)));
+				new EventTorrentMsg(id(l), L"Resume data removal error.", event_logger::warning)));
 		}
 	}
 	
@@ -423,6 +488,13 @@ public:
 
 		try {
 
+		if (pack_store* pack = pack_)
+			pack->erase(hash_, pack_store::torrent_info);
+
+		{	upgrade_to_unique_lock up_l(l);
+			info_checksum_ = 0;
+		}
+
 		wpath torrent_info_file = hal::app().get_working_directory() / L"resume" / (name(l) + L".torrent_info");
 
 		if (exists(torrent_info_file))
@@ -432,7 +504,7 @@ public:
 		catch (const boost::filesystem::filesystem_error&)
 		{
 			event_log().post(shared_ptr<EventDetail>(
-				new EventMsg(L"Torrent info removal error.", event_logger::warning)));
+				new EventTorrentMsg(id(l), L"Torrent info removal error.", event_logger::warning)));
 		}
 	}
 
@@ -442,6 +514,9 @@ public:
 
 		try {
 
+		if (pack_store* pack = pack_)
+			pack->erase(hash_, pack_store::torrent_file);
+
 		wpath torrent_file = hal::app().get_working_directory() / L"torrents" / filename_;
 		
 		if (exists(torrent_file))
@@ -451,7 +526,7 @@ public:
 		catch (const boost::filesystem::filesystem_error&)
 		{
 			event_log().post(shared_ptr<EventDetail>(
-				new EventMsg(L"Torrent file removal error.", event_logger::warning)));
+				new EventTorrentMsg(id(l), L"Torrent file removal error.", event_logger::warning)));
 		}
 	}
 	
@@ -483,12 +558,14 @@ public:
 			handle_.move_storage(path_to_utf8(s));
 			
 			save_directory_ = s;
+			touch();
 		}
 		else if (!in_session(l) && force)
 		{
 			upgrade_to_unique_lock up_l(l);
 			
 			save_directory_ = s;
+			touch();
 		}
 	}
 
@@ -511,6 +588,7 @@ public:
 
 				handle_.move_storage(path_to_utf8(m));
 				save_directory_ = move_to_directory_ = m;
+				touch();
 			}
 		}
 		else
@@ -518,6 +596,7 @@ public:
 			upgrade_to_unique_lock up_l(l);
 
 			move_to_directory_ = m;
+			touch();
 		}
 	}
 
@@ -630,6 +709,9 @@ public:
 		using boost::serialization::make_nvp;
 		switch (version)
 		{
+		case 6:
+			ar & make_nvp("info_checksum", info_checksum_);
+
 		case 5:
 			ar & make_nvp("magnet_uri", magnet_uri_);
 			ar & make_nvp("super_seeding", superseeding_);
@@ -769,6 +851,16 @@ private:
 	void init_file_details(upgrade_lock& l);
 	
 	static boost::scoped_ptr<libt::session>* the_session_;
+	static resume_data_writer* resume_writer_;
+	// Read once into a local by each user, bit_impl::use_pack_store can clear it at any time.
+	static std::atomic<pack_store*> pack_;
+	static service_strand* metadata_strand_;
+	static function<void ()> state_signal_;
+
+	static void signal_state() { if (state_signal_) state_signal_(); }
+
+	static torrent_info_ptr info_from_pack(const libt::sha1_hash& hash);
+	std::vector<std::pair<pack_store::record_kind, wpath> > store_files(upgrade_lock& l) const;
 	bool in_session(upgrade_lock& l) const;
 
 	torrent_info_ptr info_memory(upgrade_lock& l) const;	
@@ -776,8 +868,11 @@ private:
 
 	libt::torrent_status& status_cache(upgrade_lock& l) const;
 	libt::torrent_status& renew_status_cache(upgrade_lock& l) const;
+	void clear_status_rates(upgrade_lock& l) const;
+	void update_totals(upgrade_lock& l) const;
 
 	const wstring& name(upgrade_lock& l) const;	
+	const wstring& name_key(upgrade_lock& l) const;
 	const uuid& id(upgrade_lock& l) const;
 	const wpath& save_directory(upgrade_lock& l) const;
 	bool is_managed(upgrade_lock& l) const;	
@@ -792,10 +887,12 @@ private:
 	void prepare(upgrade_lock& l, torrent_info_ptr info);	
 
 	void write_torrent_info(upgrade_lock& l) const;
+	static boost::uint32_t info_checksum(const libt::torrent_info& info);
 	boost::tuple<size_t, size_t, size_t, size_t> update_peers(upgrade_lock& l) const;
 	void get_file_details(upgrade_lock& l, file_details_vec& files_vec);
 
 	void update_manager(upgrade_lock& l);
+	void touch() const { ++generation_; }
 	void initialize_non_serialized(sc::fifo_scheduler<>::processor_handle h, 
 		function<void (torrent_internal_ptr)>,
 		function<void (sc::fifo_scheduler<>::processor_handle, sc::fifo_scheduler<>::event_ptr_type)>);
@@ -824,6 +921,11 @@ private:
 	mutable boost::shared_mutex mutex_;
 	mutable boost::mutex details_mutex_;
 	mutable torrent_details_ptr details_ptr_;
+
+	// Bumped by anything that changes what get_torrent_details_ptr reports, details_ptr_ is
+	// only rebuilt when it was made from an older generation.
+	mutable std::atomic<boost::uint64_t> generation_;
+	mutable boost::uint64_t details_generation_;
 	
 	std::pair<float, float> transfer_limit_;
 	
@@ -837,6 +939,7 @@ private:
 	
 	wstring filename_;
 	mutable wstring name_;
+	mutable wstring name_key_;
 	wpath save_directory_;
 	wpath move_to_directory_;
 	wstring original_filename_;
@@ -863,6 +966,7 @@ private:
 	boost::uuids::uuid uuid_;
 	libt::sha1_hash hash_;
 	wstring hash_str_;	
+	mutable boost::uint32_t info_checksum_;	// of the torrent info last written, 0 for none
 	std::string magnet_uri_;
 	sc::fifo_scheduler<>::processor_handle state_handle_;
 
@@ -878,6 +982,8 @@ private:
 	mutable std::vector<libt::peer_info> peers_;	
 
 	mutable float progress_;	
+	mutable float checkpoint_progress_;
+	mutable pt::ptime checkpoint_time_;
 	mutable int queue_position_;
 	mutable bool managed_;
 	mutable bool superseeding_;
@@ -889,7 +995,7 @@ private:
 
 } // namespace hal
 
-BOOST_CLASS_VERSION(hal::torrent_internal, 5)
+BOOST_CLASS_VERSION(hal::torrent_internal, 6)
 BOOST_CLASS_VERSION(hal::duration_tracker, 2)
 
 namespace boost {
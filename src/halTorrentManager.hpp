@@ -6,9 +6,12 @@
 
 #pragma once
 
+#include <boost/version.hpp>
+
 #include "halIni.hpp"
 #include "global/versioned_file.hpp"
 #include "halTorrentInternal.hpp"
+#include "halSpans.hpp"
 
 
 namespace hal 
@@ -87,7 +90,45 @@ class torrent_manager :
 	struct by_uuid{};
 	struct by_name{};
 	struct by_hash{};
+
+	// Info-hashes are SHA-1 digests, so their leading bytes are already well distributed.
+	struct big_number_hash
+	{
+		std::size_t operator()(const libt::big_number& h) const
+		{
+			std::size_t v;
+			std::memcpy(&v, &h[0], sizeof(v));
+
+			return v;
+		}
+	};
 	
+	// The info-hash index is non-unique only because torrents still waiting on their metadata
+	// share the all-zero hash; insert_holder refuses any other duplicate.
+	typedef boost::multi_index_container<
+		torrent_holder,
+		boost::multi_index::indexed_by<
+			boost::multi_index::hashed_unique<
+				boost::multi_index::tag<by_uuid>,
+				boost::multi_index::member<
+					torrent_holder, boost::uuids::uuid, &torrent_holder::id>,
+				boost::hash<boost::uuids::uuid>
+				>,
+			boost::multi_index::ordered_non_unique<
+				boost::multi_index::tag<by_name>,
+				boost::multi_index::member<
+					torrent_holder, wstring, &torrent_holder::name>
+				>,
+			boost::multi_index::hashed_non_unique<
+				boost::multi_index::tag<by_hash>,
+				boost::multi_index::member<
+					torrent_holder, libt::big_number, &torrent_holder::hash>,
+				big_number_hash
+				>
+		>
+	> torrent_multi_index;
+
+	// Layout written by class version 2, kept only so those archives can still be read.
 	typedef boost::multi_index_container<
 		torrent_holder,
 		boost::multi_index::indexed_by<
@@ -107,7 +148,7 @@ class torrent_manager :
 					torrent_holder, libt::big_number, &torrent_holder::hash>
 				>
 		>
-	> torrent_multi_index;
+	> legacy_torrent_multi_index;
 	
 public:
 	typedef torrent_multi_index::index<by_uuid>::type torrent_by_uuid;
@@ -117,7 +158,15 @@ public:
 	torrent_manager() :
 		ini_class_t(L"bittorrent", L"torrent_manager"),
 		work_file_(L"bittorrent.xml", boost::lexical_cast<boost::uuids::uuid>("7246289F-C92C-4781-A574-A1E944FD1183"), 1),
-		scheduler_(false)
+		binary_file_(L"bittorrent.bin", boost::lexical_cast<boost::uuids::uuid>("7246289F-C92C-4781-A574-A1E944FD1183"), 1),
+		migrated_work_file_(L"bittorrent.xml.migrated", boost::lexical_cast<boost::uuids::uuid>("7246289F-C92C-4781-A574-A1E944FD1183"), 1),
+		migrated_binary_file_(L"bittorrent.bin.migrated", boost::lexical_cast<boost::uuids::uuid>("7246289F-C92C-4781-A574-A1E944FD1183"), 1),
+		binary_format_(true),
+		scheduler_(false),
+		streaming_(false),
+		loads_in_flight_(0),
+		loading_done_(false),
+		loaded_(false)
 	{}
 
 	~torrent_manager()
@@ -133,43 +182,155 @@ public:
 		scheduler_.terminate();
 */	}
 
+	// Either as XML or, by default, as a binary archive of the same serialize functions.
+	// The first save after switching moves the other file aside as <name>.migrated, which
+	// load_from_ini falls back on when neither main file can be read.
+	void set_binary_format(bool b) { binary_format_ = b; }
+	bool binary_format() const { return binary_format_; }
+
 	void save_to_ini()
 	{
-		shared_wostream_ptr ofs = work_file_.wostream();		
-		boost::archive::xml_woarchive ot(*ofs);
+		// Saving before the torrents were read would replace them with an empty list.
+		if (!loaded_) return;
+
+		pt::ptime start = pt::microsec_clock::universal_time();
+
+		versioned_file& saved = binary_format_ ? binary_file_ : work_file_;
+		versioned_file& other = binary_format_ ? work_file_ : binary_file_;
+
+		boost::uint64_t generation = saved.generation();
+
+		if (binary_format_)
+		{
+			shared_ostream_ptr ofs = binary_file_.ostream();
+
+			boost::uint32_t tag = binary_build_tag();
+			ofs->write(reinterpret_cast<const char*>(&tag), sizeof(tag));
+
+			boost::archive::binary_oarchive ot(*ofs);
 
-		ot << boost::serialization::make_nvp("bittorrent", *this);
+			ot << boost::serialization::make_nvp("bittorrent", *this);
+		}
+		else
+		{
+			shared_wostream_ptr ofs = work_file_.wostream();		
+			boost::archive::xml_woarchive ot(*ofs);
+
+			ot << boost::serialization::make_nvp("bittorrent", *this);
+		}
+
+		HAL_DEV_FORMAT(L"Saved %1% torrents to %2% in %3%ms", torrents_.size(), saved.main_file(),
+			(pt::microsec_clock::universal_time() - start).total_milliseconds());
+
+		// Only once the new file is certainly down.
+		if (saved.generation() > generation && other.exists())
+		{
+			other.retire();
+
+			hal::event_log().post(boost::shared_ptr<hal::EventDetail>(
+				new hal::EventMsg(hal::wform(L"Torrent state moved to %1%.") % saved.main_file(), hal::event_logger::info)));
+		}
 	}	
 
+	// Takes the binary file when there's a good copy of it and the XML otherwise, then the
+	// copies moved aside by a format switch. Should anything be on disk and none of it be
+	// readable, saving stays off so the unread torrents aren't replaced with an empty list.
 	bool load_from_ini()
 	{
-		try 
-		{
+		HAL_SPAN("torrent_manager::load_from_ini");
+
+		pt::ptime start = pt::microsec_clock::universal_time();
 
-		if (boost::optional<shared_wistream_ptr> ifs = work_file_.wistream())
+		// A partial read leaves its torrents behind, insert_holder turns their second copy away.
+		if (load_binary(binary_file_, start) || load_xml(work_file_, start))
 		{
-			boost::archive::xml_wiarchive it(**ifs);
+			loaded_ = true;
+			return true;
+		}
 
-			it >> boost::serialization::make_nvp("bittorrent", *this);
+		if (load_binary(migrated_binary_file_, start) || load_xml(migrated_work_file_, start))
+		{
+			hal::event_log().post(boost::shared_ptr<hal::EventDetail>(
+				new hal::EventMsg(hal::wform(L"Torrent state read from the copy kept by the last format change."), 
+					hal::event_logger::warning)));
 
+			loaded_ = true;
 			return true;
 		}
+
+		if (binary_file_.exists() || work_file_.exists() || 
+			migrated_binary_file_.exists() || migrated_work_file_.exists())
+		{
+			hal::event_log().post(boost::shared_ptr<hal::EventDetail>(
+				new hal::EventMsg(hal::wform(L"Torrent state couldn't be read, it won't be saved over this session."), 
+					hal::event_logger::critical)));
+		}
 		else
-			return false;
-		
+			loaded_ = true;
+
+		return false;
+	}
+
+	// Loads like load_from_ini but starts every torrent as soon as it has been read. Records
+	// go to a pool which parses their torrent info and then on to the thread running
+	// process_events, which inserts and starts them, so the session is busy long before the
+	// archive is finished. Returns with everything loaded, as load_from_ini does.
+	bool load_streaming()
+	{
+		HAL_SPAN("torrent_manager::load_streaming");
+
+		pt::ptime start = pt::microsec_clock::universal_time();
+
+		streaming_ = true;
+		first_started_ = pt::ptime();
+
+		bool loaded = load_from_ini();
+
+		{	boost::mutex::scoped_lock l(load_mutex_);
+
+			loading_done_ = true;
+			load_cond_.notify_all();
 		}
-		catch (const std::exception& e)
-		{			
-			hal::event_log().post(boost::shared_ptr<hal::EventDetail>(
-				new hal::EventXmlException(hal::from_utf8(e.what()), L"load_from_ini"))); 
 
-			return false;
+		prefetchers_.join_all();
+
+		{	boost::mutex::scoped_lock l(load_mutex_);
+
+			while (loads_in_flight_ != 0)
+			{
+				if (event_notify_)
+					load_cond_.wait(l);
+				else
+				{
+					l.unlock();
+					start_loaded();
+					l.lock();
+				}
+			}
+
+			streaming_ = false;
+			loading_done_ = false;
 		}
+
+		apply_queue_positions();
+
+		if (!first_started_.is_not_a_date_time())
+			hal::event_log().post(boost::shared_ptr<hal::EventDetail>(
+				new hal::EventMsg(hal::wform(L"Streamed %1% torrents, the first started after %2%ms and all after %3%ms.")
+					% torrents_.size() % (first_started_ - start).total_milliseconds()
+					% (pt::microsec_clock::universal_time() - start).total_milliseconds(), hal::event_logger::info)));
+
+		return loaded;
 	}
 
+	bool loaded() const { return loaded_; }
+
 	void start_all()
 	{
 		HAL_DEBUG_MSG(wform(L"Manager start all %1%") % torrents_.size());
+		HAL_SPAN("torrent_manager::start_all");
+
+		torrent_info_map infos = prefetch_torrent_info();
 
 		for (torrent_by_uuid::iterator i= torrents_.get<by_uuid>().begin(), e = torrents_.get<by_uuid>().end(); i != e; /**/)
 	//	for (const torrent_holder& t : torrents_)
@@ -183,14 +344,12 @@ public:
 
 				const torrent_holder& t = *i;
 
-				if (!t.hash.is_all_zeros())
-					if (std::count(torrents_.get<by_hash>().begin(), torrents_.get<by_hash>().end(), t) > 1)
-					{
-						HAL_DEV_MSG(L"Erasing duplicate torrent");
-						erase(i++);
-
-						continue;
-					}
+				// Already started while streaming in.
+				if (t.torrent && t.torrent->state_handle())
+				{
+					++i;
+					continue;
+				}
 
 				if (t.torrent && t.torrent->id() != t.id)
 				{
@@ -200,8 +359,10 @@ public:
 					continue;
 				}
 										
+				torrent_info_map::const_iterator info = infos.find(t.id);
+										
 				initiate_torrent((*i).torrent, bind(&torrent_manager::update_torrent, this, _1));
-				(*i).torrent->start();	
+				(*i).torrent->start(info != infos.end() ? info->second : torrent_internal::torrent_info_ptr());	
 				
 				++i;
 				
@@ -259,9 +420,7 @@ public:
 	{
 		torrent_internal_ptr t = torrent_internal_ptr(new torrent_internal(filename, save_directory, alloc, move_to_directory));
 
-		std::pair<torrent_by_name::iterator, bool> p = torrents_.get<by_name>().insert(torrent_holder(t));
-
-		if (!p.second) // Torrent already present
+		if (!insert_holder(torrent_holder(t))) // Torrent already present
 			t.reset();
 		else
 			initiate_torrent(t, bind(&torrent_manager::update_torrent, this, _1));
@@ -274,9 +433,7 @@ public:
 	{
 		torrent_internal_ptr t = torrent_internal_ptr(new torrent_internal(uri, save_directory, alloc, move_to_directory));
 
-		std::pair<torrent_by_hash::iterator, bool> p = torrents_.get<by_hash>().insert(torrent_holder(t));
-
-		if (!p.second) // Torrent already present
+		if (!insert_holder(torrent_holder(t))) // Torrent already present
 			t.reset();
 		else
 			initiate_torrent(t, bind(&torrent_manager::update_torrent, this, _1));
@@ -374,10 +531,18 @@ public:
 	void process_torrent_event(sc::fifo_scheduler<>::processor_handle h, sc::fifo_scheduler<>::event_ptr_type e)
 	{
 		scheduler_.queue_event(h, e);
+
+		if (event_notify_) event_notify_();
+	}
+
+	void set_event_notify(function<void ()> fn)
+	{
+		event_notify_ = fn;
 	}
 
 	void process_events()
 	{
+		start_loaded();
 		scheduler_();
 	}
 
@@ -448,26 +613,254 @@ public:
 	
 	friend class boost::serialization::access;
 	template<class Archive>
-	void serialize(Archive& ar, const unsigned int version)
+	void save(Archive& ar, const unsigned int version) const
+	{
+		using boost::serialization::make_nvp;
+
+		// One record after another so load can hand each on as it's read.
+		// Fixed width, the binary archive is shared by the 32 and 64 bit builds.
+		boost::uint64_t count = torrents_.size();
+		ar & make_nvp("count", count);
+
+		for (torrent_by_name::const_iterator i = torrents_.get<by_name>().begin(), 
+			e = torrents_.get<by_name>().end(); i != e; ++i)
+		{
+			ar & make_nvp("torrent", *i);
+		}
+	}
+
+	template<class Archive>
+	void load(Archive& ar, const unsigned int version)
 	{
 		using boost::serialization::make_nvp;
 		switch (version)
 		{
-		case 2:			
-			ar & make_nvp("torrents", torrents_);
-		
+		case 4:
+			{
+			boost::uint64_t count = 0;
+			ar & make_nvp("count", count);
+
+			clear_holders(static_cast<std::size_t>(count));
+
+			for (boost::uint64_t n = 0; n != count; ++n)
+			{
+				torrent_holder t;
+				ar & make_nvp("torrent", t);
+
+				add_holder(t);
+			}
+			}
+		break;
+
+		case 3:
+			{
+			std::vector<torrent_holder> torrents;
+			ar & make_nvp("torrents", torrents);
+
+			insert_holders(torrents.begin(), torrents.end());
+			}
+		break;
+
+		case 2:
+			{
+			legacy_torrent_multi_index torrents;
+			ar & make_nvp("torrents", torrents);
+
+			insert_holders(torrents.begin(), torrents.end());
+			}
 		break;
 
 		case 1:
 		default:
 			assert(false);
 		}
-	}	
+	}
+
+	BOOST_SERIALIZATION_SPLIT_MEMBER()
 	
 private:
+	typedef boost::unordered_map<uuid, torrent_internal::torrent_info_ptr, boost::hash<uuid> > torrent_info_map;
+
+	torrent_info_map prefetch_torrent_info()
+	{
+		std::vector<torrent_internal_ptr> pending;
+		pending.reserve(torrents_.size());
+
+		// Those streamed in were parsed and started already, start_all passes them over.
+		for (torrent_by_uuid::iterator i = torrents_.get<by_uuid>().begin(), 
+			e = torrents_.get<by_uuid>().end(); i != e; ++i)
+		{
+			if (i->torrent && !i->torrent->state_handle()) pending.push_back(i->torrent);
+		}
+
+		std::vector<torrent_internal::torrent_info_ptr> loaded(pending.size());
+		std::atomic<size_t> next(0);
+
+		// Metadata parsing is mostly bdecoding and hashing, so one worker per core is plenty.
+		unsigned workers = std::max(1u, std::min(boost::thread::hardware_concurrency(), 8u));
+		boost::thread_group pool;
+
+		for (unsigned n = 0; n < workers && n < pending.size(); ++n)
+			pool.create_thread([&]()
+			{
+				for (size_t j = next++; j < pending.size(); j = next++)
+					loaded[j] = pending[j]->prefetch_torrent_info();
+			});
+
+		pool.join_all();
+
+		torrent_info_map infos;
+		for (size_t j = 0; j < pending.size(); ++j)
+		{
+			if (loaded[j]) infos[pending[j]->id()] = loaded[j];
+		}
+
+		HAL_DEV_MSG(hal::wform(L"Prefetched torrent info for %1% of %2% torrents") % infos.size() % pending.size());
+
+		return infos;
+	}
+
+	void queue_prefetch(const torrent_holder& t)
+	{
+		boost::mutex::scoped_lock l(load_mutex_);
+
+		if (prefetchers_.size() == 0)
+		{
+			unsigned workers = std::max(1u, std::min(boost::thread::hardware_concurrency(), 8u));
+
+			for (unsigned n = 0; n < workers; ++n)
+				prefetchers_.create_thread(bind(&torrent_manager::prefetch_loaded, this));
+		}
+
+		prefetch_queue_.push_back(t);
+		++loads_in_flight_;
+
+		load_cond_.notify_all();
+	}
+
+	void prefetch_loaded()
+	{
+		spans().name_thread("Torrent info prefetch");
+
+		for ( ; ; )
+		{
+			torrent_holder t;
+
+			{	boost::mutex::scoped_lock l(load_mutex_);
+
+				while (prefetch_queue_.empty() && !loading_done_)
+					load_cond_.wait(l);
+
+				if (prefetch_queue_.empty()) return;
+
+				t = prefetch_queue_.front();
+				prefetch_queue_.pop_front();
+			}
+
+			torrent_internal::torrent_info_ptr info;
+			if (t.torrent) 
+			{
+				HAL_SPAN("Prefetch torrent info", t.name);
+				info = t.torrent->prefetch_torrent_info();
+			}
+
+			{	boost::mutex::scoped_lock l(load_mutex_);
+
+				start_queue_.push_back(std::make_pair(t, info));
+			}
+
+			if (event_notify_) event_notify_();
+		}
+	}
+
+	// Runs on whichever thread calls process_events.
+	void start_loaded()
+	{
+		std::deque<std::pair<torrent_holder, torrent_internal::torrent_info_ptr> > ready;
+
+		{	boost::mutex::scoped_lock l(load_mutex_);
+
+			if (start_queue_.empty()) return;
+			ready.swap(start_queue_);
+		}
+
+		HAL_SPAN("torrent_manager::start_loaded");
+
+		for (auto r = ready.begin(), e = ready.end(); r != e; ++r)
+		{
+			const torrent_holder& t = r->first;
+
+			if (!t.torrent || t.torrent->id() != t.id || !insert_holder(t))
+			{
+				HAL_DEV_MSG(hal::wform(L"Dropping duplicate torrent %1%") % t.name);
+				continue;
+			}
+
+			try 
+			{
+
+			initiate_torrent(t.torrent, bind(&torrent_manager::update_torrent, this, _1));
+			t.torrent->start(r->second);
+
+			if (first_started_.is_not_a_date_time())
+				first_started_ = pt::microsec_clock::universal_time();
+
+			}
+			catch(const std::exception& e) 
+			{
+				hal::event_log().post(shared_ptr<hal::EventDetail>(
+					new hal::EventStdException(hal::event_logger::warning, e, L"torrent_manager::start_loaded")));
+				
+				torrent_by_uuid::iterator i = torrents_.get<by_uuid>().find(t.id);
+				if (i != torrents_.get<by_uuid>().end()) erase(i);
+			}
+		}
+
+		boost::mutex::scoped_lock l(load_mutex_);
+
+		loads_in_flight_ -= ready.size();
+		load_cond_.notify_all();
+	}
+
+	bool insert_holder(const torrent_holder& t)
+	{
+		if (!t.hash.is_all_zeros() && torrents_.get<by_hash>().count(t.hash) != 0)
+			return false;
+
+		return torrents_.insert(t).second;
+	}
+
+	template<typename I>
+	void insert_holders(I first, I last)
+	{
+		clear_holders(std::distance(first, last));
+
+		for (; first != last; ++first)
+			add_holder(*first);
+	}
+
+	// While streaming the alert thread is inserting, so a fallback to the other format after
+	// a partial read keeps what has been started and its duplicates are dropped instead.
+	void clear_holders(std::size_t n)
+	{
+		if (streaming_) return;
+
+		torrents_.clear();
+		torrents_.get<by_uuid>().reserve(n);
+		torrents_.get<by_hash>().reserve(n);
+	}
+
+	void add_holder(const torrent_holder& t)
+	{
+		if (streaming_)
+			queue_prefetch(t);
+		else if (!insert_holder(t))
+			HAL_DEV_MSG(hal::wform(L"Dropping duplicate torrent %1%") % t.name);
+	}
+
 	torrent_internal_ptr erase_duplicates_by_hash(const libt::big_number& hash)
 	{
-		auto p = std::equal_range(torrents_.get<by_hash>().begin(), torrents_.get<by_hash>().end(), torrent_holder(hash));
+		auto p = torrents_.get<by_hash>().equal_range(hash);
 		auto d = std::distance(p.first, p.second);
 				
 		if (d != 1)
@@ -490,6 +883,82 @@ private:
 		return p.first->torrent;
 	}
 
+	// binary_oarchive writes size_t and its own layout as they are, and both differ between
+	// the 32 and 64 bit builds and across Boost releases. The tag in front of the archive
+	// keeps another build's file from being misread.
+	static boost::uint32_t binary_build_tag()
+	{
+		return static_cast<boost::uint32_t>(sizeof(std::size_t)) << 24 | BOOST_VERSION;
+	}
+
+	bool load_binary(versioned_file& f, pt::ptime start)
+	{
+		try 
+		{
+
+		boost::optional<shared_istream_ptr> ifs = f.istream();
+		if (!ifs) return false;
+
+		boost::uint32_t tag = 0;
+		(*ifs)->read(reinterpret_cast<char*>(&tag), sizeof(tag));
+
+		if (!**ifs || tag != binary_build_tag())
+		{
+			hal::event_log().post(boost::shared_ptr<hal::EventDetail>(
+				new hal::EventMsg(hal::wform(L"%1% was written by another build, it can't be read here.") % f.main_file(),
+					hal::event_logger::warning)));
+
+			return false;
+		}
+
+		boost::archive::binary_iarchive it(**ifs);
+		it >> boost::serialization::make_nvp("bittorrent", *this);
+
+		log_loaded(f, start);
+		return true;
+
+		}
+		catch (const std::exception& e)
+		{			
+			hal::event_log().post(boost::shared_ptr<hal::EventDetail>(
+				new hal::EventXmlException(hal::from_utf8(e.what()), L"load_from_ini"))); 
+
+			return false;
+		}
+	}
+
+	bool load_xml(versioned_file& f, pt::ptime start)
+	{
+		try 
+		{
+
+		boost::optional<shared_wistream_ptr> ifs = f.wistream();
+		if (!ifs) return false;
+
+		boost::archive::xml_wiarchive it(**ifs);
+		it >> boost::serialization::make_nvp("bittorrent", *this);
+
+		log_loaded(f, start);
+		return true;
+
+		}
+		catch (const std::exception& e)
+		{			
+			hal::event_log().post(boost::shared_ptr<hal::EventDetail>(
+				new hal::EventXmlException(hal::from_utf8(e.what()), L"load_from_ini"))); 
+
+			return false;
+		}
+	}
+
+	void log_loaded(const versioned_file& f, pt::ptime start)
+	{
+		hal::event_log().post(boost::shared_ptr<hal::EventDetail>(
+			new hal::EventMsg(hal::wform(L"Loaded %1% torrents from %2%, generation %3%, in %4%ms.")
+				% torrents_.size() % f.main_file() % f.generation()
+				% (pt::microsec_clock::universal_time() - start).total_milliseconds(), hal::event_logger::info)));
+	}
+
 	void display_holder(const torrent_holder& t)
 	{
 		HAL_DEV_MSG(hal::wform(L"Holder name : %1%") % t.name);
@@ -498,12 +967,29 @@ private:
 	}
 
 	versioned_file work_file_;
+	versioned_file binary_file_;
+	versioned_file migrated_work_file_;
+	versioned_file migrated_binary_file_;
+	bool binary_format_;
 //	ini_file& ini_;
 	torrent_multi_index torrents_;
 	sc::fifo_scheduler<> scheduler_;
+	function<void ()> event_notify_;
+
+	// Streaming load state, see load_streaming.
+	bool streaming_;
+	boost::mutex load_mutex_;
+	boost::condition_variable load_cond_;
+	std::deque<torrent_holder> prefetch_queue_;
+	std::deque<std::pair<torrent_holder, torrent_internal::torrent_info_ptr> > start_queue_;
+	size_t loads_in_flight_;
+	bool loading_done_;
+	boost::thread_group prefetchers_;
+	pt::ptime first_started_;
+	bool loaded_;
 };
 
 };
 
-BOOST_CLASS_VERSION(hal::torrent_manager, 2)
+BOOST_CLASS_VERSION(hal::torrent_manager, 4)
 BOOST_CLASS_VERSION(hal::torrent_manager::torrent_holder, 3)
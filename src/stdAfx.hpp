@@ -59,6 +59,10 @@ extern WTL::CAppModule _Module;
 #include <iterator>
 #include <iomanip>
 #include <map>
+#include <deque>
+#include <mutex>
+#include <type_traits>
+#include <tuple>
 #include <algorithm>
 #include <string>
 #include <vector>
@@ -0,0 +1,226 @@
+
+//         Copyright Ein O'Callaghan 2009 - 2009.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Saves and loads torrent_manager's state through its own save_to_ini and load_from_ini,
+// in both formats and across a format change, and checks a state which can't be read is
+// never saved over.
+//
+//	halStateTest [--torrents <n>] [--dir <path>]
+//
+// Returns non zero when any check fails.
+
+#include "halPch.hpp"
+
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/program_options.hpp>
+
+#include <libtorrent/bencode.hpp>
+#include <libtorrent/create_torrent.hpp>
+#include <libtorrent/hasher.hpp>
+
+#include "global/wtl_app.hpp"
+#include "global/string_conv.hpp"
+
+#include "halTorrent.hpp"
+#include "halTorrentInternal.hpp"
+#include "halTorrentManager.hpp"
+
+WTL::CAppModule _Module;
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+namespace libt = libtorrent;
+
+namespace
+{
+
+typedef std::map<hal::uuid, std::wstring> expected_torrents;
+
+int failures = 0;
+
+void check(bool ok, const std::string& what)
+{
+	std::cout << (ok ? "ok     " : "FAILED ") << what << std::endl;
+
+	if (!ok) ++failures;
+}
+
+std::vector<fs::wpath> write_torrents(size_t n, const fs::wpath& dir)
+{
+	const int piece_size = 64 * 1024;
+
+	fs::create_directories(dir);
+	std::vector<fs::wpath> files;
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		std::string name = (boost::format("State.Test.Torrent.%1%") % i).str();
+
+		libt::file_storage storage;
+		for (int f = 0; f < 4; ++f)
+			storage.add_file((boost::format("%1%/File %2%.bin") % name % f).str(), piece_size * 2);
+
+		libt::create_torrent ct(storage, piece_size);
+
+		for (int p = 0; p < ct.num_pieces(); ++p)
+		{
+			std::string seed = (boost::format("%1%.%2%") % i % p).str();
+			ct.set_hash(p, libt::hasher(seed.data(), static_cast<int>(seed.size())).final());
+		}
+
+		std::vector<char> buffer;
+		libt::bencode(std::back_inserter(buffer), ct.generate());
+
+		fs::wpath file = dir / hal::from_utf8(name + ".torrent");
+		fs::ofstream out(file, std::ios_base::binary);
+		out.write(buffer.data(), buffer.size());
+
+		if (!out)
+			throw std::runtime_error("can't write " + hal::to_utf8(file.wstring()));
+
+		files.push_back(file);
+	}
+
+	return files;
+}
+
+bool matches(hal::torrent_manager& m, const expected_torrents& expected)
+{
+	if (m.size() != expected.size()) return false;
+
+	for (hal::torrent_manager::torrent_by_name::iterator i = m.begin(), e = m.end(); i != e; ++i)
+	{
+		expected_torrents::const_iterator x = expected.find((*i).torrent->id());
+
+		if (x == expected.end() || x->second != (*i).torrent->name()) 
+			return false;
+	}
+
+	return true;
+}
+
+void remove_files(const fs::wpath& dir, const std::wstring& prefix)
+{
+	std::vector<fs::wpath> doomed;
+
+	for (fs::directory_iterator i(dir), e; i != e; ++i)
+		if (i->path().filename().wstring().compare(0, prefix.size(), prefix) == 0)
+			doomed.push_back(i->path());
+
+	for (const fs::wpath& p : doomed)
+		fs::remove(p);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	size_t n = 64;
+	std::string dir_arg;
+
+	po::options_description options("Options");
+	options.add_options()
+		("help", "this message")
+		("torrents", po::value<size_t>(&n)->default_value(n), "torrents to save and load")
+		("dir", po::value<std::string>(&dir_arg), "scratch directory, a temporary one by default");
+
+	po::variables_map vm;
+	po::store(po::parse_command_line(argc, argv, options), vm);
+	po::notify(vm);
+
+	if (vm.count("help"))
+	{
+		std::cout << options << std::endl;
+		return 0;
+	}
+
+	fs::wpath dir = dir_arg.empty() ? 
+		fs::temp_directory_path() / fs::unique_path(L"halStateTest-%%%%-%%%%") : 
+		fs::wpath(hal::from_utf8(dir_arg));
+
+	fs::create_directories(dir);
+	hal::app().set_working_directory(dir);
+
+	try
+	{
+
+	std::vector<fs::wpath> files = write_torrents(n, dir / L"torrents");
+	expected_torrents expected;
+
+	{	hal::torrent_manager m;
+
+		check(!m.load_from_ini(), "nothing is loaded from an empty directory");
+		check(m.loaded(), "an empty directory can be saved to");
+
+		for (const fs::wpath& f : files)
+		{
+			hal::torrent_internal_ptr t = m.create_torrent(f, dir / L"save", hal::bit::sparse_allocation);
+			if (t) expected[t->id()] = t->name();
+		}
+
+		check(expected.size() == n, "every torrent is created");
+		check(!m.create_torrent(files.front(), dir / L"save", hal::bit::sparse_allocation), 
+			"a duplicate is turned away");
+
+		m.save_to_ini();
+	}
+
+	{	hal::torrent_manager m;
+
+		check(m.load_from_ini() && m.loaded(), "the binary state loads");
+		check(matches(m, expected), "the binary state holds every torrent");
+
+		m.set_binary_format(false);
+		m.save_to_ini();
+	}
+
+	check(fs::exists(dir / L"bittorrent.bin.migrated"), "a format change moves the binary state aside");
+
+	{	hal::torrent_manager m;
+
+		check(m.load_from_ini() && m.loaded(), "the XML state loads");
+		check(matches(m, expected), "the XML state holds every torrent");
+	}
+
+	remove_files(dir, L"bittorrent.xml");
+
+	{	hal::torrent_manager m;
+
+		check(m.load_from_ini() && m.loaded(), "the moved aside state loads when it's all there is");
+		check(matches(m, expected), "the moved aside state holds every torrent");
+	}
+
+	{	fs::ofstream out(dir / L"bittorrent.bin.migrated", std::ios_base::binary | std::ios_base::trunc);
+		out << "not a torrent state";
+	}
+
+	{	hal::torrent_manager m;
+
+		check(!m.load_from_ini() && !m.loaded(), "an unreadable state isn't taken as loaded");
+
+		m.save_to_ini();
+	}
+
+	check(!fs::exists(dir / L"bittorrent.bin"), "an unreadable state isn't saved over");
+
+	}
+	catch (const std::exception& e)
+	{
+		std::cout << "FAILED " << e.what() << std::endl;
+		++failures;
+	}
+
+	if (dir_arg.empty())
+	{
+		boost::system::error_code ec;
+		fs::remove_all(dir, ec);
+	}
+
+	std::cout << (failures ? "FAILED" : "passed") << std::endl;
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,182 @@
+
+//         Copyright Ein O'Callaghan 2009 - 2009.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Decodes the binary event logs written by hal::binary_event_log.
+//
+//	halEventDump [--torrent <uuid>] [--level <name>] [--from <time>] [--to <time>] files...
+//
+// Times are "2009-05-01 12:00:00" style, UTC. Files are read in the order given, so pass the
+// rotated ones oldest first, HaliteEvents.7.bin ... HaliteEvents.bin.
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/format.hpp>
+#include <boost/optional.hpp>
+#include <boost/program_options.hpp>
+#include <boost/uuid/uuid_io.hpp>
+#include <boost/uuid/string_generator.hpp>
+
+#include "../halEventLogFormat.hpp"
+
+namespace po = boost::program_options;
+namespace pt = boost::posix_time;
+namespace fmt = hal::event_log_format;
+
+namespace
+{
+
+struct filter
+{
+	boost::optional<boost::uuids::uuid> torrent;
+	unsigned min_level;
+	boost::optional<boost::int64_t> from;
+	boost::optional<boost::int64_t> to;
+
+	bool operator()(const fmt::record& r) const
+	{
+		if (r.level < min_level) return false;
+		if (torrent && r.torrent != *torrent) return false;
+		if (from && r.time < *from) return false;
+		if (to && r.time > *to) return false;
+
+		return true;
+	}
+};
+
+const pt::ptime epoch(boost::gregorian::date(1970, 1, 1));
+
+boost::int64_t to_micro(const std::string& s)
+{
+	return (pt::time_from_string(s) - epoch).total_microseconds();
+}
+
+unsigned parse_level(const std::string& s)
+{
+	for (unsigned l = 0; ; ++l)
+	{
+		std::string name = fmt::level_name(l);
+
+		if (name == s) return l;
+		if (name == "unknown") throw std::invalid_argument("unknown level " + s);
+	}
+}
+
+std::string render(const fmt::record& r)
+{
+	if (!r.format.empty())
+	{
+		try
+		{
+
+		boost::format f(r.format);
+		for (const std::string& a : r.args)
+			f % a;
+
+		return f.str();
+
+		}
+		catch (const boost::io::format_error&)
+		{
+			// Fall through and show the pieces, better than losing the record.
+		}
+	}
+
+	std::string out = r.format;
+	for (const std::string& a : r.args)
+		out += (out.empty() ? "" : " | ") + a;
+
+	return out;
+}
+
+bool dump(const std::string& name, const filter& accept)
+{
+	boost::filesystem::ifstream ifs(boost::filesystem::path(name), std::ios::binary);
+
+	if (!ifs || !fmt::read_header(ifs))
+	{
+		std::cerr << name << ": not a Halite event log" << std::endl;
+		return false;
+	}
+
+	fmt::record r;
+	std::vector<char> scratch;
+
+	while (fmt::read_record(ifs, r, scratch))
+	{
+		if (!accept(r)) continue;
+
+		std::cout << pt::to_iso_extended_string(epoch + pt::microseconds(r.time))
+			<< ' ' << fmt::level_name(r.level);
+
+		if (!r.torrent.is_nil())
+			std::cout << ' ' << r.torrent;
+		if (r.code)
+			std::cout << " #" << r.code;
+
+		std::cout << ' ' << render(r) << '\n';
+	}
+
+	return true;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	std::string torrent, level, from, to;
+	std::vector<std::string> files;
+
+	po::options_description desc("Options");
+	desc.add_options()
+		("help", "show this message")
+		("torrent", po::value<std::string>(&torrent), "only events about this torrent uuid")
+		("level", po::value<std::string>(&level), "only events at or above this level")
+		("from", po::value<std::string>(&from), "only events at or after this UTC time")
+		("to", po::value<std::string>(&to), "only events at or before this UTC time")
+		("file", po::value<std::vector<std::string> >(&files), "event log files");
+
+	po::positional_options_description positional;
+	positional.add("file", -1);
+
+	try
+	{
+
+	po::variables_map vm;
+	po::store(po::command_line_parser(argc, argv).options(desc).positional(positional).run(), vm);
+	po::notify(vm);
+
+	if (vm.count("help") || files.empty())
+	{
+		std::cout << "halEventDump [options] files...\n" << desc << std::endl;
+		return 1;
+	}
+
+	filter accept;
+	accept.min_level = level.empty() ? 0 : parse_level(level);
+
+	if (!torrent.empty()) accept.torrent = boost::uuids::string_generator()(torrent);
+	if (!from.empty()) accept.from = to_micro(from);
+	if (!to.empty()) accept.to = to_micro(to);
+
+	bool ok = true;
+	for (const std::string& f : files)
+		ok = dump(f, accept) && ok;
+
+	std::cout.flush();
+
+	return ok ? 0 : 2;
+
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "halEventDump: " << e.what() << std::endl;
+		return 1;
+	}
+}